@@ -25,6 +25,7 @@ IMPLS = {
     'wolfcrypt-sha3-256': {'name': 'SHA3-256', 'short-name': 'SHA3-256', 'block_size': 32, 'marker': '<', 'linestyle': 'dashed', 'color': 'red'},
     # 'wolfcrypt-blake2s': {'name': 'BLAKE2s', 'short-name': 'BLAKE2s', 'block_size': 32, 'marker': '1', 'linestyle': 'dashed', 'color': 'purple'},
     'blake3-blake3': {'name': 'BLAKE3', 'short-name': 'BLAKE3', 'block_size': 32, 'marker': '2', 'linestyle': 'dotted', 'color': 'brown'},
+    'aesni-haraka-256': {'name': 'Haraka-256', 'short-name': 'Haraka-256', 'block_size': 32, 'marker': 'd', 'linestyle': 'dotted', 'color': 'teal'},
     'aes-ni-mixctr': {'name': 'MixCTR', 'short-name': 'MixCTR', 'block_size': 48, 'marker': '*', 'linestyle': 'dotted', 'color': 'pink'},
     # 'openssl-mixctr': {'name': 'MixCTR', 'short-name': 'MixCTR', 'block_size': 48, 'marker': '*', 'linestyle': 'solid', 'color': 'pink'},
     # 'wolfcrypt-mixctr': {'name': 'MixCTR', 'short-name': 'MixCTR', 'block_size': 48, 'marker': '*', 'linestyle': 'dashed', 'color': 'pink'},
@@ -32,6 +33,7 @@ IMPLS = {
     'openssl-blake2b': {'name': 'BLAKE2b', 'short-name': 'BLAKE2b', 'block_size': 64, 'marker': '3', 'linestyle': 'solid', 'color': 'olive'},
     'wolfcrypt-sha3-512': {'name': 'SHA3-512', 'short-name': 'SHA3-512', 'block_size': 64, 'marker': '>', 'linestyle': 'dashed', 'color': 'grey'},
     # 'wolfcrypt-blake2b': {'name': 'BLAKE2b', 'short-name': 'BLAKE2b', 'block_size': 64, 'marker': '3', 'linestyle': 'dashed', 'color': 'olive'},
+    'aesni-haraka-512': {'name': 'Haraka-512', 'short-name': 'Haraka-512', 'block_size': 64, 'marker': 'H', 'linestyle': 'dotted', 'color': 'darkred'},
     # 'xkcp-xoodyak': {'name': 'Xoodyak', 'short-name': 'Xoodyak', 'block_size': 48, 'marker': 'p', 'linestyle': 'dotted', 'color': 'cyan'},
     # 'xkcp-xoofff-wbc': {'name': 'Xoofff-WBC', 'short-name': 'Xoofff-WBC', 'block_size': 48, 'marker': 'h', 'linestyle': 'dotted', 'color': 'lightcoral'},
     # 'openssl-shake256': {'name': 'SHAKE256', 'short-name': 'SHAKE256', 'block_size': 128, 'marker': '^', 'linestyle': 'solid', 'color': 'gold'},
@@ -0,0 +1,80 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "ctx.h"
+#include "types.h"
+
+// Number of workers of the pool when it is started by the first submission,
+// where 0 is one per core available (see `get_default_threads`).
+#define KEYMIX_ASYNC_WORKERS 0
+
+// An encryption job, see `encrypt_submit`.
+typedef struct keymix_job keymix_job_t;
+
+// Called by a worker of the pool when `job` is over, with its error code and
+// the argument given at submission.
+typedef void (*keymix_callback_t)(keymix_job_t *job, int err, void *arg);
+
+// A queue of completed jobs, with an eventfd which is readable while the
+// queue is not empty, so that it can be polled along with sockets.
+typedef struct {
+        int fd;
+        pthread_mutex_t lock;
+        keymix_job_t *head;
+        keymix_job_t *tail;
+} keymix_queue_t;
+
+// Worker pool
+
+// Starts the worker pool running the jobs with `nof_workers` workers (0 for
+// one per core available). The jobs take turns on the workers one key at a
+// time, so that jobs of any size and from any context share them fairly. Does
+// nothing if already started.
+int keymix_async_init(uint8_t nof_workers);
+
+// Stops the worker pool once the jobs submitted are over.
+void keymix_async_shutdown(void);
+
+// Jobs
+
+// Submits the encryption of `size` bytes from `in` to `out` with the context
+// `ctx` and the `iv`, with keystreams generated by `threads` threads, and
+// returns its job without waiting for it (NULL on failure). The buffers must
+// stay valid until the job is over, which is notified to exactly one of:
+// `callback` if not NULL, otherwise `queue` if not NULL, otherwise
+// `keymix_job_wait`. Each job is a session of its own (see
+// `keymix_stream_init`), so concurrent jobs can share `ctx` in any encryption
+// mode. The result is the same as `encrypt_t`, except for the ofb encryption
+// modes, where the job starts from the key instead of the state of `ctx`.
+keymix_job_t *encrypt_submit(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
+                             uint8_t threads, keymix_callback_t callback, keymix_queue_t *queue,
+                             void *arg);
+
+// Waits for a `job` submitted with neither a callback nor a queue, and
+// returns its error code.
+int keymix_job_wait(keymix_job_t *job);
+
+// Error code of the completed `job`.
+int keymix_job_err(keymix_job_t *job);
+
+// Argument given at the submission of `job`.
+void *keymix_job_arg(keymix_job_t *job);
+
+// Frees a completed `job`.
+void keymix_job_free(keymix_job_t *job);
+
+// Completion queues
+
+// Initializes the completion queue `queue`.
+int keymix_queue_init(keymix_queue_t *queue);
+
+// Takes the next completed job out of `queue`, or NULL when it is empty.
+keymix_job_t *keymix_queue_pop(keymix_queue_t *queue);
+
+// Frees `queue`, which must be empty.
+void keymix_queue_free(keymix_queue_t *queue);
+
+#endif
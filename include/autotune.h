@@ -0,0 +1,56 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mix.h"
+
+// Size of the buffer used to microbenchmark the mix implementations
+#define AUTOTUNE_BUFFER_SIZE (1 << 20)
+
+// Number of runs per implementation, the fastest one is kept
+#define AUTOTUNE_RUNS 3
+
+// Returned by `autotune_keymix` when no single fanout fits the key size
+#define AUTOTUNE_ERR_FANOUT 2
+
+// Get the mix family given its name (e.g., "mixctr" or "shake128").
+mix_t get_mix_family(char *name);
+
+// Get the mix family name given its type.
+char *get_mix_family_name(mix_t family);
+
+// Get the path of the per-host autotuning cache, that is
+// `$XDG_CACHE_HOME/keymix/autotune-<hostname>` or
+// `$HOME/.cache/keymix/autotune-<hostname>` when XDG_CACHE_HOME is not set.
+int get_autotune_cache_path(char *path, size_t size);
+
+// Pick the fastest implementation of the given mix family on this machine.
+// The choice is looked up in the cache file at `cache_path` (or at the
+// default one when NULL) and, when missing, every implementation of the
+// family is microbenchmarked on a warm-up buffer and the winner is persisted
+// to the cache. Returns -1 if the family has no implementations.
+mix_impl_t autotune_mix(mix_t family, const char *cache_path);
+
+// Get the number of CPUs this process can actually use, that is the CPUs in
+// its affinity mask further limited by the CPU quota of its cgroup (v2 or
+// v1), if any. The result is always at least 1.
+uint8_t get_default_threads(void);
+
+// Pick the fanout and the number of threads that run keymix the fastest with
+// the given mix type, block size (0 for the default one) and key size, by
+// timing a short calibration keymix on a random key of at most
+// `AUTOTUNE_BUFFER_SIZE` bytes. Thread counts are tried
+// up to `*threads`. When `tune_fanout` is false, `*fanout` is kept as is,
+// otherwise it is picked among the fanouts compatible with the key size.
+// Returns 0 on success, `AUTOTUNE_ERR_FANOUT` when the fanout is tuned but
+// the key size only fits a mixed-radix schedule, which is not tuned, and 1
+// on any other failure.
+// NOTE: The output of keymix depends on the fanout, so decryption must use the
+// same fanout used by encryption.
+int autotune_keymix(mix_impl_t mix, block_size_t block_size, size_t key_size, bool tune_fanout,
+                    uint8_t *fanout, uint8_t *threads);
+
+#endif
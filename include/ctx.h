@@ -1,6 +1,7 @@
 #ifndef CTX_H
 #define CTX_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -9,13 +10,28 @@
 
 #define KEYMIX_NONCE_SIZE 8
 #define KEYMIX_COUNTER_SIZE 8
-#define KEYMIX_IV_SIZE KEYMIX_NONCE_SIZE + KEYMIX_COUNTER_SIZE
+#define KEYMIX_IV_SIZE (KEYMIX_NONCE_SIZE + KEYMIX_COUNTER_SIZE)
+
+// Maximum number of levels of keymix, enough for any key made of 2^63 blocks.
+#define KEYMIX_MAX_LEVELS 64
+
+// Format of the state files of the ctr-opt encryption mode (see
+// `ctx_save_state`).
+#define CTX_STATE_MAGIC "KMXSTATE"
+#define CTX_STATE_VERSION 2
+// Offset of the state in the file, a multiple of the page size so that the
+// mapped state is page-aligned.
+#define CTX_STATE_OFFSET 4096
+
+// Default number of chains of the ofb-multi encryption mode.
+#define KEYMIX_OFB_CHAINS 4
 
 typedef enum {
         ENC_MODE_CTR,
         ENC_MODE_CTR_OPT,
         ENC_MODE_CTR_CTR,
         ENC_MODE_OFB,
+        ENC_MODE_OFB_MULTI,
 } enc_mode_t;
 
 typedef enum {
@@ -28,15 +44,34 @@ typedef enum {
         CTX_ERR_INCOMPATIBLE_PRIMITIVES,
         CTX_ERR_EQUAL_PRIMITIVES,
         CTX_ERR_KEYSIZE,
+        CTX_ERR_BLOCK_SIZE,
+        CTX_ERR_FANOUT,
+        CTX_ERR_STATE,
+        CTX_ERR_KEY_LOAD,
+        CTX_ERR_CHAINS,
 } ctx_err_t;
 
+// A spread implementation, see spread.h.
+struct spread_args;
+typedef void (*spread_func_t)(struct spread_args *args);
+
 // The context for keymix operations. It houses all shared information that
-// won't be modified by the algorithm.
+// won't be modified by the algorithm, so that concurrent sessions (see
+// `keymix_stream_t`) can share it. Only `encrypt_t` in ofb encryption mode
+// advances its state.
 typedef struct {
         // The secret key.
         byte *key;
 
-        // The key's size, its number of blocks must be a power of fanout.
+        // The file the key is still to be read from by the first keymix (see
+        // `ctx_defer_key_load`), or -1 when the key is already in memory.
+        int key_fd;
+        // Held by the keymix loading the key, so that concurrent ones wait
+        // for it instead of reading a partial key.
+        pthread_mutex_t key_lock;
+
+        // The key's size, its number of blocks must be the product of the
+        // fanouts of the schedule.
         size_t key_size;
 
         // The mix type to consider.
@@ -45,9 +80,21 @@ typedef struct {
         // The mix implementation.
         mix_func_t mixpass;
 
-        // The fanout for the shuffle/spread part.
+        // The fanout for the shuffle/spread part. With a mixed-radix
+        // schedule, the fanout of the 1st spread.
         uint8_t fanout;
 
+        // Number of levels of keymix, i.e., one more than the spreads.
+        uint8_t levels;
+
+        // The fanout schedule, the spread at level i (starting from 1) uses
+        // `fanouts[i - 1]`. With a single fanout all entries are equal.
+        uint8_t fanouts[KEYMIX_MAX_LEVELS];
+
+        // The spread implementations of the levels, specialized for the block
+        // size and the fanout of the level when possible.
+        spread_func_t spreads[KEYMIX_MAX_LEVELS];
+
         // Marks this context as an encryption context.
         // That is, to do the XOR after the keymix.
         bool encrypt;
@@ -69,27 +116,108 @@ typedef struct {
 
         // Precomputation of the internal state to optimize execution of the
         // ctr encryption mode. Or store the next key of the ofb encryption
-        // mode.
+        // modes for `encrypt_t`, streams keep their own.
         byte *state;
+
+        // Number of independent chains of the ofb encryption modes, whose next
+        // keys follow each other in `state`. The ofb-multi encryption mode
+        // interleaves their keys, so that the chains advance in parallel.
+        uint8_t chains;
+
+        // The read-only mapping of the state file holding `state`, if any.
+        void *state_map;
+        size_t state_map_size;
 } ctx_t;
 
+// Header of the state files of the ctr-opt encryption mode, followed by the
+// state itself at `CTX_STATE_OFFSET`. Fields are in host byte order.
+typedef struct {
+        char magic[8];
+        uint32_t version;
+        uint32_t offset;
+        // Hash (SHA-256) of the key the state was computed from.
+        byte key_hash[32];
+        uint64_t key_size;
+        // Name of the mixing implementation, which unlike its `mix_impl_t`
+        // value stays the same across builds.
+        char mix[64];
+        uint32_t block_size;
+        uint8_t levels;
+        uint8_t fanouts[KEYMIX_MAX_LEVELS];
+} ctx_state_header_t;
+
 // Context initialization
 
 // Initializes the context `ctx` for encryption purposes with a certain `key` and setting an `iv`.
+// The precomputation of the ctr-opt encryption mode runs on `nof_threads` threads.
 ctx_err_t ctx_encrypt_init(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix, mix_impl_t one_way_mix,
-                           byte *key, size_t size, uint8_t fanout);
+                           byte *key, size_t size, uint8_t fanout, uint8_t nof_threads);
+
+// Same as `ctx_encrypt_init`, but with a custom `block_size` for the mixing
+// primitive (see `is_block_size_supported`), or its default one when 0.
+ctx_err_t ctx_encrypt_init_ex(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix,
+                              mix_impl_t one_way_mix, byte *key, size_t size, uint8_t fanout,
+                              block_size_t block_size, uint8_t nof_threads);
 
 // Initializes the context `ctx` for keymix-only purposes with a certain `key`.
 ctx_err_t ctx_keymix_init(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size, uint8_t fanout);
 
+// Same as `ctx_keymix_init`, but with a custom `block_size` for the mixing
+// primitive (see `is_block_size_supported`), or its default one when 0.
+ctx_err_t ctx_keymix_init_ex(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size, uint8_t fanout,
+                             block_size_t block_size);
+
+// Same as `ctx_keymix_init_ex`, but with a mixed-radix fanout schedule of
+// `nof_fanouts` levels (e.g., 4,4,3,2), where each fanout must be a divisor of
+// the block size. The number of blocks of the key must be the product of the
+// fanouts.
+ctx_err_t ctx_keymix_init_schedule(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size,
+                                   uint8_t *fanouts, uint8_t nof_fanouts,
+                                   block_size_t block_size);
+
+// Same as `ctx_encrypt_init_ex`, but with a mixed-radix fanout schedule (see
+// `ctx_keymix_init_schedule`).
+ctx_err_t ctx_encrypt_init_schedule(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix,
+                                    mix_impl_t one_way_mix, byte *key, size_t size,
+                                    uint8_t *fanouts, uint8_t nof_fanouts,
+                                    block_size_t block_size, uint8_t nof_threads);
+
 // Updates the context `ctx` to enable the XOR operation after doing the keymix.
 void ctx_enable_encryption(ctx_t *ctx);
 
 // Updates the context `ctx` to disable the XOR operation after doing the keymix.
 void ctx_disable_encryption(ctx_t *ctx);
 
-// Precompute internal state to optimize execution of the ctr encryption mode.
-void ctx_precompute_state(ctx_t *ctx);
+// Precompute internal state to optimize execution of the ctr encryption mode,
+// using `nof_threads` threads. Returns `CTX_ERR_STATE` on failure, leaving
+// `ctx` without a state.
+ctx_err_t ctx_precompute_state(ctx_t *ctx, uint8_t nof_threads);
+
+// Writes the precomputed state of the ctr-opt context `ctx` to a new state
+// file at `path`, bound to the key (by its hash), the mixing primitive, the
+// block size and the fanout schedule. The file is as sensitive as the key, so
+// it is only readable by its owner.
+ctx_err_t ctx_save_state(ctx_t *ctx, const char *path);
+
+// Maps read-only the state file at `path` into `ctx->state` and turns the ctr
+// or ctr-opt context `ctx` into a ctr-opt one, so that the precomputation of
+// its state can be skipped. Fails with `CTX_ERR_STATE`, leaving `ctx` as is,
+// when the file is missing, corrupted or bound to a different key or
+// configuration.
+ctx_err_t ctx_load_state(ctx_t *ctx, const char *path);
+
+// Defers the loading of the key of the ctr context `ctx` from the file `fd`
+// (at offset 0) into the `ctx->key` buffer to its first keymix, where each
+// thread reads the extent of the key it mixes first, so that the reads
+// overlap with the computation of the threads already served. Concurrent
+// encryptions wait for that keymix to be over, and the encryption fails when
+// the key cannot be read (the next one tries again).
+ctx_err_t ctx_defer_key_load(ctx_t *ctx, int fd);
+
+// Sets the number of chains of the ofb-multi context `ctx` (by default
+// `KEYMIX_OFB_CHAINS`), restarting them from the key. The keystream depends on
+// it, so encryption and decryption must agree on the number of chains.
+ctx_err_t ctx_set_ofb_chains(ctx_t *ctx, uint8_t chains);
 
 // Free `ctx` state.
 void ctx_free(ctx_t *ctx);
@@ -1,10 +1,38 @@
 #ifndef ENC_H
 #define ENC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "ctx.h"
 
+// An incremental encryption, where data is pushed in chunks of any size with
+// the same result of a single `encrypt_t` of their concatenation (on a fresh
+// context, for the ofb encryption modes). Each keystream is generated when the
+// previous one is used up.
+// A stream is the session of an encryption: it holds all of its running
+// state, so that the context is only read and can be shared by concurrent
+// streams on any thread, without duplicating the key.
+typedef struct {
+        ctx_t *ctx;
+        uint8_t threads;
+
+        // Copy of the IV, whose counter part is the one of the next keystream.
+        byte iv[KEYMIX_IV_SIZE];
+        bool has_iv;
+
+        // The counter of the next keystream, also without an IV (with the
+        // ofb-multi encryption mode, the number of keystreams generated).
+        uint64_t counter;
+
+        // The current keystream and the number of its bytes already used.
+        byte *keystream;
+        size_t offset;
+
+        // The ofb chains, i.e., the next keys of the ofb encryption modes.
+        byte *state;
+} keymix_stream_t;
+
 // Callable functions
 
 // Get counter in 64-bit unsigned int format
@@ -22,4 +50,25 @@ int encrypt(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv);
 int encrypt_t(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
               uint8_t threads);
 
+// Encrypts the `nof_msgs` messages of `sizes[i]` bytes from `in[i]` to
+// `out[i]`, each with its own IV `ivs[i]`, the same as an `encrypt_t` of each
+// with `threads` threads. With the ctr-opt encryption mode, the keystreams of
+// many messages are generated together (see `keymix_opt_batch`), which is
+// faster for many short messages.
+int encrypt_batch(ctx_t *ctx, byte **in, byte **out, size_t *sizes, byte **ivs,
+                  uint32_t nof_msgs, uint8_t threads);
+
+// Starts the incremental encryption `stream` with the context `ctx` and the
+// `iv`, generating the keystreams with `threads` threads. Unlike `encrypt_t`,
+// the ofb encryption modes start from the key and do not advance the state
+// of `ctx`.
+int keymix_stream_init(keymix_stream_t *stream, ctx_t *ctx, byte *iv, uint8_t threads);
+
+// Encrypts the next `size` bytes of `stream` from `in` to `out`, which can be
+// the same pointer if the operation is to be done in-place.
+int keymix_stream_update(keymix_stream_t *stream, byte *in, byte *out, size_t size);
+
+// Ends the incremental encryption `stream`, erasing its keystream.
+void keymix_stream_final(keymix_stream_t *stream);
+
 #endif
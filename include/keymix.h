@@ -20,6 +20,29 @@ int get_fanouts_from_mix_type(mix_impl_t mix_type, uint8_t n, uint8_t *fanouts);
 // Get number of encryption levels in the keymix computation
 uint8_t get_levels(size_t size, block_size_t block_size, uint8_t fanout);
 
+// Pick a mixed-radix fanout schedule for a key of `size` bytes, made of the
+// highest fanouts returned by `get_fanouts_from_block_size` (from bigger to
+// smaller), so to minimize the number of levels. The schedule is stored in
+// `fanouts`, which must fit `KEYMIX_MAX_LEVELS - 1` entries. Returns the
+// number of fanouts or -1 when the number of blocks cannot be factored by
+// them.
+int get_fanout_schedule(block_size_t block_size, size_t size, uint8_t *fanouts);
+
+// Precompute in `state` the internal state of keymix of `ctx->key` that is
+// kept equal across all IV and counter values, as needed by the ctr-opt
+// encryption mode, using `nof_threads` threads.
+int keymix_precompute(ctx_t *ctx, byte *state, uint8_t nof_threads);
+
+// Generates in lockstep the keystreams of the ctr-opt encryption mode for
+// `nof_lanes` IVs, the same as `keymix_ex` of `ctx->state` with each of them.
+// The keystream of `ivs[i]` goes to `out + i * ctx->key_size`. Each tile of
+// the state is read from memory once for all the lanes, and the lanes are
+// mixed together while small, which pays off for many short messages. The lanes are split
+// among `nof_threads` threads, or with fewer lanes than threads each lane is
+// split among all of them.
+int keymix_opt_batch(ctx_t *ctx, byte *out, byte (*ivs)[KEYMIX_IV_SIZE], uint32_t nof_lanes,
+                     uint8_t nof_threads);
+
 // Same as `keymix_ex` but without IV and with a single thread.
 int keymix(ctx_t *ctx, byte *out, size_t size);
 
@@ -28,11 +51,19 @@ int keymix_t(ctx_t *ctx, byte *out, size_t size, uint8_t threads);
 
 // The Keymix primitive.
 // Applies mix as defined by `ctx->mixpass` to `in`, putting the result in
-// `out`. Here `size` is the size of both input and output, and must be a
-// multiple of the `block_size` by a power of `fanout`.
+// `out`. Here `size` is the size of both input and output, and must be equal
+// to the key size of `ctx`.
 // An IV of 64-bit nonce and 64-bit counter is applied on the 1st 128 bits
 // of `in` to generate a fresh keysteam
 int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
               uint8_t nof_threads);
 
+// Keymix of the ctr-ctr encryption mode, the same as `keymix_ex` of `ctx->key`
+// refreshed by AES-128-CTR with the nonce of `iv` (zero if NULL) from the AES
+// block `counter`. The refresh is fused into the 1st level: each thread
+// refreshes its extent of the key a tile at a time right before mixing it, so
+// the refreshed key is never written out.
+int keymix_refresh(ctx_t *ctx, byte *out, size_t size, byte *iv, uint64_t counter,
+                   uint8_t nof_threads);
+
 #endif
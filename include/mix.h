@@ -10,6 +10,9 @@
 // Number of AES execution in the MixCTR implementations
 #define BLOCKS_PER_MACRO 3
 
+// Maximum ratio between a custom block size of an XOF and its default one
+#define MAX_BLOCK_SIZE_FACTOR 16
+
 // Accepted types of mix implementations.
 typedef enum {
         NONE,
@@ -28,8 +31,12 @@ typedef enum {
         OPENSSL_SHA3_256,
         OPENSSL_BLAKE2S,
         WOLFCRYPT_SHA3_256,
+        KECCAK_SHA3_256,
         WOLFCRYPT_BLAKE2S,
+        SIMD_BLAKE2S,
         BLAKE3_BLAKE3,
+        BLAKE3_BLAKE3_MANY,
+        AESNI_HARAKA_256,
         // 384-bit block size
         AESNI_MIXCTR,
         OPENSSL_MIXCTR,
@@ -38,10 +45,16 @@ typedef enum {
         OPENSSL_SHA3_512,
         OPENSSL_BLAKE2B,
         WOLFCRYPT_SHA3_512,
+        KECCAK_SHA3_512,
         WOLFCRYPT_BLAKE2B,
+        SIMD_BLAKE2B,
+        AESNI_HARAKA_512,
         // Extendable-output functions (XOFs)
         // 384-bit internal state
         XKCP_XOODYAK,
+        XKCP_XOODYAK_TIMES4,
+        XKCP_XOODYAK_TIMES8,
+        XKCP_XOODYAK_TIMES16,
         // NOTE: To ensure a security strength of 128 bits, the block size
         // should be at least of 64 bytes. So, in our setup we can only reach
         // 96 bit of security (see https://eprint.iacr.org/2016/1188.pdf).
@@ -49,10 +62,12 @@ typedef enum {
         // 1600-bit internal state: r=1088, c=512
         OPENSSL_SHAKE256,
         WOLFCRYPT_SHAKE256,
+        KECCAK_SHAKE256,
         XKCP_TURBOSHAKE_256,
         // 1600-bit internal state: r=1344, c=256
         OPENSSL_SHAKE128,
         WOLFCRYPT_SHAKE128,
+        KECCAK_SHAKE128,
         XKCP_TURBOSHAKE_128,
         XKCP_KANGAROOTWELVE,
         // 1600-bit internal state
@@ -74,11 +89,13 @@ typedef enum {
         MIX_SHA3_256,
         MIX_BLAKE2S,
         MIX_BLAKE3,
+        MIX_HARAKA_256,
         // 384-bit block size
         MIX_MIXCTR,
         // 512-bit block size
         MIX_SHA3_512,
         MIX_BLAKE2B,
+        MIX_HARAKA_512,
         // Extendable-output functions (XOFs)
         // 384-bit internal state
         MIX_XOODYAK,
@@ -101,9 +118,11 @@ typedef enum {
         BLOCK_SIZE_SHA3_256 = 32,
         BLOCK_SIZE_BLAKE2S = 32,
         BLOCK_SIZE_BLAKE3 = 32,
+        BLOCK_SIZE_HARAKA_256 = 32,
         BLOCK_SIZE_MIXCTR = BLOCKS_PER_MACRO * BLOCK_SIZE_AES,
         BLOCK_SIZE_SHA3_512 = 64,
         BLOCK_SIZE_BLAKE2B = 64,
+        BLOCK_SIZE_HARAKA_512 = 64,
         // Extendable-output functions (XOFs)
         // We pick the biggest block size that does not exceed the internal
         // state of the permutation function and brings the best performance
@@ -117,14 +136,42 @@ typedef enum {
         BLOCK_SIZE_KRAVETTE_WBC = 192, // 1600-bit internal state
 } block_size_t;
 
+// A mix function with a custom block size, as offered by the XOFs.
+// Here `size` must be a multiple of `block_size`.
+typedef int (*mix_xof_func_t)(byte *in, byte *out, size_t size, block_size_t block_size,
+                              byte *iv);
+
+// Hooks of the stateful mix interface. The state built by `create` for a
+// given `iv` (e.g., fetched algorithms and expanded keys) is reused by every
+// `process` call until `destroy` is called. A state is not thread-safe, so
+// every thread must create its own.
+typedef struct {
+        int (*create)(void **state, byte *iv);
+        int (*process)(void *state, byte *in, byte *out, size_t size);
+        void (*destroy)(void *state);
+} mix_hooks_t;
+
 typedef struct {
         char *name;
         mix_func_t function;
         mix_t primitive;
         block_size_t block_size;
         bool is_one_way;
+        // Stateful implementation of `function` (optional)
+        const mix_hooks_t *hooks;
+        // Same as `function` but with a custom block size (XOFs only,
+        // optional)
+        mix_xof_func_t xof_function;
 } mix_info_t;
 
+// A mix implementation bound to its reusable state.
+typedef struct {
+        mix_info_t *info;
+        void *state;
+        byte *iv;
+        block_size_t block_size;
+} mix_ctx_t;
+
 const static mix_impl_t MIX_TYPES[] = {
         // 128-bit block size
         OPENSSL_AES_128,
@@ -139,28 +186,40 @@ const static mix_impl_t MIX_TYPES[] = {
         // 256-bit block size
         OPENSSL_SHA3_256,
         WOLFCRYPT_SHA3_256,
+        KECCAK_SHA3_256,
         OPENSSL_BLAKE2S,
         WOLFCRYPT_BLAKE2S,
+        SIMD_BLAKE2S,
         BLAKE3_BLAKE3,
+        BLAKE3_BLAKE3_MANY,
+        AESNI_HARAKA_256,
         // 384-bit block size
         AESNI_MIXCTR,
         OPENSSL_MIXCTR,
         WOLFSSL_MIXCTR,
         // 384-bit internal state
         XKCP_XOODYAK,
+        XKCP_XOODYAK_TIMES4,
+        XKCP_XOODYAK_TIMES8,
+        XKCP_XOODYAK_TIMES16,
         XKCP_XOOFFF_WBC,
         // 512-bit block size
         OPENSSL_SHA3_512,
         WOLFCRYPT_SHA3_512,
+        KECCAK_SHA3_512,
         OPENSSL_BLAKE2B,
         WOLFCRYPT_BLAKE2B,
+        SIMD_BLAKE2B,
+        AESNI_HARAKA_512,
         // 1600-bit internal state: r=1088, c=512
         OPENSSL_SHAKE256,
         WOLFCRYPT_SHAKE256,
+        KECCAK_SHAKE256,
         XKCP_TURBOSHAKE_256,
         // 1600-bit internal state: r=1344, c=256
         OPENSSL_SHAKE128,
         WOLFCRYPT_SHAKE128,
+        KECCAK_SHAKE128,
         XKCP_TURBOSHAKE_128,
         XKCP_KANGAROOTWELVE,
         // 1600-bit internal state
@@ -186,12 +245,52 @@ char *get_mix_name(mix_impl_t mix_type);
 // Get mix info from the mix type.
 mix_info_t *get_mix_info(mix_impl_t mix_type);
 
+// Whether the running CPU supports the instructions needed by the mix type
+// (e.g., AES-NI).
+bool is_mix_supported(mix_impl_t mix_type);
+
+// Whether the mix type supports the given block size, that is its default one
+// or, for XOFs, a multiple of it up to `MAX_BLOCK_SIZE_FACTOR` times.
+bool is_block_size_supported(mix_impl_t mix_type, block_size_t block_size);
+
 // Get the mix type given its name.
 mix_impl_t get_mix_type(char *name);
 
+// Initializes the mix context `mix_ctx` of the given mix type, building the
+// state of the implementation for the given `iv` once and for all.
+// Implementations without hooks simply fall back to their mix function.
+int mix_ctx_init(mix_ctx_t *mix_ctx, mix_impl_t mix_type, byte *iv);
+
+// Same as `mix_ctx_init`, but with a custom block size, which must be
+// supported by the mix type.
+int mix_ctx_init_sized(mix_ctx_t *mix_ctx, mix_impl_t mix_type, byte *iv,
+                       block_size_t block_size);
+
+// Same as the mix function of the context implementation, but reusing its
+// state. Here `size` must be a multiple of the block size of the context.
+int mix_ctx_process(mix_ctx_t *mix_ctx, byte *in, byte *out, size_t size);
+
+// Same as `mix_ctx_process` of `in`, but XOR'ing the output with `src` into
+// `out`, a tile at a time, so that the output of the mix does not go through
+// memory. Here `size` can be any size, and `in` must hold it rounded up to a
+// whole block.
+int mix_ctx_process_xor(mix_ctx_t *mix_ctx, byte *in, byte *src, byte *out, size_t size);
+
+// Free the state of `mix_ctx`.
+void mix_ctx_free(mix_ctx_t *mix_ctx);
+
+// Run the hooks of a stateful implementation on a single call, i.e., its mix
+// function.
+int mix_hooks_run(const mix_hooks_t *hooks, byte *in, byte *out, size_t size, byte *iv);
+
 // Run mix function with multiple threads.
 int multi_threaded_mixpass(mix_func_t mixpass, block_size_t block_size,
                            byte *in, byte *out, size_t size, byte *iv,
                            uint8_t nof_threads);
 
+// Same as `mix_ctx_process_xor` with a context of the given mix type for the
+// `iv` on multiple threads.
+int multi_threaded_mixpass_xor(mix_impl_t mix_type, byte *in, byte *src, byte *out, size_t size,
+                               byte *iv, uint8_t nof_threads);
+
 #endif
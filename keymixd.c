@@ -0,0 +1,251 @@
+#include <argp.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "autotune.h"
+#include "ctx.h"
+#include "daemon.h"
+#include "file.h"
+#include "keymix.h"
+#include "types.h"
+#include "utils.h"
+
+// ------------------------------------------------------------------ Error management and codes
+
+#define ERR_SERVE 100
+#define ERR_KEY_READ 102
+#define ERR_CTX 113
+
+void errmsg(const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        fprintf(stderr, "keymixd: ");
+        vfprintf(stderr, fmt, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+}
+
+// ------------------------------------------------------------------ Option definitions
+
+typedef struct {
+        const char *key;
+        const char *socket;
+        block_size_t block_size;
+        uint8_t fanout;
+        enc_mode_t enc_mode;
+        mix_impl_t mix;
+        mix_impl_t one_way_mix;
+        uint8_t threads;
+        bool verbose;
+} cli_args_t;
+
+enum args_key {
+        ARG_KEY_BLOCK_SIZE        = 'b',
+        ARG_KEY_ENC_MODE          = 'e',
+        ARG_KEY_FANOUT            = 'f',
+        ARG_KEY_ONE_WAY_PRIMITIVE = 0x100,
+        ARG_KEY_PRIMITIVE         = 'p',
+        ARG_KEY_SOCKET            = 's',
+        ARG_KEY_THREADS           = 't',
+        ARG_KEY_VERBOSE           = 'v',
+};
+
+const char *argp_program_version     = "1.0.0";
+const char *argp_program_bug_address = "<seclab@unibg.it>";
+static char args_doc[]               = "KEYFILE";
+
+static struct argp_option options[] = {
+    {"block-size", ARG_KEY_BLOCK_SIZE, "UINT", 0,
+     "Block size of the mixing primitive (default: the one of the primitive)"},
+    {"enc-mode", ARG_KEY_ENC_MODE, "STRING", 0,
+     "Encryption mode, one of ctr, ctr-opt, ctr-ctr (default: ctr)"},
+    {"fanout", ARG_KEY_FANOUT, "UINT", 0,
+     "Fanout of keymix (default: the first fanout supported by the primitive, or a schedule of "
+     "the highest ones when the key size is not a power of it)"},
+    {"one-way-primitive", ARG_KEY_ONE_WAY_PRIMITIVE, "STRING", 0,
+     "One of the mixing primitive available (default: none)"},
+    {"primitive", ARG_KEY_PRIMITIVE, "STRING", 0,
+     "One of the mixing primitive available (default: xkcp-tuboshake-128)"},
+    {"socket", ARG_KEY_SOCKET, "PATH", 0, "Path of the Unix domain socket to listen on"},
+    {"threads", ARG_KEY_THREADS, "UINT", 0,
+     "Number of threads of each encryption (default: the number of CPUs available to the "
+     "process)"},
+    {"verbose", ARG_KEY_VERBOSE, NULL, 0, "Verbose mode"},
+    {NULL},
+};
+
+error_t parse_opt(int, char *, struct argp_state *);
+
+static struct argp argp = {options, parse_opt, args_doc,
+                           "keymixd -- a daemon serving encryptions with a resident large key"};
+
+// ------------------------------------------------------------------ Argument parsing
+
+error_t parse_opt(int key, char *arg, struct argp_state *state) {
+        cli_args_t *arguments = state->input;
+        long value;
+
+        switch (key) {
+        case ARG_KEY_VERBOSE:
+                arguments->verbose = true;
+                break;
+        case ARG_KEY_SOCKET:
+                arguments->socket = arg;
+                break;
+        case ARG_KEY_ENC_MODE:
+                arguments->enc_mode = get_enc_mode_type(arg);
+                if (arguments->enc_mode == -1 || arguments->enc_mode == ENC_MODE_OFB ||
+                    arguments->enc_mode == ENC_MODE_OFB_MULTI)
+                        argp_error(state, "encryption mode must be one of ctr, ctr-opt, ctr-ctr");
+                break;
+        case ARG_KEY_PRIMITIVE:
+                arguments->mix = get_mix_type(arg);
+                if (arguments->mix == -1)
+                        argp_error(state, "primitive must be one of the available ones");
+                break;
+        case ARG_KEY_ONE_WAY_PRIMITIVE:
+                arguments->one_way_mix = get_mix_type(arg);
+                if (arguments->one_way_mix == -1)
+                        argp_error(state, "one-way primitive must be one of the available ones");
+                break;
+        case ARG_KEY_BLOCK_SIZE:
+                value = strtol(arg, NULL, 10);
+                if (value <= 0)
+                        argp_error(state, "block size must be positive");
+                arguments->block_size = value;
+                break;
+        case ARG_KEY_FANOUT:
+                value = strtol(arg, NULL, 10);
+                if (value < 2 || value > UINT8_MAX)
+                        argp_error(state, "fanout must be between 2 and %d", UINT8_MAX);
+                arguments->fanout = value;
+                break;
+        case ARG_KEY_THREADS:
+                value = strtol(arg, NULL, 10);
+                if (value <= 0 || value > UINT8_MAX)
+                        argp_error(state, "number of threads must be between 1 and %d", UINT8_MAX);
+                arguments->threads = value;
+                break;
+        case ARGP_KEY_ARG:
+                if (state->arg_num > 0)
+                        argp_usage(state);
+                arguments->key = arg;
+                break;
+        case ARGP_KEY_END:
+                if (state->arg_num < 1)
+                        argp_usage(state);
+                if (arguments->socket == NULL)
+                        argp_error(state, "the socket path is required");
+                break;
+        default:
+                return ARGP_ERR_UNKNOWN;
+        }
+
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        int err = 0;
+
+        cli_args_t args = {
+            .key         = NULL,
+            .socket      = NULL,
+            .block_size  = 0,
+            .fanout      = 0,
+            .enc_mode    = ENC_MODE_CTR,
+            .mix         = XKCP_TURBOSHAKE_128,
+            .one_way_mix = NONE,
+            .threads     = get_default_threads(),
+            .verbose     = false,
+        };
+
+        if (argp_parse(&argp, argc, argv, 0, 0, &args))
+                return EXIT_FAILURE;
+
+        bool default_fanout = !args.fanout;
+        if (!args.fanout && args.block_size)
+                get_fanouts_from_block_size(args.block_size, 1, &args.fanout);
+        else if (!args.fanout)
+                get_fanouts_from_mix_type(args.mix, 1, &args.fanout);
+
+        size_t key_size = 0;
+        byte *key       = NULL;
+        bool key_mapped = false;
+        ctx_t ctx;
+        bool ctx_ready = false;
+
+        FILE *fkey = fopen(args.key, "r");
+        if (fkey == NULL) {
+                errmsg("no such file '%s'", args.key);
+                return ENOENT;
+        }
+
+        // The key stays resident for the whole life of the daemon
+        key_size   = get_file_size(fkey);
+        key        = map_file(fkey, key_size, args.threads, false);
+        key_mapped = (key != NULL);
+        if (!key_mapped) {
+                key = checked_malloc(key_size);
+                if (fread(key, 1, key_size, fkey) != key_size) {
+                        errmsg("cannot read the key");
+                        err = ERR_KEY_READ;
+                        goto cleanup;
+                }
+        }
+
+        // Same fallback of keymixer to a mixed-radix schedule
+        uint8_t fanouts[KEYMIX_MAX_LEVELS];
+        int nof_fanouts = 0;
+        mix_func_t mix_func;
+        block_size_t mix_block_size = args.block_size;
+        if (!mix_block_size && get_mix_func(args.mix, &mix_func, &mix_block_size))
+                mix_block_size = 0;
+        if (default_fanout && mix_block_size && args.fanout && !(key_size % mix_block_size) &&
+            !ISPOWEROF(key_size / mix_block_size, args.fanout))
+                nof_fanouts = get_fanout_schedule(mix_block_size, key_size, fanouts);
+
+        if (nof_fanouts > 1)
+                err = ctx_encrypt_init_schedule(&ctx, args.enc_mode, args.mix, args.one_way_mix,
+                                                key, key_size, fanouts, nof_fanouts,
+                                                args.block_size, args.threads);
+        else
+                err = ctx_encrypt_init_ex(&ctx, args.enc_mode, args.mix, args.one_way_mix, key,
+                                          key_size, args.fanout, args.block_size, args.threads);
+        if (err) {
+                errmsg("cannot initialize the encryption context (error %d), see keymixer for "
+                       "the supported configurations",
+                       err);
+                err = ERR_CTX;
+                goto cleanup;
+        }
+        ctx_ready = true;
+
+        if (args.verbose) {
+                printf("key:               %s\n", args.key);
+                printf("socket:            %s\n", args.socket);
+                printf("enc mode:          %s\n", get_enc_mode_name(args.enc_mode));
+                printf("primitive:         %s\n", get_mix_name(args.mix));
+                printf("one-way primitive: %s\n", get_mix_name(args.one_way_mix));
+                printf("fanout:            %d", ctx.fanouts[0]);
+                for (uint8_t i = 1; i < ctx.levels - 1; i++)
+                        printf(",%d", ctx.fanouts[i]);
+                printf("\n");
+                printf("threads:           %d\n", args.threads);
+                fflush(stdout);
+        }
+
+        if (keymixd_serve(&ctx, args.socket, args.threads))
+                err = ERR_SERVE;
+
+cleanup:
+        if (ctx_ready)
+                ctx_free(&ctx);
+        if (key_mapped) {
+                unmap_file(key, key_size);
+        } else {
+                safe_explicit_bzero(key, key_size);
+                free(key);
+        }
+        fclose(fkey);
+        return err;
+}
@@ -1,9 +1,13 @@
 #include <argp.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "autotune.h"
 #include "ctx.h"
+#include "daemon.h"
 #include "file.h"
 #include "keymix.h"
 #include "types.h"
@@ -21,6 +25,14 @@
 #define ERR_NOT_ONE_WAY 107
 #define ERR_INCOMPATIBLE_PRIMITIVES 108
 #define ERR_EQUAL_PRIMITIVES 109
+#define ERR_BLOCK_SIZE 110
+#define ERR_FANOUT 111
+#define ERR_STATE 112
+#define ERR_DAEMON 113
+
+// Size of the buffer shared with keymixd, rounded down to a multiple of the
+// key size
+#define DAEMON_BUFFER_SIZE (8 * 1024 * 1024)
 
 void errmsg(const char *fmt, ...) {
         va_list args;
@@ -37,28 +49,45 @@ typedef struct {
         const char *input;
         const char *output;
         const char *key;
+        const char *daemon;
         byte iv[KEYMIX_IV_SIZE];
+        block_size_t block_size;
         uint8_t fanout;
+        bool auto_fanout;
+        uint8_t fanouts[KEYMIX_MAX_LEVELS];
+        uint8_t nof_fanouts;
         enc_mode_t enc_mode;
         mix_impl_t mix;
         mix_impl_t one_way_mix;
         uint8_t threads;
+        bool auto_threads;
+        uint8_t chains;
+        const char *state_cache;
+        bool huge_pages;
+        bool read_key;
         bool verbose;
 } cli_args_t;
 
 enum args_key {
+        ARG_KEY_BLOCK_SIZE        = 'b',
+        ARG_KEY_CHAINS            = 0x105,
+        ARG_KEY_DAEMON            = 0x104,
         ARG_KEY_ENC_MODE          = 'e',
+        ARG_KEY_FANOUT            = 'f',
+        ARG_KEY_HUGE_PAGES        = 0x102,
         ARG_KEY_IV                = 'i',
         ARG_KEY_ONE_WAY_PRIMITIVE = 0x100,
         ARG_KEY_OUTPUT            = 'o',
         ARG_KEY_PRIMITIVE         = 'p',
+        ARG_KEY_READ_KEY          = 0x103,
+        ARG_KEY_STATE_CACHE       = 0x101,
         ARG_KEY_THREADS           = 't',
         ARG_KEY_VERBOSE           = 'v',
 };
 
 const char *argp_program_version     = "1.0.0";
 const char *argp_program_bug_address = "<seclab@unibg.it>";
-static char args_doc[]               = "KEYFILE [INPUT]";
+static char args_doc[]               = "KEYFILE [INPUT]\n--daemon=SOCKET [INPUT]";
 
 // The order for an argp_opption is
 // - long name
@@ -67,15 +96,42 @@ static char args_doc[]               = "KEYFILE [INPUT]";
 // - some flags, always zero for us
 // - help description
 static struct argp_option options[] = {
+    {"block-size", ARG_KEY_BLOCK_SIZE, "UINT", 0,
+     "Block size of the mixing primitive, XOFs accept a multiple of their default one to reduce "
+     "the number of levels (default: the one of the primitive)"},
+    {"chains", ARG_KEY_CHAINS, "UINT", 0,
+     "With the ofb-multi encryption mode, number of independent ofb chains interleaved one key "
+     "at a time (default: 4). Decryption must use the same number of chains"},
+    {"daemon", ARG_KEY_DAEMON, "SOCKET", 0,
+     "Encrypt through the keymixd daemon listening at SOCKET, with its key and configuration, "
+     "instead of loading a key"},
     {"enc-mode", ARG_KEY_ENC_MODE, "STRING", 0, "Encryption mode (default: ctr)"},
+    {"fanout", ARG_KEY_FANOUT, "UINT[,UINT...]", 0,
+     "Fanout of keymix, a comma-separated schedule with the fanout of each level (e.g., "
+     "4,4,3,2), or auto to pick the fastest single fanout for the key size (default: the first "
+     "fanout supported by the primitive, or a schedule of the highest ones when the key size is "
+     "not a power of it). Decryption must use the same fanout"},
+    {"huge-pages", ARG_KEY_HUGE_PAGES, NULL, 0,
+     "Back the memory mapping of the key with huge pages, when the file system supports it"},
     {"iv", ARG_KEY_IV, "STRING", 0,
      "16-Byte initialization vector in hexadecimal format (default: 0)"},
     {"one-way-primitive", ARG_KEY_ONE_WAY_PRIMITIVE, "STRING", 0,
-     "One of the mixing primitive available (default: none)"},
+     "One of the mixing primitive available, or auto:FAMILY to pick the fastest implementation "
+     "of a family on this machine (default: none)"},
     {"output", ARG_KEY_OUTPUT, "PATH", 0, "Output to file instead of standard output"},
     {"primitive", ARG_KEY_PRIMITIVE, "STRING", 0,
-     "One of the mixing primitive available (default: xkcp-tuboshake-128)"},
-    {"threads", ARG_KEY_THREADS, "UINT", 0, "Number of threads"},
+     "One of the mixing primitive available, or auto:FAMILY to pick the fastest implementation "
+     "of a family on this machine (default: xkcp-tuboshake-128)"},
+    {"read-key", ARG_KEY_READ_KEY, NULL, 0,
+     "Read the key in parallel, an extent per thread, instead of mapping it. With the ctr "
+     "encryption mode, each thread starts mixing as soon as its extent is read"},
+    {"state-cache", ARG_KEY_STATE_CACHE, "PATH", 0,
+     "With the ctr-opt encryption mode, map the precomputed state from PATH when it matches the "
+     "key and configuration, otherwise precompute it and save it to PATH. The file is as "
+     "sensitive as the key"},
+    {"threads", ARG_KEY_THREADS, "UINT", 0,
+     "Number of threads, or auto to pick the fastest one (default: the number of CPUs available "
+     "to the process)"},
     {"verbose", ARG_KEY_VERBOSE, NULL, 0, "Verbose mode"},
     {NULL}, // as per doc, this is necessary to terminate the options
 };
@@ -96,6 +152,23 @@ inline int parse_hex(byte *bytes, size_t len, char *hex) {
         return 0;
 }
 
+// Parse a mixing primitive name, where `auto:FAMILY` stands for the fastest
+// implementation of the family on this machine (see `autotune_mix`)
+mix_impl_t parse_mix(char *arg) {
+        const char *prefix = "auto:";
+        size_t prefix_len  = strlen(prefix);
+
+        if (strncmp(arg, prefix, prefix_len)) {
+                return get_mix_type(arg);
+        }
+
+        mix_t family = get_mix_family(arg + prefix_len);
+        if (family == -1) {
+                return -1;
+        }
+        return autotune_mix(family, NULL);
+}
+
 error_t parse_opt(int key, char *arg, struct argp_state *state) {
         cli_args_t *arguments = state->input;
         switch (key) {
@@ -115,23 +188,63 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
                 arguments->enc_mode = get_enc_mode_type(arg);
                 if (arguments->enc_mode == -1)
                         argp_error(state,
-                                   "encryption mode must be one of ctr, ctr-opt, ctr-ctr, ofb");
+                                   "encryption mode must be one of ctr, ctr-opt, ctr-ctr, ofb, "
+                                   "ofb-multi");
                 break;
         case ARG_KEY_PRIMITIVE:
-                arguments->mix = get_mix_type(arg);
+                arguments->mix = parse_mix(arg);
                 if (arguments->mix == -1)
                         argp_error(state, "primitive must be one of the available ones");
                 break;
         case ARG_KEY_ONE_WAY_PRIMITIVE:
-                arguments->one_way_mix = get_mix_type(arg);
+                arguments->one_way_mix = parse_mix(arg);
                 if (arguments->one_way_mix == -1)
                         argp_error(state, "one-way primitive must be one of the available ones");
                 break;
+        case ARG_KEY_BLOCK_SIZE:
+                long block_size = strtol(arg, NULL, 10);
+                if (block_size <= 0)
+                        argp_error(state, "block size must be positive");
+                arguments->block_size = block_size;
+                break;
+        case ARG_KEY_FANOUT:
+                if (!strcmp(arg, "auto")) {
+                        arguments->auto_fanout = true;
+                        break;
+                }
+                char *end = arg;
+                uint8_t nof_fanouts = 0;
+                do {
+                        long fanout = strtol(end, &end, 10);
+                        if (fanout < 2 || fanout > UINT8_MAX)
+                                argp_error(state, "fanout must be between 2 and %d", UINT8_MAX);
+                        if (nof_fanouts == KEYMIX_MAX_LEVELS - 1)
+                                argp_error(state, "fanout schedule must have at most %d levels",
+                                           KEYMIX_MAX_LEVELS - 1);
+                        arguments->fanouts[nof_fanouts++] = fanout;
+                } while (*end == ',' && end++);
+                if (*end)
+                        argp_error(state, "fanout must be a comma-separated list of integers");
+                arguments->fanout      = arguments->fanouts[0];
+                arguments->nof_fanouts = (nof_fanouts > 1 ? nof_fanouts : 0);
+                arguments->auto_fanout = false;
+                break;
+        case ARG_KEY_CHAINS:
+                long chains = strtol(arg, NULL, 10);
+                if (chains <= 0 || chains > UINT8_MAX)
+                        argp_error(state, "number of chains must be between 1 and %d", UINT8_MAX);
+                arguments->chains = chains;
+                break;
         case ARG_KEY_THREADS:
+                if (!strcmp(arg, "auto")) {
+                        arguments->auto_threads = true;
+                        break;
+                }
                 long value = strtol(arg, NULL, 10);
-                if (value <= 0)
-                        argp_error(state, "number of threads must be at least 1");
-                arguments->threads = value;
+                if (value <= 0 || value > UINT8_MAX)
+                        argp_error(state, "number of threads must be between 1 and %d", UINT8_MAX);
+                arguments->threads      = value;
+                arguments->auto_threads = false;
                 break;
         case ARGP_KEY_ARG:
                 // We accept only 2 input argument, the key and (possibly) the file
@@ -143,10 +256,34 @@ error_t parse_opt(int key, char *arg, struct argp_state *state) {
                         // Too many arguments, note that argp_usage exits
                         argp_usage(state);
                 break;
+        case ARG_KEY_HUGE_PAGES:
+                arguments->huge_pages = true;
+                break;
+        case ARG_KEY_STATE_CACHE:
+                arguments->state_cache = arg;
+                break;
+        case ARG_KEY_READ_KEY:
+                arguments->read_key = true;
+                break;
+        case ARG_KEY_DAEMON:
+                arguments->daemon = arg;
+                break;
         case ARGP_KEY_END:
+                // The daemon has the key, so the only argument is the input
+                if (arguments->daemon) {
+                        if (state->arg_num > 1)
+                                argp_usage(state);
+                        arguments->input = arguments->key;
+                        arguments->key   = NULL;
+                        break;
+                }
                 if (state->arg_num < 1)
                         // Too few arguments, note that argp_usage exits
                         argp_usage(state);
+                if (arguments->state_cache && arguments->enc_mode != ENC_MODE_CTR_OPT)
+                        argp_error(state, "state cache requires the ctr-opt encryption mode");
+                if (arguments->chains && arguments->enc_mode != ENC_MODE_OFB_MULTI)
+                        argp_error(state, "chains require the ofb-multi encryption mode");
                 break;
         default:
                 return ARGP_ERR_UNKNOWN;
@@ -167,6 +304,64 @@ int checked_fopen(FILE **fp, const char *resource, char *mode, FILE *default_fp)
         return 0;
 };
 
+// Encrypts `fin` into `fout` through the keymixd daemon listening at `path`,
+// with the same result as `stream_encrypt` with the key of the daemon
+int daemon_encrypt(const char *path, byte *iv, FILE *fin, FILE *fout) {
+        keymixd_response_t info;
+        byte counter_iv[KEYMIX_IV_SIZE];
+        byte *buffer = NULL;
+        size_t buffer_size;
+        size_t keys;
+        size_t read;
+        int err = 0;
+
+        int sock = keymixd_connect(path);
+        if (sock < 0) {
+                errmsg("cannot connect to the daemon at '%s'", path);
+                return ERR_DAEMON;
+        }
+
+        if (keymixd_info(sock, &info) || !info.key_size) {
+                errmsg("the daemon at '%s' is not a keymixd", path);
+                err = ERR_DAEMON;
+                goto cleanup;
+        }
+
+        // Send whole keys at a time, so that the counter of the IV advances
+        // as with the local encryption
+        keys        = MAX(1, DAEMON_BUFFER_SIZE / info.key_size);
+        buffer_size = keys * info.key_size;
+        buffer      = keymixd_attach(sock, buffer_size);
+        if (buffer == NULL) {
+                errmsg("cannot share a buffer with the daemon");
+                err = ERR_DAEMON;
+                goto cleanup;
+        }
+
+        memcpy(counter_iv, iv, KEYMIX_IV_SIZE);
+        do {
+                read = fread(buffer, 1, buffer_size, fin);
+                if (read == 0)
+                        break;
+
+                if (keymixd_encrypt(sock, 0, read, counter_iv)) {
+                        errmsg("the daemon could not encrypt");
+                        err = ERR_ENC;
+                        break;
+                }
+
+                fwrite(buffer, read, 1, fout);
+                for (size_t k = 0; k < keys; k++)
+                        ctr64_inc(counter_iv + KEYMIX_NONCE_SIZE);
+        } while (read == buffer_size);
+
+cleanup:
+        if (buffer != NULL)
+                munmap(buffer, buffer_size);
+        close(sock);
+        return err;
+}
+
 int main(int argc, char **argv) {
         int err = 0;
 
@@ -175,41 +370,40 @@ int main(int argc, char **argv) {
             .input       = NULL,
             .output      = NULL,
             .key         = NULL,
+            .daemon      = NULL,
             .iv          = 0,
-            .enc_mode    = ENC_MODE_CTR,
-            .mix         = XKCP_TURBOSHAKE_128,
-            .one_way_mix = NONE,
-            .threads     = 1,
-            .verbose     = false,
+            .block_size   = 0,
+            .fanout       = 0,
+            .auto_fanout  = false,
+            .nof_fanouts  = 0,
+            .enc_mode     = ENC_MODE_CTR,
+            .mix          = XKCP_TURBOSHAKE_128,
+            .one_way_mix  = NONE,
+            .threads      = get_default_threads(),
+            .auto_threads = false,
+            .chains       = 0,
+            .state_cache  = NULL,
+            .huge_pages   = false,
+            .read_key     = false,
+            .verbose      = false,
         };
 
         // Start parsing
         if (argp_parse(&argp, argc, argv, 0, 0, &args))
                 return EXIT_FAILURE;
 
-        // Setup fanout
-        get_fanouts_from_mix_type(args.mix, 1, (uint8_t *)&args.fanout);
-
-        if (args.verbose) {
-                printf("===============\n");
-                printf("KEYMIXER CONFIG\n");
-                printf("===============\n");
-                printf("resource:          %s\n", args.input);
-                printf("output:            %s\n", args.output);
-                printf("key:               %s\n", args.key);
-                printf("iv:                [redacted]\n");
-                // printf("%llx\n", (unsigned long long)(args.iv & 0xFFFFFFFFFFFFFFFF));
-                printf("enc mode:          %s", get_enc_mode_name(args.enc_mode));
-                printf("primitive:         %s", get_mix_name(args.mix));
-                printf("one-way primitive: %s", get_mix_name(args.one_way_mix));
-                printf("fanout:            %d\n", args.fanout);
-                printf("threads:           %d\n", args.threads);
-                printf("===============\n");
-        }
+        // Setup block size and fanout
+        bool default_fanout = !args.fanout;
+        if (!args.fanout && args.block_size)
+                get_fanouts_from_block_size(args.block_size, 1, &args.fanout);
+        else if (!args.fanout)
+                get_fanouts_from_mix_type(args.mix, 1, &args.fanout);
 
         // Setup variables here, before the gotos start
         size_t key_size = 0;
         byte *key       = NULL;
+        bool key_mapped = false;
+        bool key_defer  = false;
 
         // Prepare the streams
         FILE *fkey = NULL;
@@ -228,19 +422,102 @@ int main(int argc, char **argv) {
         if (err)
                 goto cleanup;
 
-        // Read the key into memory
+        if (args.daemon) {
+                err = daemon_encrypt(args.daemon, args.iv, fin, fout);
+                goto cleanup;
+        }
+
+        // Map the key read-only, sharing its page-cache copy with the other
+        // processes, or read it into memory when it cannot be mapped or when
+        // asked to. In ctr mode, the reading is left to the first keymix
         key_size = get_file_size(fkey);
-        key      = checked_malloc(key_size);
+        if (!args.read_key) {
+                key        = map_file(fkey, key_size, args.threads, args.huge_pages);
+                key_mapped = (key != NULL);
+        }
 
-        if (fread(key, 1, key_size, fkey) != key_size) {
-                err = ERR_KEY_READ;
-                goto cleanup;
+        if (!key_mapped) {
+                key = checked_malloc(key_size);
+                if (args.read_key && args.enc_mode == ENC_MODE_CTR) {
+                        key_defer = true;
+                } else if (args.read_key) {
+                        if (read_file(fileno(fkey), key, key_size, args.threads)) {
+                                err = ERR_KEY_READ;
+                                goto cleanup;
+                        }
+                } else if (fread(key, 1, key_size, fkey) != key_size) {
+                        err = ERR_KEY_READ;
+                        goto cleanup;
+                }
+        }
+
+        // Without an explicit fanout, fall back to a mixed-radix schedule
+        // when the key is not made of a power of the default fanout blocks
+        mix_func_t mix_func;
+        block_size_t mix_block_size = args.block_size;
+        if (!mix_block_size && get_mix_func(args.mix, &mix_func, &mix_block_size))
+                mix_block_size = 0;
+        if (default_fanout && !args.auto_fanout && mix_block_size && args.fanout &&
+            !(key_size % mix_block_size) && !ISPOWEROF(key_size / mix_block_size, args.fanout)) {
+                int nof_fanouts = get_fanout_schedule(mix_block_size, key_size, args.fanouts);
+                if (nof_fanouts > 1) {
+                        args.fanout      = args.fanouts[0];
+                        args.nof_fanouts = nof_fanouts;
+                }
+        }
+
+        // Tune fanout and threads on this key size, keeping the default
+        // values on failure (e.g., an invalid key size, reported below)
+        if (args.auto_fanout || args.auto_threads) {
+                uint8_t fanout  = args.fanout;
+                uint8_t threads = args.auto_threads ? get_default_threads() : args.threads;
+                int tune_err    = autotune_keymix(args.mix, args.block_size, key_size,
+                                                  args.auto_fanout, &fanout, &threads);
+                if (tune_err == AUTOTUNE_ERR_FANOUT) {
+                        errmsg("auto fanout unsupported for this key size, which is not "
+                               "block_size * fanout^n for any fanout: pass a fanout schedule");
+                        err = ERR_FANOUT;
+                        goto cleanup;
+                }
+                if (!tune_err) {
+                        args.fanout = fanout;
+                        if (args.auto_threads)
+                                args.threads = threads;
+                }
+        }
+
+        if (args.verbose) {
+                printf("===============\n");
+                printf("KEYMIXER CONFIG\n");
+                printf("===============\n");
+                printf("resource:          %s\n", args.input);
+                printf("output:            %s\n", args.output);
+                printf("key:               %s\n", args.key);
+                printf("iv:                [redacted]\n");
+                // printf("%llx\n", (unsigned long long)(args.iv & 0xFFFFFFFFFFFFFFFF));
+                printf("enc mode:          %s", get_enc_mode_name(args.enc_mode));
+                printf("primitive:         %s", get_mix_name(args.mix));
+                printf("one-way primitive: %s", get_mix_name(args.one_way_mix));
+                printf("block size:        %d\n", args.block_size);
+                printf("fanout:            %d", args.fanout);
+                for (uint8_t i = 1; i < args.nof_fanouts; i++)
+                        printf(",%d", args.fanouts[i]);
+                printf("\n");
+                printf("threads:           %d\n", args.threads);
+                printf("===============\n");
         }
 
-        // Do the encryption
+        // Do the encryption. With a state cache, the context starts in ctr
+        // mode, so that the precomputation only runs when the cache misses
         ctx_t ctx;
-        err = ctx_encrypt_init(&ctx, args.enc_mode, args.mix, args.one_way_mix, key, key_size,
-                               args.fanout);
+        enc_mode_t enc_mode = (args.state_cache ? ENC_MODE_CTR : args.enc_mode);
+        if (args.nof_fanouts)
+                err = ctx_encrypt_init_schedule(&ctx, enc_mode, args.mix, args.one_way_mix, key,
+                                                key_size, args.fanouts, args.nof_fanouts,
+                                                args.block_size, args.threads);
+        else
+                err = ctx_encrypt_init_ex(&ctx, enc_mode, args.mix, args.one_way_mix, key,
+                                          key_size, args.fanout, args.block_size, args.threads);
         switch (err) {
         case CTX_ERR_UNKNOWN_MIX:
                 errmsg("no mix primitive implementation found");
@@ -255,7 +532,7 @@ int main(int argc, char **argv) {
                 err = ERR_UNKNOWN_ONE_WAY_MIX;
                 goto cleanup;
         case CTX_ERR_MISSING_ONE_WAY_MIX:
-                errmsg("cannot use ofb encryption mode without a one-way primitive");
+                errmsg("cannot use an ofb encryption mode without a one-way primitive");
                 err = ERR_MISSING_ONE_WAY_MIX;
                 goto cleanup;
         case CTX_ERR_NOT_ONE_WAY:
@@ -269,9 +546,23 @@ int main(int argc, char **argv) {
                 err = ERR_INCOMPATIBLE_PRIMITIVES;
                 goto cleanup;
         case CTX_ERR_EQUAL_PRIMITIVES:
-                errmsg("cannot use ofb encryption mode with the same mix and one-way primitive");
+                errmsg("cannot use an ofb encryption mode with the same mix and one-way primitive");
                 err = ERR_EQUAL_PRIMITIVES;
                 goto cleanup;
+        case CTX_ERR_BLOCK_SIZE:
+                errmsg("%s mixing primitive does not support a block size of %d",
+                       get_mix_name(args.mix), args.block_size);
+                err = ERR_BLOCK_SIZE;
+                goto cleanup;
+        case CTX_ERR_FANOUT:
+                errmsg("the fanouts must be divisors of the block size of the %s mixing primitive",
+                       get_mix_name(args.mix));
+                err = ERR_FANOUT;
+                goto cleanup;
+        case CTX_ERR_STATE:
+                errmsg("cannot precompute the state of the ctr-opt encryption mode");
+                err = ERR_STATE;
+                goto cleanup;
         case CTX_ERR_KEYSIZE:
                 mix_func_t mix_function;
                 mix_func_t one_way_function;
@@ -279,6 +570,15 @@ int main(int argc, char **argv) {
                 block_size_t one_way_block_size;
 
                 get_mix_func(args.mix, &mix_function, &block_size);
+                if (args.block_size)
+                        block_size = args.block_size;
+                if (args.nof_fanouts) {
+                        errmsg("size of the key must be: size = block_size * the product of the "
+                               "fanouts of the schedule, with %s mixing primitive block_size = %d",
+                               get_mix_name(args.mix), block_size);
+                        err = ERR_KEY_SIZE;
+                        goto cleanup;
+                }
                 switch (args.enc_mode) {
                 case ENC_MODE_CTR:
                 case ENC_MODE_CTR_OPT:
@@ -287,6 +587,7 @@ int main(int argc, char **argv) {
                                get_mix_name(args.mix), block_size, args.fanout);
                         break;
                 case ENC_MODE_OFB:
+                case ENC_MODE_OFB_MULTI:
                         get_mix_func(args.one_way_mix, &one_way_function, &one_way_block_size);
                         errmsg("size of the key must be: size = block_size * fanout^n, with %s "
                                "mixing primitive block_size = %d and fanout = %d, but also "
@@ -300,15 +601,53 @@ int main(int argc, char **argv) {
                 goto cleanup;
         }
 
+        if (key_defer)
+                ctx_defer_key_load(&ctx, fileno(fkey));
+
+        if (args.chains && ctx_set_ofb_chains(&ctx, args.chains)) {
+                errmsg("cannot set up %d ofb chains", args.chains);
+                ctx_free(&ctx);
+                err = ERR_STATE;
+                goto cleanup;
+        }
+
+        if (args.state_cache && ctx_load_state(&ctx, args.state_cache)) {
+                if (args.verbose)
+                        printf("state cache miss, precomputing the state\n");
+                ctx_free(&ctx);
+                if (args.nof_fanouts)
+                        err = ctx_encrypt_init_schedule(&ctx, args.enc_mode, args.mix,
+                                                        args.one_way_mix, key, key_size,
+                                                        args.fanouts, args.nof_fanouts,
+                                                        args.block_size, args.threads);
+                else
+                        err = ctx_encrypt_init_ex(&ctx, args.enc_mode, args.mix, args.one_way_mix,
+                                                  key, key_size, args.fanout, args.block_size,
+                                                  args.threads);
+                if (err) {
+                        err = ERR_STATE;
+                        goto cleanup;
+                }
+                // The encryption does not depend on the cache, so just warn
+                if (ctx_save_state(&ctx, args.state_cache))
+                        errmsg("cannot save the state to '%s'", args.state_cache);
+        }
+
         if (stream_encrypt(&ctx, fin, fout, args.iv, args.threads))
                 err = ERR_ENC;
 
+        ctx_free(&ctx);
+
         // ctx_keymix_init(&ctx, args.mixfunc, key, key_size, args.fanout);
         // err = stream_encrypt2(&ctx, fin, fout, args.iv, args.threads);
 
 cleanup:
-        safe_explicit_bzero(key, key_size);
-        free(key);
+        if (key_mapped) {
+                unmap_file(key, key_size);
+        } else {
+                safe_explicit_bzero(key, key_size);
+                free(key);
+        }
         if (fkey != NULL)
                 fclose(fkey);
         // Do NOT close stdin or stdout
@@ -1,5 +1,6 @@
 #include "aesni.h"
 
+#include "isa.h"
 #include "types.h"
 
 #include <stdint.h>
@@ -7,10 +8,13 @@
 
 // Implemented following the Intel white paper here
 // https://www.intel.com/content/dam/doc/white-paper/advanced-encryption-standard-new-instructions-set-paper.pdf
+// Every function is built for several ISAs and dispatched at load time (see
+// isa.h).
 
 // --------------------------------------- AES 256
 
-inline __m128i key_256_assist_1(__m128i key1, __m128i m) {
+ISA_AESNI static inline __attribute__((always_inline)) __m128i
+key_256_assist_1(__m128i key1, __m128i m) {
         __m128i tmp;
         m = _mm_shuffle_epi32(m, 0xff);
 
@@ -26,7 +30,8 @@ inline __m128i key_256_assist_1(__m128i key1, __m128i m) {
         return key1;
 }
 
-inline __m128i key_256_assist_2(__m128i key1, __m128i key2) {
+ISA_AESNI static inline __attribute__((always_inline)) __m128i
+key_256_assist_2(__m128i key1, __m128i key2) {
         __m128i tmp = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(key1, 0x0), 0xaa);
         __m128i m   = _mm_slli_si128(key2, 0x4);
 
@@ -42,7 +47,8 @@ inline __m128i key_256_assist_2(__m128i key1, __m128i key2) {
         return key2;
 }
 
-void aes256_key_expansion(byte *key, __m128i *key_schedule) {
+ISA_AESNI static inline __attribute__((always_inline)) void
+aes256_key_expansion_impl(byte *key, __m128i *key_schedule) {
 #define KEYROUND_1(i, rcon)                                                                        \
         key_schedule[i] = key_256_assist_1(key_schedule[i - 2],                                    \
                                            _mm_aeskeygenassist_si128(key_schedule[i - 1], rcon))
@@ -69,7 +75,11 @@ void aes256_key_expansion(byte *key, __m128i *key_schedule) {
 #undef KEYROUND_2
 }
 
-void aes256_enc(__m128i *key_schedule, byte *data, byte *out) {
+ISA_AESNI_DISPATCH(aes256_key_expansion, (byte *key, __m128i *key_schedule),
+                   (key, key_schedule));
+
+ISA_AESNI static inline __attribute__((always_inline)) void
+aes256_enc_impl(__m128i *key_schedule, byte *data, byte *out) {
         __m128i m;
         uint8_t j;
 
@@ -83,9 +93,13 @@ void aes256_enc(__m128i *key_schedule, byte *data, byte *out) {
         _mm_storeu_si128((__m128i *)out, m);
 }
 
+ISA_AESNI_DISPATCH(aes256_enc, (__m128i *key_schedule, byte *data, byte *out),
+                   (key_schedule, data, out));
+
 // --------------------------------------- AES 256
 
-inline __m128i key_128_assist(__m128i key, __m128i m) {
+ISA_AESNI static inline __attribute__((always_inline)) __m128i
+key_128_assist(__m128i key, __m128i m) {
         __m128i tmp;
         m   = _mm_shuffle_epi32(m, 0xff);
         tmp = _mm_slli_si128(key, 0x4);
@@ -98,7 +112,8 @@ inline __m128i key_128_assist(__m128i key, __m128i m) {
         return key;
 }
 
-void aes128_key_expansion(byte *key, __m128i *key_schedule) {
+ISA_AESNI static inline __attribute__((always_inline)) void
+aes128_key_expansion_impl(byte *key, __m128i *key_schedule) {
 #define KEYROUND(i, rcon)                                                                          \
         key_schedule[i] = key_128_assist(key_schedule[i - 1],                                      \
                                          _mm_aeskeygenassist_si128(key_schedule[i - 1], rcon));
@@ -118,7 +133,11 @@ void aes128_key_expansion(byte *key, __m128i *key_schedule) {
 #undef KEYROUND
 }
 
-void aes128_enc(__m128i *key_schedule, byte *data, byte *out) {
+ISA_AESNI_DISPATCH(aes128_key_expansion, (byte *key, __m128i *key_schedule),
+                   (key, key_schedule));
+
+ISA_AESNI static inline __attribute__((always_inline)) void
+aes128_enc_impl(__m128i *key_schedule, byte *data, byte *out) {
         __m128i m;
         uint8_t j;
 
@@ -131,3 +150,6 @@ void aes128_enc(__m128i *key_schedule, byte *data, byte *out) {
         m = _mm_aesenclast_si128(m, key_schedule[j]);
         _mm_storeu_si128((__m128i *)out, m);
 }
+
+ISA_AESNI_DISPATCH(aes128_enc, (__m128i *key_schedule, byte *data, byte *out),
+                   (key_schedule, data, out));
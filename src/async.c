@@ -0,0 +1,298 @@
+#include "async.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "autotune.h"
+#include "enc.h"
+#include "log.h"
+#include "utils.h"
+
+struct keymix_job {
+        // The encryption to do, as a stream advancing one key at a time
+        ctx_t *ctx;
+        byte *in;
+        byte *out;
+        size_t size;
+        size_t done_size;
+        byte iv[KEYMIX_IV_SIZE];
+        bool has_iv;
+        uint8_t threads;
+        keymix_stream_t stream;
+        bool started;
+
+        // How to notify the completion
+        keymix_callback_t callback;
+        keymix_queue_t *queue;
+        void *arg;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        bool done;
+        int err;
+
+        // Next job in the pool or in a completion queue
+        keymix_job_t *next;
+};
+
+// The worker pool, with the FIFO of the jobs waiting for their next turn
+static struct {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        keymix_job_t *head;
+        keymix_job_t *tail;
+        pthread_t *workers;
+        uint8_t nof_workers;
+        bool stop;
+} pool = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+};
+
+// --------------------------------------------------------- Worker pool
+
+static void push_job(keymix_job_t **head, keymix_job_t **tail, keymix_job_t *job) {
+        job->next = NULL;
+        if (*tail != NULL)
+                (*tail)->next = job;
+        else
+                *head = job;
+        *tail = job;
+}
+
+static keymix_job_t *pop_job(keymix_job_t **head, keymix_job_t **tail) {
+        keymix_job_t *job = *head;
+        if (job != NULL) {
+                *head = job->next;
+                if (*head == NULL)
+                        *tail = NULL;
+        }
+        return job;
+}
+
+// Encrypts the next key of `job`. Returns true when the job is over
+static bool run_turn(keymix_job_t *job) {
+        size_t size;
+        int err;
+
+        if (!job->started) {
+                err = keymix_stream_init(&job->stream, job->ctx, job->has_iv ? job->iv : NULL,
+                                         job->threads);
+                if (err) {
+                        job->err = err;
+                        return true;
+                }
+                job->started = true;
+        }
+
+        size = MIN(job->ctx->key_size, job->size - job->done_size);
+        err  = keymix_stream_update(&job->stream, job->in + job->done_size,
+                                    job->out + job->done_size, size);
+        job->done_size += size;
+
+        if (err || job->done_size == job->size) {
+                keymix_stream_final(&job->stream);
+                job->err = err;
+                return true;
+        }
+        return false;
+}
+
+// Notifies the completion of `job`, which must not be touched afterwards,
+// since the notified party may free it
+static void complete(keymix_job_t *job) {
+        keymix_queue_t *queue = job->queue;
+        uint64_t one          = 1;
+
+        if (job->callback != NULL) {
+                job->callback(job, job->err, job->arg);
+        } else if (queue != NULL) {
+                pthread_mutex_lock(&queue->lock);
+                push_job(&queue->head, &queue->tail, job);
+                if (write(queue->fd, &one, sizeof(one)) != sizeof(one))
+                        _log(LOG_ERROR, "Cannot signal the completion queue\n");
+                pthread_mutex_unlock(&queue->lock);
+        } else {
+                pthread_mutex_lock(&job->lock);
+                job->done = true;
+                pthread_cond_broadcast(&job->cond);
+                pthread_mutex_unlock(&job->lock);
+        }
+}
+
+void *w_thread_worker(void *a) {
+        keymix_job_t *job;
+
+        pthread_mutex_lock(&pool.lock);
+        while (true) {
+                while (pool.head == NULL && !pool.stop)
+                        pthread_cond_wait(&pool.cond, &pool.lock);
+
+                job = pop_job(&pool.head, &pool.tail);
+                if (job == NULL)
+                        break;
+                pthread_mutex_unlock(&pool.lock);
+
+                // A job is either running on a single worker or waiting in
+                // the pool, so its keys are encrypted in order
+                bool over = run_turn(job);
+                if (over)
+                        complete(job);
+
+                pthread_mutex_lock(&pool.lock);
+                if (!over) {
+                        push_job(&pool.head, &pool.tail, job);
+                        pthread_cond_signal(&pool.cond);
+                }
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        return NULL;
+}
+
+int keymix_async_init(uint8_t nof_workers) {
+        int err = 0;
+
+        pthread_mutex_lock(&pool.lock);
+        if (pool.nof_workers) {
+                goto cleanup;
+        }
+
+        if (!nof_workers)
+                nof_workers = get_default_threads();
+        pool.workers = malloc(nof_workers * sizeof(pthread_t));
+        pool.stop    = false;
+        if (pool.workers == NULL) {
+                err = 1;
+                goto cleanup;
+        }
+
+        for (uint8_t w = 0; w < nof_workers; w++) {
+                err = pthread_create(&pool.workers[w], NULL, w_thread_worker, NULL);
+                if (err) {
+                        _log(LOG_ERROR, "pthread_create error %d (worker %d)\n", err, w);
+                        break;
+                }
+                pool.nof_workers++;
+        }
+
+cleanup:
+        pthread_mutex_unlock(&pool.lock);
+        return err;
+}
+
+void keymix_async_shutdown(void) {
+        pthread_mutex_lock(&pool.lock);
+        pool.stop = true;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+
+        for (uint8_t w = 0; w < pool.nof_workers; w++) {
+                pthread_join(pool.workers[w], NULL);
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        free(pool.workers);
+        pool.workers     = NULL;
+        pool.nof_workers = 0;
+        pthread_mutex_unlock(&pool.lock);
+}
+
+// --------------------------------------------------------- Jobs
+
+keymix_job_t *encrypt_submit(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
+                             uint8_t threads, keymix_callback_t callback, keymix_queue_t *queue,
+                             void *arg) {
+        keymix_job_t *job;
+
+        if (keymix_async_init(KEYMIX_ASYNC_WORKERS)) {
+                _log(LOG_ERROR, "Cannot start the worker pool\n");
+                return NULL;
+        }
+
+        job = calloc(1, sizeof(keymix_job_t));
+        if (job == NULL) {
+                return NULL;
+        }
+
+        job->ctx      = ctx;
+        job->in       = in;
+        job->out      = out;
+        job->size     = size;
+        job->has_iv   = (iv != NULL);
+        job->threads  = threads;
+        job->callback = callback;
+        job->queue    = queue;
+        job->arg      = arg;
+        if (iv) {
+                memcpy(job->iv, iv, KEYMIX_IV_SIZE);
+        }
+        pthread_mutex_init(&job->lock, NULL);
+        pthread_cond_init(&job->cond, NULL);
+
+        pthread_mutex_lock(&pool.lock);
+        push_job(&pool.head, &pool.tail, job);
+        pthread_cond_signal(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+
+        return job;
+}
+
+int keymix_job_wait(keymix_job_t *job) {
+        pthread_mutex_lock(&job->lock);
+        while (!job->done)
+                pthread_cond_wait(&job->cond, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+
+        return job->err;
+}
+
+inline int keymix_job_err(keymix_job_t *job) { return job->err; }
+
+inline void *keymix_job_arg(keymix_job_t *job) { return job->arg; }
+
+void keymix_job_free(keymix_job_t *job) {
+        if (job == NULL)
+                return;
+
+        pthread_mutex_destroy(&job->lock);
+        pthread_cond_destroy(&job->cond);
+        explicit_bzero(job->iv, KEYMIX_IV_SIZE);
+        free(job);
+}
+
+// --------------------------------------------------------- Completion queues
+
+int keymix_queue_init(keymix_queue_t *queue) {
+        // In semaphore mode, each read takes a single completion
+        queue->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+        if (queue->fd < 0) {
+                _log(LOG_ERROR, "Cannot create the eventfd of the queue\n");
+                return 1;
+        }
+
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->head = NULL;
+        queue->tail = NULL;
+        return 0;
+}
+
+keymix_job_t *keymix_queue_pop(keymix_queue_t *queue) {
+        keymix_job_t *job;
+        uint64_t value;
+
+        pthread_mutex_lock(&queue->lock);
+        job = pop_job(&queue->head, &queue->tail);
+        if (job != NULL && read(queue->fd, &value, sizeof(value)) != sizeof(value))
+                _log(LOG_ERROR, "Cannot consume the completion queue\n");
+        pthread_mutex_unlock(&queue->lock);
+
+        return job;
+}
+
+void keymix_queue_free(keymix_queue_t *queue) {
+        close(queue->fd);
+        pthread_mutex_destroy(&queue->lock);
+}
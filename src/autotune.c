@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+
+#include "autotune.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ctx.h"
+#include "keymix.h"
+#include "log.h"
+#include "mix.h"
+#include "types.h"
+#include "utils.h"
+
+#define AUTOTUNE_CACHE_DIR "keymix"
+#define AUTOTUNE_CACHE_LINE_SIZE 128
+
+#define CGROUP_V2_CPU_MAX "/sys/fs/cgroup/cpu.max"
+#define CGROUP_V1_CPU_QUOTA "/sys/fs/cgroup/cpu/cpu.cfs_quota_us"
+#define CGROUP_V1_CPU_PERIOD "/sys/fs/cgroup/cpu/cpu.cfs_period_us"
+
+// Maximum number of fanouts considered by the calibration
+#define AUTOTUNE_MAX_FANOUTS 8
+
+// *** MIX FAMILIES ***
+
+char *MIX_FAMILY_NAMES[] = {
+    "none",
+    // Fixed-output functions
+    "aes",
+    "davies-meyer",
+    "matyas-meyer-oseas",
+    "sha3-256",
+    "blake2s",
+    "blake3",
+    "haraka-256",
+    "mixctr",
+    "sha3-512",
+    "blake2b",
+    "haraka-512",
+    // Extendable-output functions (XOFs)
+    "xoodyak",
+    "xoofff-wbc",
+    "shake256",
+    "turboshake256",
+    "shake128",
+    "turboshake128",
+    "kangarootwelve",
+    "kravette-wbc",
+};
+
+mix_t get_mix_family(char *name) {
+        uint8_t n = sizeof(MIX_FAMILY_NAMES) / sizeof(*MIX_FAMILY_NAMES);
+        for (uint8_t i = 1; i < n; i++)
+                if (strcmp(name, MIX_FAMILY_NAMES[i]) == 0)
+                        return (mix_t)i;
+        return -1;
+}
+
+char *get_mix_family_name(mix_t family) {
+        uint8_t n = sizeof(MIX_FAMILY_NAMES) / sizeof(*MIX_FAMILY_NAMES);
+        if (family < 0 || family >= n) {
+                return NULL;
+        }
+
+        return MIX_FAMILY_NAMES[family];
+}
+
+// *** CACHE ***
+
+int get_autotune_cache_path(char *path, size_t size) {
+        char hostname[HOST_NAME_MAX + 1];
+        char *base   = getenv("XDG_CACHE_HOME");
+        char *suffix = "";
+        int len;
+
+        if (!base || !*base) {
+                base   = getenv("HOME");
+                suffix = "/.cache";
+        }
+        if (!base || !*base) {
+                _log(LOG_ERROR, "Cannot locate the cache directory\n");
+                return 1;
+        }
+
+        if (gethostname(hostname, sizeof(hostname))) {
+                _log(LOG_ERROR, "gethostname error %d\n", errno);
+                return 1;
+        }
+        hostname[HOST_NAME_MAX] = '\0';
+
+        len = snprintf(path, size, "%s%s/%s/autotune-%s", base, suffix, AUTOTUNE_CACHE_DIR,
+                       hostname);
+        return (len < 0 || len >= size);
+}
+
+// Look up the implementation chosen for `family` in the cache, each line of
+// which is made of the family name and the implementation name
+mix_impl_t cache_lookup(const char *cache_path, mix_t family) {
+        char line[AUTOTUNE_CACHE_LINE_SIZE];
+        char family_name[AUTOTUNE_CACHE_LINE_SIZE];
+        char impl_name[AUTOTUNE_CACHE_LINE_SIZE];
+        mix_impl_t mix_type = -1;
+
+        FILE *fp = fopen(cache_path, "r");
+        if (!fp) {
+                return -1;
+        }
+
+        while (fgets(line, sizeof(line), fp)) {
+                if (sscanf(line, "%127s %127s", family_name, impl_name) != 2)
+                        continue;
+                if (strcmp(family_name, get_mix_family_name(family)))
+                        continue;
+
+                mix_type = get_mix_type(impl_name);
+                // Ignore stale entries
+                if (mix_type != -1 && get_mix_info(mix_type)->primitive != family)
+                        mix_type = -1;
+        }
+
+        fclose(fp);
+        return mix_type;
+}
+
+// Create the parent directories of `path`, if missing
+int mkdir_parents(const char *path) {
+        char dir[PATH_MAX];
+
+        if (strlen(path) >= sizeof(dir)) {
+                return 1;
+        }
+        strcpy(dir, path);
+
+        for (char *p = dir + 1; *p; p++) {
+                if (*p != '/')
+                        continue;
+
+                *p = '\0';
+                if (mkdir(dir, 0755) && errno != EEXIST) {
+                        _log(LOG_ERROR, "mkdir error %d (%s)\n", errno, dir);
+                        return 1;
+                }
+                *p = '/';
+        }
+        return 0;
+}
+
+// Persist the implementation chosen for `family`, keeping the entries of the
+// other families. The cache is replaced atomically, so that concurrent runs
+// never read a partial file.
+int cache_store(const char *cache_path, mix_t family, mix_impl_t mix_type) {
+        char line[AUTOTUNE_CACHE_LINE_SIZE];
+        char family_name[AUTOTUNE_CACHE_LINE_SIZE];
+        char tmp_path[PATH_MAX];
+        FILE *fin;
+        FILE *fout;
+        int len;
+
+        if (mkdir_parents(cache_path)) {
+                return 1;
+        }
+
+        len = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", cache_path, getpid());
+        if (len < 0 || len >= sizeof(tmp_path)) {
+                return 1;
+        }
+
+        fout = fopen(tmp_path, "w");
+        if (!fout) {
+                _log(LOG_ERROR, "Cannot write the autotuning cache %s\n", tmp_path);
+                return 1;
+        }
+
+        fin = fopen(cache_path, "r");
+        if (fin) {
+                while (fgets(line, sizeof(line), fin)) {
+                        if (sscanf(line, "%127s", family_name) == 1 &&
+                            !strcmp(family_name, get_mix_family_name(family)))
+                                continue;
+                        fputs(line, fout);
+                }
+                fclose(fin);
+        }
+
+        fprintf(fout, "%s %s\n", get_mix_family_name(family), get_mix_name(mix_type));
+
+        if (fclose(fout) || rename(tmp_path, cache_path)) {
+                _log(LOG_ERROR, "Cannot update the autotuning cache %s\n", cache_path);
+                unlink(tmp_path);
+                return 1;
+        }
+        return 0;
+}
+
+// *** MICROBENCHMARK ***
+
+mix_impl_t autotune_benchmark(mix_t family) {
+        mix_impl_t best_mix_type = -1;
+        double best_time         = 0;
+        mix_info_t *info;
+        byte *buffer;
+        size_t size;
+
+        buffer = checked_malloc(AUTOTUNE_BUFFER_SIZE);
+        for (size_t i = 0; i < AUTOTUNE_BUFFER_SIZE; i++) {
+                buffer[i] = rand();
+        }
+
+        for (mix_impl_t mix_type = 0; (info = get_mix_info(mix_type)); mix_type++) {
+                if (info->primitive != family || !is_mix_supported(mix_type))
+                        continue;
+
+                size = AUTOTUNE_BUFFER_SIZE - AUTOTUNE_BUFFER_SIZE % info->block_size;
+
+                double time = 0;
+                for (uint8_t r = 0; r < AUTOTUNE_RUNS; r++) {
+                        double curr_time = MEASURE(
+                            (*info->function)(buffer, buffer, size, MIXPASS_DEFAULT_IV));
+                        time = (!r ? curr_time : MIN(time, curr_time));
+                }
+                _log(LOG_DEBUG, "[autotune] %s: %.1f MiB/s\n", info->name,
+                     size / time / 1.024 / 1024);
+
+                // The implementations of a family share the block size, so
+                // they process the same amount of data
+                if (best_mix_type == -1 || time < best_time) {
+                        best_mix_type = mix_type;
+                        best_time     = time;
+                }
+        }
+
+        explicit_bzero(buffer, AUTOTUNE_BUFFER_SIZE);
+        free(buffer);
+        return best_mix_type;
+}
+
+mix_impl_t autotune_mix(mix_t family, const char *cache_path) {
+        char default_cache_path[PATH_MAX];
+        mix_impl_t mix_type;
+
+        if (!get_mix_family_name(family) || family == MIX_NONE) {
+                return -1;
+        }
+
+        if (!cache_path) {
+                cache_path = (get_autotune_cache_path(default_cache_path,
+                                                      sizeof(default_cache_path))
+                                      ? NULL
+                                      : default_cache_path);
+        }
+
+        if (cache_path) {
+                mix_type = cache_lookup(cache_path, family);
+                if (mix_type != -1) {
+                        _log(LOG_DEBUG, "[autotune] %s: cached %s\n",
+                             get_mix_family_name(family), get_mix_name(mix_type));
+                        return mix_type;
+                }
+        }
+
+        mix_type = autotune_benchmark(family);
+        if (mix_type == -1) {
+                return -1;
+        }
+        _log(LOG_DEBUG, "[autotune] %s: picked %s\n", get_mix_family_name(family),
+             get_mix_name(mix_type));
+
+        // A missing cache only costs a new benchmark on the next run
+        if (cache_path) {
+                cache_store(cache_path, family, mix_type);
+        }
+        return mix_type;
+}
+
+// *** THREADS AND FANOUT ***
+
+// Read the CPU quota of the cgroup as a number of CPUs, or 0 if unlimited
+double get_cgroup_cpus() {
+        long long quota  = -1;
+        long long period = 0;
+        char max[32];
+        FILE *fp;
+
+        // cgroup v2: "$MAX $PERIOD", where $MAX may be "max"
+        fp = fopen(CGROUP_V2_CPU_MAX, "r");
+        if (fp) {
+                if (fscanf(fp, "%31s %lld", max, &period) == 2 && strcmp(max, "max"))
+                        quota = atoll(max);
+                fclose(fp);
+        } else {
+                // cgroup v1: a quota of -1 means unlimited
+                fp = fopen(CGROUP_V1_CPU_QUOTA, "r");
+                if (fp) {
+                        if (fscanf(fp, "%lld", &quota) != 1)
+                                quota = -1;
+                        fclose(fp);
+                }
+                fp = fopen(CGROUP_V1_CPU_PERIOD, "r");
+                if (fp) {
+                        if (fscanf(fp, "%lld", &period) != 1)
+                                period = 0;
+                        fclose(fp);
+                }
+        }
+
+        if (quota <= 0 || period <= 0) {
+                return 0;
+        }
+        return (double)quota / period;
+}
+
+uint8_t get_default_threads(void) {
+        cpu_set_t cpu_set;
+        long nof_cpus;
+        double cgroup_cpus;
+
+        if (!sched_getaffinity(0, sizeof(cpu_set), &cpu_set)) {
+                nof_cpus = CPU_COUNT(&cpu_set);
+        } else {
+                nof_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+
+        cgroup_cpus = get_cgroup_cpus();
+        if (cgroup_cpus > 0) {
+                nof_cpus = MIN(nof_cpus, (long)ceil(cgroup_cpus));
+        }
+
+        return MAX(1, MIN(nof_cpus, UINT8_MAX));
+}
+
+// Time a keymix with the given parameters over a key of `size` bytes
+double calibrate(mix_impl_t mix, block_size_t block_size, byte *key, byte *out, size_t size,
+                 uint8_t fanout, uint8_t threads) {
+        ctx_t ctx;
+        double time;
+
+        if (ctx_keymix_init_ex(&ctx, mix, key, size, fanout, block_size)) {
+                return -1;
+        }
+        time = MEASURE(keymix_t(&ctx, out, size, threads));
+        ctx_free(&ctx);
+        return time;
+}
+
+int autotune_keymix(mix_impl_t mix, block_size_t block_size, size_t key_size, bool tune_fanout,
+                    uint8_t *fanout, uint8_t *threads) {
+        uint8_t fanouts[AUTOTUNE_MAX_FANOUTS];
+        int nof_fanouts;
+        uint8_t max_threads = MAX(1, *threads);
+        double best_time    = -1;
+        mix_info_t *info    = get_mix_info(mix);
+
+        if (!info || mix == NONE) {
+                return 1;
+        }
+        if (!block_size) {
+                block_size = info->block_size;
+        }
+        if (!is_block_size_supported(mix, block_size) || !key_size || key_size % block_size) {
+                return 1;
+        }
+
+        uint64_t nof_macros = key_size / block_size;
+        if (tune_fanout) {
+                nof_fanouts = get_fanouts_from_block_size(block_size, AUTOTUNE_MAX_FANOUTS, fanouts);
+                if (nof_fanouts <= 0)
+                        return 1;
+
+                // Keep the fanouts whose powers make up the key size
+                int nof_fitting = 0;
+                for (int f = 0; f < nof_fanouts; f++) {
+                        if (ISPOWEROF(nof_macros, fanouts[f]))
+                                fanouts[nof_fitting++] = fanouts[f];
+                }
+                if (!nof_fitting)
+                        return AUTOTUNE_ERR_FANOUT;
+                nof_fanouts = nof_fitting;
+        } else {
+                nof_fanouts = 1;
+                fanouts[0]  = *fanout;
+        }
+
+        byte *key = checked_malloc(AUTOTUNE_BUFFER_SIZE);
+        byte *out = checked_malloc(AUTOTUNE_BUFFER_SIZE);
+        for (size_t i = 0; i < AUTOTUNE_BUFFER_SIZE; i++) {
+                key[i] = rand();
+        }
+
+        for (int f = 0; f < nof_fanouts; f++) {
+                if (!ISPOWEROF(nof_macros, fanouts[f]))
+                        continue;
+
+                // Largest key with the same structure that fits the buffer
+                size_t size = key_size;
+                while (size > AUTOTUNE_BUFFER_SIZE) {
+                        size /= fanouts[f];
+                }
+
+                // Try the powers of 2 up to the maximum #threads, and the
+                // maximum itself
+                for (uint16_t t = 1; t <= max_threads; t = (t < max_threads && 2 * t > max_threads
+                                                              ? max_threads
+                                                              : 2 * t)) {
+                        double time = calibrate(mix, block_size, key, out, size, fanouts[f], t);
+                        if (time < 0)
+                                continue;
+
+                        // Compare the time per byte, since the calibration
+                        // size depends on the fanout
+                        time /= size;
+                        _log(LOG_DEBUG, "[autotune] fanout %d, threads %d: %.1f MiB/s\n",
+                             fanouts[f], t, 1 / time / 1.024 / 1024);
+                        if (best_time < 0 || time < best_time) {
+                                best_time = time;
+                                *fanout   = fanouts[f];
+                                *threads  = t;
+                        }
+                }
+        }
+
+        explicit_bzero(key, AUTOTUNE_BUFFER_SIZE);
+        free(key);
+        free(out);
+        return (best_time < 0);
+}
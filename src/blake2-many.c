@@ -0,0 +1,151 @@
+#include "blake2-many.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "isa.h"
+#include "types.h"
+
+// Unkeyed BLAKE2s-256 (BLAKE2b-512) over a 32-byte (64-byte) message is a
+// single compression of one zero-padded block flagged as the last one. Since
+// the mixpass hashes lots of independent messages of the same length, we
+// compress several of them at a time with the state transposed (one vector
+// per state word, one lane per message).
+// The vectors rely on GCC vector extensions, which map to the widest SIMD
+// registers available for the target, and the kernels are built for several
+// targets picked at load time (see isa.h).
+
+typedef uint32_t vec32_t __attribute__((vector_size(4 * BLAKE2S_MANY_LANES)));
+typedef uint64_t vec64_t __attribute__((vector_size(8 * BLAKE2B_MANY_LANES)));
+
+static const uint32_t BLAKE2S_IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                       0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+static const uint64_t BLAKE2B_IV[8] = {0x6A09E667F3BCC908, 0xBB67AE8584CAA73B, 0x3C6EF372FE94F82B,
+                                       0xA54FF53A5F1D36F1, 0x510E527FADE682D1, 0x9B05688C2B3E6C1F,
+                                       0x1F83D9ABFB41BD6B, 0x5BE0CD19137E2179};
+
+static const uint8_t BLAKE2_SIGMA[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+};
+
+// Parameter block word 0: digest length, no key, fanout 1 and depth 1
+#define BLAKE2_PARAM(outlen) (0x01010000 ^ (outlen))
+
+#define ROTR(x, n, bits) (((x) >> (n)) | ((x) << ((bits) - (n))))
+
+#define G(a, b, c, d, mx, my, r1, r2, r3, r4, bits)                                                \
+        do {                                                                                       \
+                v[a] = v[a] + v[b] + (mx);                                                         \
+                v[d] = ROTR(v[d] ^ v[a], r1, bits);                                                \
+                v[c] = v[c] + v[d];                                                                \
+                v[b] = ROTR(v[b] ^ v[c], r2, bits);                                                \
+                v[a] = v[a] + v[b] + (my);                                                         \
+                v[d] = ROTR(v[d] ^ v[a], r3, bits);                                                \
+                v[c] = v[c] + v[d];                                                                \
+                v[b] = ROTR(v[b] ^ v[c], r4, bits);                                                \
+        } while (0)
+
+#define ROUND(s, r1, r2, r3, r4, bits)                                                             \
+        do {                                                                                       \
+                G(0, 4, 8, 12, m[s[0]], m[s[1]], r1, r2, r3, r4, bits);                            \
+                G(1, 5, 9, 13, m[s[2]], m[s[3]], r1, r2, r3, r4, bits);                            \
+                G(2, 6, 10, 14, m[s[4]], m[s[5]], r1, r2, r3, r4, bits);                           \
+                G(3, 7, 11, 15, m[s[6]], m[s[7]], r1, r2, r3, r4, bits);                           \
+                G(0, 5, 10, 15, m[s[8]], m[s[9]], r1, r2, r3, r4, bits);                           \
+                G(1, 6, 11, 12, m[s[10]], m[s[11]], r1, r2, r3, r4, bits);                         \
+                G(2, 7, 8, 13, m[s[12]], m[s[13]], r1, r2, r3, r4, bits);                          \
+                G(3, 4, 9, 14, m[s[14]], m[s[15]], r1, r2, r3, r4, bits);                          \
+        } while (0)
+
+// Compresses a batch of messages, where `word_t`/`vec_t` are the word and
+// vector types, `lanes` the number of messages and `block_size` their size
+#define COMPRESS_LANES(word_t, vec_t, lanes, block_size, iv, rounds, r1, r2, r3, r4)               \
+        do {                                                                                       \
+                vec_t h[8];                                                                        \
+                vec_t v[16];                                                                       \
+                vec_t m[16];                                                                       \
+                word_t word;                                                                       \
+                uint8_t nof_words = (block_size) / sizeof(word_t);                                 \
+                                                                                                   \
+                /* Transpose the messages, the rest of the block is zero */                        \
+                for (uint8_t w = 0; w < 16; w++) {                                                 \
+                        m[w] = (vec_t){0};                                                         \
+                        for (uint8_t l = 0; w < nof_words && l < (lanes); l++) {                   \
+                                memcpy(&word, in + l * (block_size) + w * sizeof(word_t),          \
+                                       sizeof(word_t));                                            \
+                                m[w][l] = word;                                                    \
+                        }                                                                          \
+                }                                                                                  \
+                                                                                                   \
+                for (uint8_t w = 0; w < 8; w++) {                                                  \
+                        h[w]     = (vec_t){0} + iv[w];                                             \
+                        v[w + 8] = (vec_t){0} + iv[w];                                             \
+                }                                                                                  \
+                h[0] ^= BLAKE2_PARAM(block_size);                                                  \
+                memcpy(v, h, sizeof(h));                                                           \
+                                                                                                   \
+                /* Byte counter and last block flag */                                             \
+                v[12] ^= (block_size);                                                             \
+                v[14] = ~v[14];                                                                    \
+                                                                                                   \
+                for (uint8_t r = 0; r < (rounds); r++) {                                           \
+                        ROUND(BLAKE2_SIGMA[r % 10], r1, r2, r3, r4, 8 * sizeof(word_t));           \
+                }                                                                                  \
+                                                                                                   \
+                for (uint8_t w = 0; w < 8; w++) {                                                  \
+                        h[w] ^= v[w] ^ v[w + 8];                                                   \
+                        for (uint8_t l = 0; l < (lanes); l++) {                                    \
+                                word = h[w][l];                                                    \
+                                memcpy(out + l * (block_size) + w * sizeof(word_t), &word,         \
+                                       sizeof(word_t));                                            \
+                        }                                                                          \
+                }                                                                                  \
+        } while (0)
+
+static inline __attribute__((always_inline)) void blake2s_compress_lanes(byte *in, byte *out) {
+        COMPRESS_LANES(uint32_t, vec32_t, BLAKE2S_MANY_LANES, BLAKE2S_MANY_BLOCK_SIZE, BLAKE2S_IV,
+                       10, 16, 12, 8, 7);
+}
+
+static inline __attribute__((always_inline)) void blake2b_compress_lanes(byte *in, byte *out) {
+        COMPRESS_LANES(uint64_t, vec64_t, BLAKE2B_MANY_LANES, BLAKE2B_MANY_BLOCK_SIZE, BLAKE2B_IV,
+                       12, 32, 24, 16, 63);
+}
+
+#define HASH_MANY(compress_lanes, lanes, block_size)                                               \
+        do {                                                                                       \
+                size_t batch_size = (lanes) * (block_size);                                        \
+                byte tail[(lanes) * (block_size)];                                                 \
+                                                                                                   \
+                byte *last = in + size - size % batch_size;                                        \
+                for (; in < last; in += batch_size, out += batch_size) {                           \
+                        compress_lanes(in, out);                                                   \
+                }                                                                                  \
+                                                                                                   \
+                /* Process the remaining blocks in a zero-padded batch */                          \
+                size %= batch_size;                                                                \
+                if (size) {                                                                        \
+                        memcpy(tail, in, size);                                                    \
+                        memset(tail + size, 0, batch_size - size);                                 \
+                        compress_lanes(tail, tail);                                                \
+                        memcpy(out, tail, size);                                                   \
+                }                                                                                  \
+        } while (0)
+
+ISA_CLONES void blake2s_hash_many_32(byte *in, byte *out, size_t size) {
+        HASH_MANY(blake2s_compress_lanes, BLAKE2S_MANY_LANES, BLAKE2S_MANY_BLOCK_SIZE);
+}
+
+ISA_CLONES void blake2b_hash_many_64(byte *in, byte *out, size_t size) {
+        HASH_MANY(blake2b_compress_lanes, BLAKE2B_MANY_LANES, BLAKE2B_MANY_BLOCK_SIZE);
+}
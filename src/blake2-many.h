@@ -0,0 +1,26 @@
+#ifndef BLAKE2_MANY_H
+#define BLAKE2_MANY_H
+
+#include <stdlib.h>
+
+#include "types.h"
+
+// Number of independent messages compressed together by the kernels
+#define BLAKE2S_MANY_LANES 8
+#define BLAKE2B_MANY_LANES 4
+
+// Size of the messages (and digests) supported by the kernels
+#define BLAKE2S_MANY_BLOCK_SIZE 32
+#define BLAKE2B_MANY_BLOCK_SIZE 64
+
+// Computes the BLAKE2s-256 digest of every 32-byte block of `in` into the
+// corresponding block of `out`. Here `size` must be a multiple of 32 and the
+// operation can be done in-place.
+void blake2s_hash_many_32(byte *in, byte *out, size_t size);
+
+// Computes the BLAKE2b-512 digest of every 64-byte block of `in` into the
+// corresponding block of `out`. Here `size` must be a multiple of 64 and the
+// operation can be done in-place.
+void blake2b_hash_many_64(byte *in, byte *out, size_t size);
+
+#endif
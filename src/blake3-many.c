@@ -0,0 +1,114 @@
+#include "blake3-many.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "isa.h"
+#include "types.h"
+
+// A 32-byte input fits in a single BLAKE3 chunk made of a single block, so
+// its digest is just one compression with the CHUNK_START, CHUNK_END and ROOT
+// flags set. The library wraps each compression with the hasher bookkeeping
+// and its SIMD `hash_many` kernels assume full 64-byte blocks, so here we
+// compress `BLAKE3_MANY_LANES` messages at a time with the state transposed
+// (one vector per state word, one lane per message).
+// The vectors rely on GCC vector extensions, which map to the widest SIMD
+// registers available for the target, and the kernels are built for several
+// targets picked at load time (see isa.h).
+
+typedef uint32_t vec_t __attribute__((vector_size(4 * BLAKE3_MANY_LANES)));
+
+#define BLAKE3_CHUNK_START 1
+#define BLAKE3_CHUNK_END 2
+#define BLAKE3_ROOT 8
+
+static const uint32_t BLAKE3_IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                      0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+static const uint8_t BLAKE3_MSG_PERMUTATION[16] = {2, 6,  3,  10, 7,  0,  4,  13,
+                                                   1, 11, 12, 5,  9,  14, 15, 8};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define G(a, b, c, d, mx, my)                                                                      \
+        do {                                                                                       \
+                v[a] = v[a] + v[b] + (mx);                                                         \
+                v[d] = ROTR(v[d] ^ v[a], 16);                                                      \
+                v[c] = v[c] + v[d];                                                                \
+                v[b] = ROTR(v[b] ^ v[c], 12);                                                      \
+                v[a] = v[a] + v[b] + (my);                                                         \
+                v[d] = ROTR(v[d] ^ v[a], 8);                                                       \
+                v[c] = v[c] + v[d];                                                                \
+                v[b] = ROTR(v[b] ^ v[c], 7);                                                       \
+        } while (0)
+
+static inline __attribute__((always_inline)) void compress_lanes(byte *in, byte *out) {
+        vec_t v[16];
+        vec_t m[16];
+        vec_t tmp[16];
+        uint32_t word;
+
+        // Transpose the messages, the 2nd half of the 64-byte block is zero
+        for (uint8_t w = 0; w < 8; w++) {
+                for (uint8_t l = 0; l < BLAKE3_MANY_LANES; l++) {
+                        memcpy(&word, in + l * BLAKE3_MANY_BLOCK_SIZE + 4 * w, sizeof(word));
+                        m[w][l] = word;
+                }
+                m[w + 8] = (vec_t){0};
+        }
+
+        for (uint8_t w = 0; w < 8; w++) {
+                v[w] = (vec_t){0} + BLAKE3_IV[w];
+        }
+        for (uint8_t w = 0; w < 4; w++) {
+                v[w + 8] = (vec_t){0} + BLAKE3_IV[w];
+        }
+        v[12] = (vec_t){0};                        // counter (low)
+        v[13] = (vec_t){0};                        // counter (high)
+        v[14] = (vec_t){0} + BLAKE3_MANY_BLOCK_SIZE; // block length
+        v[15] = (vec_t){0} + (BLAKE3_CHUNK_START | BLAKE3_CHUNK_END | BLAKE3_ROOT);
+
+        for (uint8_t r = 0; r < 7; r++) {
+                G(0, 4, 8, 12, m[0], m[1]);
+                G(1, 5, 9, 13, m[2], m[3]);
+                G(2, 6, 10, 14, m[4], m[5]);
+                G(3, 7, 11, 15, m[6], m[7]);
+                G(0, 5, 10, 15, m[8], m[9]);
+                G(1, 6, 11, 12, m[10], m[11]);
+                G(2, 7, 8, 13, m[12], m[13]);
+                G(3, 4, 9, 14, m[14], m[15]);
+
+                for (uint8_t w = 0; w < 16; w++) {
+                        tmp[w] = m[BLAKE3_MSG_PERMUTATION[w]];
+                }
+                memcpy(m, tmp, sizeof(m));
+        }
+
+        // The digest is the 1st half of the output chaining value
+        for (uint8_t w = 0; w < 8; w++) {
+                v[w] ^= v[w + 8];
+                for (uint8_t l = 0; l < BLAKE3_MANY_LANES; l++) {
+                        word = v[w][l];
+                        memcpy(out + l * BLAKE3_MANY_BLOCK_SIZE + 4 * w, &word, sizeof(word));
+                }
+        }
+}
+
+ISA_CLONES void blake3_hash_many_32(byte *in, byte *out, size_t size) {
+        size_t batch_size = BLAKE3_MANY_LANES * BLAKE3_MANY_BLOCK_SIZE;
+        byte tail[BLAKE3_MANY_LANES * BLAKE3_MANY_BLOCK_SIZE];
+
+        byte *last = in + size - size % batch_size;
+        for (; in < last; in += batch_size, out += batch_size) {
+                compress_lanes(in, out);
+        }
+
+        // Process the remaining blocks in a zero-padded batch
+        size %= batch_size;
+        if (size) {
+                memcpy(tail, in, size);
+                memset(tail + size, 0, batch_size - size);
+                compress_lanes(tail, tail);
+                memcpy(out, tail, size);
+        }
+}
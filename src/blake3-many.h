@@ -0,0 +1,19 @@
+#ifndef BLAKE3_MANY_H
+#define BLAKE3_MANY_H
+
+#include <stdlib.h>
+
+#include "types.h"
+
+// Number of independent messages compressed together by the kernel
+#define BLAKE3_MANY_LANES 8
+
+// Size of the messages (and digests) supported by the kernel
+#define BLAKE3_MANY_BLOCK_SIZE 32
+
+// Computes the BLAKE3 digest of every 32-byte block of `in` into the
+// corresponding block of `out`. Here `size` must be a multiple of 32 and the
+// operation can be done in-place.
+void blake3_hash_many_32(byte *in, byte *out, size_t size);
+
+#endif
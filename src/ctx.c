@@ -1,14 +1,31 @@
 #include "ctx.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <openssl/evp.h>
 
 #include "keymix.h"
+#include "log.h"
 #include "spread.h"
 #include "utils.h"
 
 ctx_err_t ctx_keymix_init(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size, uint8_t fanout) {
-        ctx->state = NULL;
+        return ctx_keymix_init_ex(ctx, mix, key, size, fanout, 0);
+}
+
+// Initialize `ctx` for keymix purposes, except for its fanout schedule
+static ctx_err_t keymix_init(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size,
+                             block_size_t block_size) {
+        ctx->state     = NULL;
+        ctx->state_map = NULL;
+        ctx->key_fd    = -1;
+        ctx->key_lock  = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+        ctx->chains    = 1;
 
         if (get_mix_func(mix, &ctx->mixpass, &ctx->block_size)) {
                 return CTX_ERR_UNKNOWN_MIX;
@@ -18,8 +35,16 @@ ctx_err_t ctx_keymix_init(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size, ui
                 return CTX_ERR_MISSING_MIX;
         }
 
-        size_t num_macros = size / ctx->block_size;
-        if (size % ctx->block_size != 0 || !ISPOWEROF(num_macros, fanout)) {
+        // NOTE: `mixpass` only implements the default block size, custom
+        // block sizes are handled by the mix context (see `mix_ctx_init_sized`)
+        if (block_size) {
+                if (!is_block_size_supported(mix, block_size)) {
+                        return CTX_ERR_BLOCK_SIZE;
+                }
+                ctx->block_size = block_size;
+        }
+
+        if (size % ctx->block_size != 0) {
                 return CTX_ERR_KEYSIZE;
         }
 
@@ -28,26 +53,97 @@ ctx_err_t ctx_keymix_init(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size, ui
         ctx->key_size    = size;
         ctx->mix         = mix;
         ctx->one_way_mix = NONE;
-        ctx->fanout      = fanout;
         ctx_disable_encryption(ctx);
 
         return CTX_ERR_NONE;
 }
 
-ctx_err_t ctx_encrypt_init(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix, mix_impl_t one_way_mix,
-                           byte *key, size_t size, uint8_t fanout) {
-        ctx->state = NULL;
+// Set the fanout schedule of `ctx` and pick the spread of each level
+static ctx_err_t set_schedule(ctx_t *ctx, uint8_t *fanouts, uint8_t nof_fanouts) {
+        uint64_t nof_macros = ctx->key_size / ctx->block_size;
+        uint64_t product    = 1;
+
+        if (nof_fanouts >= KEYMIX_MAX_LEVELS) {
+                return CTX_ERR_KEYSIZE;
+        }
+
+        for (uint8_t i = 0; i < nof_fanouts; i++) {
+                // Each spread splits the blocks in `fanout` minis
+                if (fanouts[i] < 2 || ctx->block_size % fanouts[i]) {
+                        return CTX_ERR_FANOUT;
+                }
+                if (nof_macros % (product * fanouts[i])) {
+                        return CTX_ERR_KEYSIZE;
+                }
+                product *= fanouts[i];
+
+                ctx->fanouts[i] = fanouts[i];
+                ctx->spreads[i] = get_spread_func(ctx->block_size, fanouts[i]);
+        }
+
+        if (product != nof_macros) {
+                return CTX_ERR_KEYSIZE;
+        }
+
+        ctx->levels = nof_fanouts + 1;
+        ctx->fanout = (nof_fanouts ? fanouts[0] : 0);
+
+        return CTX_ERR_NONE;
+}
+
+ctx_err_t ctx_keymix_init_ex(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size, uint8_t fanout,
+                             block_size_t block_size) {
+        uint8_t fanouts[KEYMIX_MAX_LEVELS];
+        uint8_t nof_fanouts = 0;
+
+        ctx_err_t err = keymix_init(ctx, mix, key, size, block_size);
+        if (err) {
+                return err;
+        }
 
-        int err = ctx_keymix_init(ctx, mix, key, size, fanout);
+        if (fanout < 2 || ctx->block_size % fanout) {
+                return CTX_ERR_FANOUT;
+        }
+
+        // The number of blocks must be a power of the fanout
+        for (uint64_t num_macros = size / ctx->block_size; num_macros > 1; num_macros /= fanout) {
+                if (num_macros % fanout || nof_fanouts == KEYMIX_MAX_LEVELS - 1) {
+                        return CTX_ERR_KEYSIZE;
+                }
+                fanouts[nof_fanouts++] = fanout;
+        }
+
+        err = set_schedule(ctx, fanouts, nof_fanouts);
+        ctx->fanout = fanout;
+
+        return err;
+}
+
+ctx_err_t ctx_keymix_init_schedule(ctx_t *ctx, mix_impl_t mix, byte *key, size_t size,
+                                   uint8_t *fanouts, uint8_t nof_fanouts,
+                                   block_size_t block_size) {
+        ctx_err_t err = keymix_init(ctx, mix, key, size, block_size);
         if (err) {
                 return err;
         }
 
+        return set_schedule(ctx, fanouts, nof_fanouts);
+}
+
+ctx_err_t ctx_encrypt_init(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix, mix_impl_t one_way_mix,
+                           byte *key, size_t size, uint8_t fanout, uint8_t nof_threads) {
+        return ctx_encrypt_init_ex(ctx, enc_mode, mix, one_way_mix, key, size, fanout, 0,
+                                   nof_threads);
+}
+
+// Turn the keymix context `ctx` into an encryption context
+static ctx_err_t encrypt_init(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t one_way_mix,
+                              uint8_t nof_threads) {
         if (get_mix_func(one_way_mix, &ctx->one_way_mixpass, &ctx->one_way_block_size)) {
                 return CTX_ERR_UNKNOWN_ONE_WAY_MIX;
         }
 
-        mix_info_t mix_info = *get_mix_info(mix);
+        mix_info_t mix_info = *get_mix_info(ctx->mix);
         mix_info_t one_way_mix_info = *get_mix_info(one_way_mix);
 
         // Ensure the one-way mixing primitive is indeed a one-way primitive
@@ -56,8 +152,9 @@ ctx_err_t ctx_encrypt_init(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix, mix_
         }
 
         // Ensure the one-way mixing implementation is specified with the OFB
-        // encryption mode
-        if (enc_mode == ENC_MODE_OFB && one_way_mix == NONE) {
+        // encryption modes
+        bool ofb = (enc_mode == ENC_MODE_OFB || enc_mode == ENC_MODE_OFB_MULTI);
+        if (ofb && one_way_mix == NONE) {
                 return CTX_ERR_MISSING_ONE_WAY_MIX;
         }
 
@@ -68,15 +165,15 @@ ctx_err_t ctx_encrypt_init(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix, mix_
                 return CTX_ERR_INCOMPATIBLE_PRIMITIVES;
         }
 
-        // Ensure the mixing primitive are not the same with the OFB encryption mode.
+        // Ensure the mixing primitive are not the same with the OFB encryption modes.
         // Indeed, this would compromise the security of the encryption
-        if (enc_mode == ENC_MODE_OFB && mix_info.primitive == one_way_mix_info.primitive) {
+        if (ofb && mix_info.primitive == one_way_mix_info.primitive) {
                 return CTX_ERR_EQUAL_PRIMITIVES;
         }
 
         // Ensure the block size of the one-way mixing primitive is a divisor
         // of the key size
-        if (one_way_mix != NONE && size % ctx->one_way_block_size) {
+        if (one_way_mix != NONE && ctx->key_size % ctx->one_way_block_size) {
                 return CTX_ERR_KEYSIZE;
         }
 
@@ -85,74 +182,219 @@ ctx_err_t ctx_encrypt_init(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix, mix_
         ctx_enable_encryption(ctx);
 
         if (enc_mode == ENC_MODE_CTR_OPT) {
-                ctx_precompute_state(ctx);
-        } else if (enc_mode == ENC_MODE_OFB) {
-                ctx->state = malloc(ctx->key_size);
-                memcpy(ctx->state, ctx->key, ctx->key_size);
+                return ctx_precompute_state(ctx, nof_threads);
+        } else if (ofb) {
+                return ctx_set_ofb_chains(ctx, enc_mode == ENC_MODE_OFB ? 1 : KEYMIX_OFB_CHAINS);
         }
 
         return CTX_ERR_NONE;
 }
 
+ctx_err_t ctx_encrypt_init_ex(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix,
+                              mix_impl_t one_way_mix, byte *key, size_t size, uint8_t fanout,
+                              block_size_t block_size, uint8_t nof_threads) {
+        ctx->state = NULL;
+
+        int err = ctx_keymix_init_ex(ctx, mix, key, size, fanout, block_size);
+        if (err) {
+                return err;
+        }
+
+        return encrypt_init(ctx, enc_mode, one_way_mix, nof_threads);
+}
+
+ctx_err_t ctx_encrypt_init_schedule(ctx_t *ctx, enc_mode_t enc_mode, mix_impl_t mix,
+                                    mix_impl_t one_way_mix, byte *key, size_t size,
+                                    uint8_t *fanouts, uint8_t nof_fanouts,
+                                    block_size_t block_size, uint8_t nof_threads) {
+        ctx->state = NULL;
+
+        int err = ctx_keymix_init_schedule(ctx, mix, key, size, fanouts, nof_fanouts,
+                                           block_size);
+        if (err) {
+                return err;
+        }
+
+        return encrypt_init(ctx, enc_mode, one_way_mix, nof_threads);
+}
+
 inline void ctx_enable_encryption(ctx_t *ctx) { ctx->encrypt = true; }
 
 inline void ctx_disable_encryption(ctx_t *ctx) { ctx->encrypt = false; }
 
-void ctx_precompute_state(ctx_t *ctx) {
-        byte *curr;
-        size_t prev_size;
-        size_t curr_size;
-        uint8_t levels;
-
+ctx_err_t ctx_precompute_state(ctx_t *ctx, uint8_t nof_threads) {
         ctx->state = malloc(ctx->key_size);
-        curr       = ctx->state;
-        prev_size  = 1;
-        curr_size  = ctx->block_size;
-        levels     = get_levels(ctx->key_size, ctx->block_size, ctx->fanout);
+        if (ctx->state == NULL) {
+                _log(LOG_ERROR, "Cannot allocate the state\n");
+                return CTX_ERR_STATE;
+        }
+
+        // Never leave a partial state around, it would be used (or saved)
+        // as a valid one
+        if (keymix_precompute(ctx, ctx->state, nof_threads)) {
+                _log(LOG_ERROR, "Cannot precompute the state\n");
+                ctx_free(ctx);
+                return CTX_ERR_STATE;
+        }
+        return CTX_ERR_NONE;
+}
+
+ctx_err_t ctx_defer_key_load(ctx_t *ctx, int fd) {
+        // The other modes read the whole key before the first keymix (e.g.,
+        // to refresh it or to copy it into the state)
+        if (ctx->enc_mode != ENC_MODE_CTR || fd < 0) {
+                return CTX_ERR_KEY_LOAD;
+        }
 
-        // Copy key changed with iv and counter
-        memcpy(curr, ctx->key, ctx->block_size);
-        curr += ctx->block_size;
+        ctx->key_fd = fd;
+        return CTX_ERR_NONE;
+}
 
-        // Keymix to compute only the internal state that is kept equal across
-        // all iv and counter values
+// Fill the header of the state file of `ctx`, binding the state to its key
+// and configuration
+static int fill_state_header(ctx_t *ctx, ctx_state_header_t *header) {
+        _Static_assert(sizeof(ctx_state_header_t) <= CTX_STATE_OFFSET,
+                       "The state file header must fit before the state");
+
+        // Zero the padding too, so that headers can be compared as a whole
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, CTX_STATE_MAGIC, sizeof(header->magic));
+        header->version    = CTX_STATE_VERSION;
+        header->offset     = CTX_STATE_OFFSET;
+        header->key_size   = ctx->key_size;
+        header->block_size = ctx->block_size;
+        header->levels     = ctx->levels;
+        memcpy(header->fanouts, ctx->fanouts, ctx->levels - 1);
+        strncpy(header->mix, get_mix_name(ctx->mix), sizeof(header->mix) - 1);
+
+        if (!EVP_Digest(ctx->key, ctx->key_size, header->key_hash, NULL, EVP_sha256(), NULL)) {
+                _log(LOG_ERROR, "Cannot hash the key\n");
+                return 1;
+        }
+        return 0;
+}
 
-        spread_args_t args = {
-                .thread_id       = 0,
-                .nof_threads     = 1,
-                .fanout          = ctx->fanout,
-                .block_size      = ctx->block_size,
-        };
+ctx_err_t ctx_save_state(ctx_t *ctx, const char *path) {
+        byte header[CTX_STATE_OFFSET] = {0};
+        char tmp_path[PATH_MAX];
+        FILE *fp;
+        int fd;
 
-        (*ctx->mixpass)(ctx->key + ctx->block_size, curr,
-                        ctx->key_size - curr_size, MIXPASS_DEFAULT_IV);
+        if (!ctx->encrypt || ctx->enc_mode != ENC_MODE_CTR_OPT || ctx->state == NULL) {
+                return CTX_ERR_STATE;
+        }
 
-        for (args.level = 1; args.level < levels; args.level++) {
-                // Keep internal state not yet affected by iv and counter that
-                // will be affected at the current layer
-                prev_size = curr_size;
-                curr_size = ctx->fanout * prev_size;
-                curr += curr_size - prev_size;
+        if (fill_state_header(ctx, (ctx_state_header_t *)header)) {
+                return CTX_ERR_STATE;
+        }
 
-                args.buffer          = curr;
-                args.buffer_abs      = curr;
-                args.buffer_abs_size = ctx->key_size - curr_size,
-                args.buffer_size     = ctx->key_size - curr_size,
+        // Write a temporary file and then rename it, so that concurrent
+        // processes never map a partial state
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, getpid());
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+                _log(LOG_ERROR, "Cannot create the state file %s\n", tmp_path);
+                if (fd >= 0) {
+                        close(fd);
+                        unlink(tmp_path);
+                }
+                return CTX_ERR_STATE;
+        }
 
-                spread(&args);
-                (*ctx->mixpass)(curr, curr, ctx->key_size - curr_size,
-                                MIXPASS_DEFAULT_IV);
+        int err = (fwrite(header, 1, CTX_STATE_OFFSET, fp) != CTX_STATE_OFFSET ||
+                   fwrite(ctx->state, 1, ctx->key_size, fp) != ctx->key_size);
+        err |= fclose(fp);
+        if (!err) {
+                err = rename(tmp_path, path);
+        }
+        if (err) {
+                _log(LOG_ERROR, "Cannot write the state file %s\n", path);
+                unlink(tmp_path);
+                return CTX_ERR_STATE;
         }
+
+        return CTX_ERR_NONE;
+}
+
+ctx_err_t ctx_load_state(ctx_t *ctx, const char *path) {
+        ctx_state_header_t header;
+        struct stat st;
+        size_t map_size;
+        void *map;
+        int fd;
+
+        if (!ctx->encrypt || (ctx->enc_mode != ENC_MODE_CTR && ctx->enc_mode != ENC_MODE_CTR_OPT)) {
+                return CTX_ERR_STATE;
+        }
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return CTX_ERR_STATE;
+        }
+
+        map_size = CTX_STATE_OFFSET + ctx->key_size;
+        if (fstat(fd, &st) || st.st_size != map_size) {
+                close(fd);
+                return CTX_ERR_STATE;
+        }
+
+        map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+                _log(LOG_ERROR, "Cannot map the state file %s\n", path);
+                return CTX_ERR_STATE;
+        }
+
+        if (fill_state_header(ctx, &header) || memcmp(map, &header, sizeof(header))) {
+                munmap(map, map_size);
+                return CTX_ERR_STATE;
+        }
+
+        ctx_free(ctx);
+        ctx->state          = (byte *)map + CTX_STATE_OFFSET;
+        ctx->state_map      = map;
+        ctx->state_map_size = map_size;
+        ctx->enc_mode       = ENC_MODE_CTR_OPT;
+
+        return CTX_ERR_NONE;
+}
+
+ctx_err_t ctx_set_ofb_chains(ctx_t *ctx, uint8_t chains) {
+        byte *state;
+
+        // The ofb encryption mode has a single chain
+        bool single = (ctx->enc_mode == ENC_MODE_OFB && chains == 1);
+        if (!ctx->encrypt || chains == 0 || (ctx->enc_mode != ENC_MODE_OFB_MULTI && !single)) {
+                return CTX_ERR_CHAINS;
+        }
+
+        // Every chain starts from the key
+        state = malloc(ctx->key_size * chains);
+        if (state == NULL) {
+                return CTX_ERR_CHAINS;
+        }
+        for (uint8_t c = 0; c < chains; c++) {
+                memcpy(state + ctx->key_size * c, ctx->key, ctx->key_size);
+        }
+
+        ctx_free(ctx);
+        ctx->state  = state;
+        ctx->chains = chains;
+        return CTX_ERR_NONE;
 }
 
 inline void ctx_free(ctx_t *ctx) {
-        if (ctx->state != NULL) {
-                explicit_bzero(ctx->state, ctx->key_size);
+        if (ctx->state_map != NULL) {
+                munmap(ctx->state_map, ctx->state_map_size);
+        } else if (ctx->state != NULL) {
+                explicit_bzero(ctx->state, ctx->key_size * ctx->chains);
                 free(ctx->state);
         }
+        ctx->state     = NULL;
+        ctx->state_map = NULL;
 }
 
-char *ENC_NAMES[] = { "ctr", "ctr-opt", "ctr-ctr", "ofb" };
+char *ENC_NAMES[] = { "ctr", "ctr-opt", "ctr-ctr", "ofb", "ofb-multi" };
 
 char *get_enc_mode_name(enc_mode_t enc_mode) {
         uint8_t n = sizeof(ENC_NAMES) / sizeof(*ENC_NAMES);
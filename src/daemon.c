@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "enc.h"
+#include "log.h"
+
+// A client connection, along with the buffer it attached
+typedef struct {
+        int sock;
+        byte *data;
+        size_t size;
+} keymixd_conn_t;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int signum) { stop = 1; }
+
+// Sends `msg` with the file descriptor `fd` attached, if not negative
+static int send_with_fd(int sock, void *msg, size_t size, int fd) {
+        char control[CMSG_SPACE(sizeof(int))] = {0};
+        struct iovec iov  = {.iov_base = msg, .iov_len = size};
+        struct msghdr hdr = {.msg_iov = &iov, .msg_iovlen = 1};
+
+        if (fd >= 0) {
+                hdr.msg_control    = control;
+                hdr.msg_controllen = sizeof(control);
+
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+                cmsg->cmsg_level     = SOL_SOCKET;
+                cmsg->cmsg_type      = SCM_RIGHTS;
+                cmsg->cmsg_len       = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        return (sendmsg(sock, &hdr, MSG_NOSIGNAL) != size);
+}
+
+// Receives `msg` into `size` bytes and the file descriptor attached to it
+// into `fd`, or -1 if none. Returns the size of the message, 0 when the peer
+// closed the connection
+static ssize_t recv_with_fd(int sock, void *msg, size_t size, int *fd) {
+        char control[CMSG_SPACE(sizeof(int))];
+        struct iovec iov  = {.iov_base = msg, .iov_len = size};
+        struct msghdr hdr = {
+                .msg_iov        = &iov,
+                .msg_iovlen     = 1,
+                .msg_control    = control,
+                .msg_controllen = sizeof(control),
+        };
+
+        *fd = -1;
+        ssize_t res = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        if (res > 0 && cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+                memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        return res;
+}
+
+// --------------------------------------------------------- Server
+
+// Maps the buffer `fd` of the connection `conn`, replacing the previous one.
+// The buffer must be sealed against shrinking, otherwise the client could
+// truncate it while it is being encrypted
+static keymixd_status_t attach(keymixd_conn_t *conn, int fd) {
+        struct stat st;
+        byte *data;
+        int seals;
+
+        // Files that do not support seals make F_GET_SEALS fail
+        if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+                return KEYMIXD_ERR_ATTACH;
+        }
+        seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+                return KEYMIXD_ERR_ATTACH;
+        }
+
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+                return KEYMIXD_ERR_ATTACH;
+        }
+
+        if (conn->data != NULL) {
+                munmap(conn->data, conn->size);
+        }
+        conn->data = data;
+        conn->size = st.st_size;
+        return KEYMIXD_OK;
+}
+
+// Serves the next request of the connection `conn`. Returns 1 when the
+// connection is over
+static int serve_request(ctx_t *ctx, keymixd_conn_t *conn, uint8_t threads) {
+        keymixd_request_t req;
+        int fd;
+
+        ssize_t size = recv_with_fd(conn->sock, &req, sizeof(req), &fd);
+        if (size <= 0) {
+                return 1;
+        }
+
+        keymixd_response_t res = {
+                .status   = KEYMIXD_OK,
+                .enc_mode = ctx->enc_mode,
+                .key_size = ctx->key_size,
+        };
+
+        if (size != sizeof(req) || req.magic != KEYMIXD_MAGIC) {
+                res.status = KEYMIXD_ERR_REQUEST;
+        } else {
+                switch (req.op) {
+                case KEYMIXD_OP_INFO:
+                        break;
+                case KEYMIXD_OP_ATTACH:
+                        res.status = attach(conn, fd);
+                        break;
+                case KEYMIXD_OP_ENCRYPT:
+                        if (conn->data == NULL || req.offset > conn->size ||
+                            req.size > conn->size - req.offset) {
+                                res.status = KEYMIXD_ERR_BOUNDS;
+                        } else if (encrypt_t(ctx, conn->data + req.offset,
+                                             conn->data + req.offset, req.size, req.iv,
+                                             threads)) {
+                                res.status = KEYMIXD_ERR_ENC;
+                        }
+                        break;
+                default:
+                        res.status = KEYMIXD_ERR_REQUEST;
+                        break;
+                }
+        }
+
+        if (fd >= 0) {
+                close(fd);
+        }
+
+        return (send(conn->sock, &res, sizeof(res), MSG_NOSIGNAL) != sizeof(res));
+}
+
+static void close_conn(keymixd_conn_t *conn) {
+        if (conn->data != NULL) {
+                munmap(conn->data, conn->size);
+        }
+        close(conn->sock);
+}
+
+// The requests are served one at a time by a single event loop, each one on
+// all the `threads`, so that concurrent clients do not oversubscribe the CPUs
+int keymixd_serve(ctx_t *ctx, const char *path, uint8_t threads) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        struct sigaction sa     = {.sa_handler = on_signal};
+        struct pollfd *fds      = NULL;
+        keymixd_conn_t *conns   = NULL;
+        nfds_t nof_fds          = 1;
+        mode_t mask;
+        int sock;
+        int err = 0;
+
+        if (ctx->enc_mode == ENC_MODE_OFB || ctx->enc_mode == ENC_MODE_OFB_MULTI) {
+                _log(LOG_ERROR, "The ofb encryption modes cannot serve concurrent clients\n");
+                return 1;
+        }
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                _log(LOG_ERROR, "Socket path too long: %s\n", path);
+                return 1;
+        }
+        strcpy(addr.sun_path, path);
+
+        sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (sock < 0) {
+                _log(LOG_ERROR, "Cannot create the socket\n");
+                return 1;
+        }
+
+        // Only the owner can connect, since the daemon encrypts with its key
+        mask = umask(0077);
+        err  = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+        umask(mask);
+        if (err || listen(sock, SOMAXCONN)) {
+                _log(LOG_ERROR, "Cannot listen on %s: %s\n", path, strerror(errno));
+                close(sock);
+                return 1;
+        }
+
+        // No SA_RESTART, so that poll is interrupted
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        fds   = malloc(sizeof(struct pollfd));
+        conns = malloc(sizeof(keymixd_conn_t));
+        fds[0].fd     = sock;
+        fds[0].events = POLLIN;
+
+        while (!stop) {
+                if (poll(fds, nof_fds, -1) < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        _log(LOG_ERROR, "poll error: %s\n", strerror(errno));
+                        err = 1;
+                        break;
+                }
+
+                // Go backwards, so that closed connections can be replaced
+                // by the last one
+                for (nfds_t i = nof_fds - 1; i >= 1; i--) {
+                        if (!fds[i].revents)
+                                continue;
+                        if (serve_request(ctx, conns + i, threads)) {
+                                close_conn(conns + i);
+                                nof_fds--;
+                                fds[i]   = fds[nof_fds];
+                                conns[i] = conns[nof_fds];
+                        }
+                }
+
+                if (fds[0].revents & POLLIN) {
+                        int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+                        if (conn < 0) {
+                                _log(LOG_ERROR, "accept error: %s\n", strerror(errno));
+                                continue;
+                        }
+
+                        struct pollfd *new_fds = realloc(fds, (nof_fds + 1) * sizeof(*fds));
+                        if (new_fds == NULL) {
+                                _log(LOG_ERROR, "Cannot allocate the connection\n");
+                                close(conn);
+                                continue;
+                        }
+                        fds = new_fds;
+
+                        keymixd_conn_t *new_conns = realloc(conns,
+                                                            (nof_fds + 1) * sizeof(*conns));
+                        if (new_conns == NULL) {
+                                _log(LOG_ERROR, "Cannot allocate the connection\n");
+                                close(conn);
+                                continue;
+                        }
+                        conns = new_conns;
+
+                        fds[nof_fds].fd     = conn;
+                        fds[nof_fds].events = POLLIN;
+                        conns[nof_fds]      = (keymixd_conn_t){.sock = conn};
+                        nof_fds++;
+                }
+        }
+
+        for (nfds_t i = 1; i < nof_fds; i++) {
+                close_conn(conns + i);
+        }
+        free(fds);
+        free(conns);
+        close(sock);
+        unlink(path);
+        return err;
+}
+
+// --------------------------------------------------------- Client
+
+int keymixd_connect(const char *path) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        int sock;
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                return -1;
+        }
+        strcpy(addr.sun_path, path);
+
+        sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (sock < 0) {
+                return -1;
+        }
+
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+                close(sock);
+                return -1;
+        }
+        return sock;
+}
+
+// Sends the request `req`, with the file descriptor `fd` if not negative, and
+// waits for the response `res`. Returns its status, or -1 on I/O errors
+static int request(int sock, keymixd_request_t *req, int fd, keymixd_response_t *res) {
+        int res_fd;
+
+        req->magic = KEYMIXD_MAGIC;
+        if (send_with_fd(sock, req, sizeof(*req), fd)) {
+                return -1;
+        }
+
+        if (recv_with_fd(sock, res, sizeof(*res), &res_fd) != sizeof(*res)) {
+                return -1;
+        }
+        if (res_fd >= 0) {
+                close(res_fd);
+        }
+        return res->status;
+}
+
+int keymixd_info(int sock, keymixd_response_t *info) {
+        keymixd_request_t req = {.op = KEYMIXD_OP_INFO};
+        return request(sock, &req, -1, info);
+}
+
+byte *keymixd_attach(int sock, size_t size) {
+        keymixd_request_t req = {.op = KEYMIXD_OP_ATTACH};
+        keymixd_response_t res;
+        byte *data = MAP_FAILED;
+        int fd;
+
+        fd = memfd_create("keymixd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+                return NULL;
+        }
+
+        if (!ftruncate(fd, size) && !fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL)) {
+                data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+
+        if (data != MAP_FAILED && request(sock, &req, fd, &res)) {
+                _log(LOG_ERROR, "The daemon refused the buffer\n");
+                munmap(data, size);
+                data = MAP_FAILED;
+        }
+
+        close(fd);
+        return (data != MAP_FAILED ? data : NULL);
+}
+
+int keymixd_encrypt(int sock, uint64_t offset, uint64_t size, byte *iv) {
+        keymixd_request_t req = {
+                .op     = KEYMIXD_OP_ENCRYPT,
+                .offset = offset,
+                .size   = size,
+        };
+        keymixd_response_t res;
+
+        if (iv != NULL) {
+                memcpy(req.iv, iv, KEYMIX_IV_SIZE);
+        }
+        return request(sock, &req, -1, &res);
+}
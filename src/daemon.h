@@ -0,0 +1,74 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+#include "ctx.h"
+#include "types.h"
+
+// Protocol of keymixd, a daemon keeping an encryption context resident and
+// serving the encryption requests of its clients over a Unix domain socket.
+// Payloads are not sent over the socket: each client attaches a shared memory
+// buffer (a memfd) to its connection once, then asks for regions of it to be
+// encrypted in place.
+#define KEYMIXD_MAGIC 0x444d584b // "KXMD"
+
+typedef enum {
+        // Get the key size and the encryption mode of the daemon.
+        KEYMIXD_OP_INFO,
+        // Attach the memfd sent along with the request to the connection,
+        // replacing the previous one.
+        KEYMIXD_OP_ATTACH,
+        // Encrypt in place `size` bytes of the attached buffer from `offset`.
+        KEYMIXD_OP_ENCRYPT,
+} keymixd_op_t;
+
+typedef enum {
+        KEYMIXD_OK,
+        KEYMIXD_ERR_REQUEST,
+        KEYMIXD_ERR_ATTACH,
+        KEYMIXD_ERR_BOUNDS,
+        KEYMIXD_ERR_ENC,
+} keymixd_status_t;
+
+typedef struct {
+        uint32_t magic;
+        uint32_t op;
+        uint64_t offset;
+        uint64_t size;
+        byte iv[KEYMIX_IV_SIZE];
+} keymixd_request_t;
+
+typedef struct {
+        uint32_t status;
+        uint32_t enc_mode;
+        uint64_t key_size;
+} keymixd_response_t;
+
+// Server
+
+// Serves the encryption requests with the context `ctx` on the socket at
+// `path`, each one running on `threads` threads, until a SIGINT or SIGTERM.
+// Connections are served concurrently, so the encryption mode of `ctx` must
+// not be one of the ofb ones, whose state changes at every encryption.
+int keymixd_serve(ctx_t *ctx, const char *path, uint8_t threads);
+
+// Client
+
+// Connects to the daemon listening at `path`. Returns the socket or -1.
+int keymixd_connect(const char *path);
+
+// Gets the key size and encryption mode of the daemon into `info`.
+int keymixd_info(int sock, keymixd_response_t *info);
+
+// Creates a shared memory buffer of `size` bytes and attaches it to the
+// connection `sock`. Returns the mapping of the buffer, to be unmapped with
+// `munmap`, or NULL.
+byte *keymixd_attach(int sock, size_t size);
+
+// Asks the daemon to encrypt in place `size` bytes of the attached buffer
+// from `offset`, with the `iv` (the counter of which is incremented at every
+// key, as in `encrypt`). Returns 0 on success.
+int keymixd_encrypt(int sock, uint64_t offset, uint64_t size, byte *iv);
+
+#endif
@@ -7,10 +7,17 @@
 
 #include "keymix.h"
 #include "log.h"
-#include "refresh.h"
 #include "types.h"
 #include "utils.h"
 
+// Size from which the stream XORs the keystream with multiple threads
+#define STREAM_THREADED_XOR_SIZE (1024 * 1024)
+
+// Maximum number of keystreams generated together by a batch, and their
+// maximum overall size
+#define BATCH_MAX_LANES 16
+#define BATCH_MAX_SIZE (256 * 1024 * 1024)
+
 // ---------------------------------------------- Keymix internals
 
 typedef struct {
@@ -54,10 +61,48 @@ void ctr64_inc(unsigned char *counter) {
         } while (n);
 }
 
-void keymix_ctr_mode(enc_args_t *args) {
-        ctx_t *ctx = args->ctx;
+// Generates into `keystream` the keystream of the ctr encryption modes with the
+// `iv`, for which `counter` is the value of its counter part (or the number
+// of keys done, without an IV)
+static int ctr_keystream(ctx_t *ctx, byte *keystream, byte *iv, uint64_t counter,
+                         uint8_t threads) {
         byte *src;
 
+        // Configure the source according to the encryption mode
+        switch (ctx->enc_mode) {
+        case ENC_MODE_CTR:
+                src = ctx->key;
+                break;
+        case ENC_MODE_CTR_OPT:
+                src = ctx->state;
+                break;
+        case ENC_MODE_CTR_CTR:
+                return keymix_refresh(ctx, keystream, ctx->key_size, iv,
+                                      (ctx->key_size / BLOCK_SIZE_AES) * counter, threads);
+        default:
+                _log(LOG_ERROR, "The ofb encryption modes have no ctr keystream\n");
+                return 1;
+        }
+
+        return keymix_ex(ctx, src, keystream, ctx->key_size, iv, threads);
+}
+
+// Advances the `state` of the ofb encryption mode and generates the first
+// `size` bytes of the keystream from it into `keystream`
+static int ofb_keystream(ctx_t *ctx, byte *state, byte *keystream, byte *iv, size_t size,
+                         uint8_t threads) {
+        int err = keymix_ex(ctx, state, state, ctx->key_size, iv, threads);
+        if (err)
+                return err;
+
+        return multi_threaded_mixpass(ctx->one_way_mixpass, ctx->one_way_block_size, state,
+                                      keystream, size, iv, threads);
+}
+
+int keymix_ctr_mode(enc_args_t *args) {
+        ctx_t *ctx = args->ctx;
+        int err    = 0;
+
         // Make a copy of the IV before changing its counter part, to avoid
         // unexpected side effects
         byte *iv      = NULL;
@@ -74,32 +119,16 @@ void keymix_ctr_mode(enc_args_t *args) {
         // Buffer to store the output of the keymix
         byte *outbuffer = malloc(ctx->key_size);
 
-        // Configure the source according to the encryption mode
-        switch (ctx->enc_mode) {
-        case ENC_MODE_CTR:
-                src = ctx->key;
-                break;
-        case ENC_MODE_CTR_OPT:
-                src = ctx->state;
-                break;
-        case ENC_MODE_CTR_CTR:
-                src = outbuffer;
-                break;
-        }
-
         byte *in              = args->in;
         byte *out             = args->out;
         size_t remaining_size = args->resource_size;
 
         for (uint32_t i = 0; i < args->keys_to_do; i++) {
-                if (ctx->enc_mode == ENC_MODE_CTR_CTR) {
-                        multi_threaded_refresh(ctx->key, outbuffer,
-                                               ctx->key_size, iv,
-                                               (ctx->key_size / BLOCK_SIZE_AES) * (starting_counter + i),
-                                               args->threads);
-                }
-                keymix_ex(ctx, src, outbuffer, ctx->key_size, iv,
-                          args->threads);
+                // Stop on failure (e.g., the deferred loading of the key),
+                // since the keystream is not valid
+                err = ctr_keystream(ctx, outbuffer, iv, starting_counter + i, args->threads);
+                if (err)
+                        break;
                 multi_threaded_memxor(out, outbuffer, in,
                                       MIN(remaining_size, ctx->key_size),
                                       args->threads);
@@ -116,38 +145,101 @@ void keymix_ctr_mode(enc_args_t *args) {
                 free(iv);
         }
         free(outbuffer);
+        return err;
+}
+
+// The one-way pass and XOR of a key of the ofb encryption mode, fused so
+// that the keystream is XOR'ed straight into the output
+typedef struct {
+        ctx_t *ctx;
+        byte *state;
+        byte *in;
+        byte *out;
+        size_t size;
+        byte *iv;
+        uint8_t threads;
+        int err;
+} thr_ofb_tail_t;
+
+void *w_thread_ofb_tail(void *a) {
+        thr_ofb_tail_t *thr = (thr_ofb_tail_t *)a;
+
+        thr->err = multi_threaded_mixpass_xor(thr->ctx->one_way_mix, thr->state, thr->in,
+                                              thr->out, thr->size, thr->iv, thr->threads);
+        return NULL;
 }
 
 // To enable the use of the ofb encryption mode with streams, this function
 // works as an iterator keeping track of the next key to use in its internal
 // state. Unfortunately, this means we cannot reuse the same context as is for
 // multiple encryptions/decryptions. However, it is always possible to reset
-// the context to its initial form by resetting the state to the initial key
-void keymix_ofb_mode(enc_args_t *args) {
-        ctx_t *ctx     = args->ctx;
+// the context to its initial form by resetting the state to the initial key.
+// The next state of the chain only depends on the previous one, so the state
+// is double-buffered and the one-way pass and XOR of each key run along with
+// the keymix of the next one, leaving the chain as the only critical path
+int keymix_ofb_mode(enc_args_t *args) {
+        ctx_t *ctx = args->ctx;
+        int err    = 0;
+
+        // The one-way pass and XOR take about one of the levels + 1 passes
+        // over each key. With 1 thread, they just run after each keymix.
+        bool overlap           = (args->threads >= 2);
+        uint8_t tail_threads   = MAX(1, args->threads / (ctx->levels + 1));
+        uint8_t keymix_threads = MAX(1, args->threads - (overlap ? tail_threads : 0));
+
+        // Buffer to store the next state
+        byte *next_state = malloc(ctx->key_size);
+        byte *state      = ctx->state;
+        if (next_state == NULL) {
+                _log(LOG_ERROR, "Cannot allocate the ofb buffers\n");
+                return 1;
+        }
 
-        // Buffer to store the output of the keymix
-        byte *outbuffer = malloc(ctx->key_size);
+        pthread_t tail_thread;
+        thr_ofb_tail_t tail;
+        bool tail_running = false;
 
         byte *in              = args->in;
         byte *out             = args->out;
         size_t remaining_size = args->resource_size;
-        uint64_t nof_macros;
-        size_t remaining_one_way_size;
 
         for (uint64_t i = 0; i < args->keys_to_do; i++) {
-                keymix_ex(ctx, ctx->state, ctx->state, ctx->key_size, args->iv,
-                          args->threads);
-                nof_macros = CEILDIV(remaining_size, ctx->one_way_block_size);
-                remaining_one_way_size = ctx->one_way_block_size * nof_macros;
-                multi_threaded_mixpass(ctx->one_way_mixpass,
-                                       ctx->one_way_block_size,
-                                       ctx->state, outbuffer,
-                                       MIN(remaining_one_way_size, ctx->key_size),
-                                       args->iv, args->threads);
-                multi_threaded_memxor(out, outbuffer, in,
-                                      MIN(remaining_size, ctx->key_size),
-                                      args->threads);
+                // The tail of the previous key reads `state` as well
+                err = keymix_ex(ctx, state, next_state, ctx->key_size, args->iv, keymix_threads);
+                if (tail_running) {
+                        pthread_join(tail_thread, NULL);
+                        tail_running = false;
+                        err |= tail.err;
+                }
+                if (err)
+                        break;
+
+                // The previous state is not read anymore
+                byte *tmp  = state;
+                state      = next_state;
+                next_state = tmp;
+
+                tail = (thr_ofb_tail_t){
+                        .ctx     = ctx,
+                        .state   = state,
+                        .in      = in,
+                        .out     = out,
+                        .size    = MIN(remaining_size, ctx->key_size),
+                        .iv      = args->iv,
+                        .threads = tail_threads,
+                };
+
+                // The last key has nothing to overlap with
+                if (!overlap || i == args->keys_to_do - 1 ||
+                    pthread_create(&tail_thread, NULL, w_thread_ofb_tail, &tail)) {
+                        w_thread_ofb_tail(&tail);
+                        if (tail.err) {
+                                err = tail.err;
+                                break;
+                        }
+                } else {
+                        tail_running = true;
+                }
 
                 in += ctx->key_size;
                 out += ctx->key_size;
@@ -155,7 +247,104 @@ void keymix_ofb_mode(enc_args_t *args) {
                         remaining_size -= ctx->key_size;
         }
 
-        free(outbuffer);
+        if (tail_running) {
+                pthread_join(tail_thread, NULL);
+                err |= tail.err;
+        }
+
+        // The context keeps the buffer holding the last state of the chain
+        if (state != ctx->state) {
+                next_state = ctx->state;
+                ctx->state = state;
+        }
+
+        explicit_bzero(next_state, ctx->key_size);
+        free(next_state);
+        return err;
+}
+
+// Derives into `chain_iv` the IV of the `chain` of the ofb-multi encryption
+// mode, that is the `iv` (or the default one) with its counter part advanced
+// by the index of the chain, so that every chain mixes with its own IV
+static void ofb_chain_iv(byte *iv, uint8_t chain, byte *chain_iv) {
+        memcpy(chain_iv, iv ? iv : (byte *)MIXPASS_DEFAULT_IV, KEYMIX_IV_SIZE);
+        for (uint8_t c = 0; c < chain; c++) {
+                ctr64_inc(chain_iv + KEYMIX_NONCE_SIZE);
+        }
+}
+
+// A key of a chain of the ofb-multi encryption mode
+typedef struct {
+        ctx_t *ctx;
+        byte *state;
+        byte iv[KEYMIX_IV_SIZE];
+        byte *in;
+        byte *out;
+        size_t size;
+        uint8_t threads;
+        int err;
+} thr_ofb_chain_t;
+
+void *w_thread_ofb_chain(void *a) {
+        thr_ofb_chain_t *thr = (thr_ofb_chain_t *)a;
+        ctx_t *ctx           = thr->ctx;
+
+        thr->err = keymix_ex(ctx, thr->state, thr->state, ctx->key_size, thr->iv, thr->threads);
+        if (!thr->err)
+                thr->err = multi_threaded_mixpass_xor(ctx->one_way_mix, thr->state, thr->in,
+                                                      thr->out, thr->size, thr->iv, thr->threads);
+        return NULL;
+}
+
+// The keys of the ofb-multi encryption mode go to its chains in turn, starting
+// from the 1st one at every encryption. The chains are independent, so each
+// round of keys runs them in parallel, each one on its share of the threads
+int keymix_ofb_multi_mode(enc_args_t *args) {
+        ctx_t *ctx     = args->ctx;
+        uint8_t chains = ctx->chains;
+        int err        = 0;
+
+        pthread_t threads[chains];
+        bool spawned[chains];
+        thr_ofb_chain_t chain_args[chains];
+
+        for (uint8_t c = 0; c < chains; c++) {
+                chain_args[c].ctx     = ctx;
+                chain_args[c].state   = ctx->state + ctx->key_size * c;
+                chain_args[c].threads = MAX(1, args->threads / chains);
+                ofb_chain_iv(args->iv, c, chain_args[c].iv);
+        }
+
+        for (uint64_t i = 0; i < args->keys_to_do && !err; i += chains) {
+                uint8_t nof_chains = MIN(chains, args->keys_to_do - i);
+
+                for (uint8_t c = 0; c < nof_chains; c++) {
+                        thr_ofb_chain_t *a = chain_args + c;
+                        size_t offset      = ctx->key_size * (i + c);
+
+                        a->in   = args->in + offset;
+                        a->out  = args->out + offset;
+                        a->size = MIN(ctx->key_size, args->resource_size - offset);
+                        a->err  = 0;
+
+                        // With 1 thread, just run the chains in turn
+                        spawned[c] = (args->threads > 1 && nof_chains > 1 &&
+                                      !pthread_create(&threads[c], NULL, w_thread_ofb_chain, a));
+                        if (!spawned[c])
+                                w_thread_ofb_chain(a);
+                }
+
+                for (uint8_t c = 0; c < nof_chains; c++) {
+                        if (spawned[c])
+                                pthread_join(threads[c], NULL);
+                        err |= chain_args[c].err;
+                }
+        }
+
+        for (uint8_t c = 0; c < chains; c++) {
+                explicit_bzero(chain_args[c].iv, KEYMIX_IV_SIZE);
+        }
+        return err;
 }
 
 int keymix_encrypt(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
@@ -177,13 +366,14 @@ int keymix_encrypt(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
                 .threads          = threads,
         };
 
-        if (ctx->enc_mode != ENC_MODE_OFB) {
-                keymix_ctr_mode(&arg);
-        } else {
-                keymix_ofb_mode(&arg);
+        switch (ctx->enc_mode) {
+        case ENC_MODE_OFB:
+                return keymix_ofb_mode(&arg);
+        case ENC_MODE_OFB_MULTI:
+                return keymix_ofb_multi_mode(&arg);
+        default:
+                return keymix_ctr_mode(&arg);
         }
-
-        return 0;
 }
 
 // ---------------------------------------------- Principal interface
@@ -197,3 +387,192 @@ int encrypt_t(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
         assert(ctx->encrypt && "You must use an encryption context with encrypt");
         return keymix_encrypt(ctx, in, out, size, iv, threads);
 }
+
+int encrypt_batch(ctx_t *ctx, byte **in, byte **out, size_t *sizes, byte **ivs,
+                  uint32_t nof_msgs, uint8_t threads) {
+        assert(ctx->encrypt && "You must use an encryption context with encrypt_batch");
+        size_t key_size = ctx->key_size;
+        int err         = 0;
+
+        // Only the ctr-opt encryption mode shares a state among the IVs
+        if (ctx->enc_mode != ENC_MODE_CTR_OPT) {
+                for (uint32_t m = 0; m < nof_msgs && !err; m++) {
+                        err = encrypt_t(ctx, in[m], out[m], sizes[m], ivs[m], threads);
+                }
+                return err;
+        }
+
+        uint64_t tot_lanes = 0;
+        for (uint32_t m = 0; m < nof_msgs; m++) {
+                tot_lanes += CEILDIV(sizes[m], key_size);
+        }
+        uint32_t max_lanes = MIN(BATCH_MAX_LANES, BATCH_MAX_SIZE / key_size);
+        max_lanes          = MAX(1, MIN(max_lanes, tot_lanes));
+        byte lane_ivs[max_lanes][KEYMIX_IV_SIZE];
+        uint32_t lane_msgs[max_lanes];
+        size_t lane_offsets[max_lanes];
+        byte iv[KEYMIX_IV_SIZE];
+
+        byte *keystreams = malloc(key_size * max_lanes);
+        if (keystreams == NULL) {
+                _log(LOG_ERROR, "Cannot allocate the keystreams\n");
+                return 1;
+        }
+
+        // Each lane is a key of a message, whose counter is incremented at
+        // every key as in `encrypt` (a missing IV is the same as a zero one
+        // that is never incremented)
+        uint32_t msg  = 0;
+        size_t offset = 0;
+        while (msg < nof_msgs && !err) {
+                uint32_t nof_lanes = 0;
+                while (msg < nof_msgs && nof_lanes < max_lanes) {
+                        if (offset >= sizes[msg]) {
+                                msg++;
+                                offset = 0;
+                                continue;
+                        }
+                        if (offset == 0) {
+                                if (ivs[msg])
+                                        memcpy(iv, ivs[msg], KEYMIX_IV_SIZE);
+                                else
+                                        memset(iv, 0, KEYMIX_IV_SIZE);
+                        }
+
+                        memcpy(lane_ivs[nof_lanes], iv, KEYMIX_IV_SIZE);
+                        lane_msgs[nof_lanes]    = msg;
+                        lane_offsets[nof_lanes] = offset;
+                        nof_lanes++;
+
+                        if (ivs[msg])
+                                ctr64_inc(iv + KEYMIX_NONCE_SIZE);
+                        offset += key_size;
+                }
+                if (!nof_lanes)
+                        break;
+
+                err = keymix_opt_batch(ctx, keystreams, lane_ivs, nof_lanes, threads);
+                for (uint32_t l = 0; l < nof_lanes && !err; l++) {
+                        uint32_t m = lane_msgs[l];
+                        size_t o   = lane_offsets[l];
+                        memxor(out[m] + o, keystreams + key_size * l, in[m] + o,
+                               MIN(key_size, sizes[m] - o));
+                }
+        }
+
+        explicit_bzero(keystreams, key_size * max_lanes);
+        explicit_bzero(lane_ivs, sizeof(lane_ivs));
+        explicit_bzero(iv, KEYMIX_IV_SIZE);
+        free(keystreams);
+        return err;
+}
+
+// ---------------------------------------------- Streaming interface
+
+// Generates the next keystream of `stream`
+static int next_keystream(keymix_stream_t *stream) {
+        ctx_t *ctx = stream->ctx;
+        byte *iv   = (stream->has_iv ? stream->iv : NULL);
+        int err;
+
+        if (ctx->enc_mode == ENC_MODE_OFB) {
+                err = ofb_keystream(ctx, stream->state, stream->keystream, iv, ctx->key_size,
+                                    stream->threads);
+        } else if (ctx->enc_mode == ENC_MODE_OFB_MULTI) {
+                // Same turns of the chains as `encrypt_t`
+                uint8_t chain = stream->counter % ctx->chains;
+                byte chain_iv[KEYMIX_IV_SIZE];
+
+                ofb_chain_iv(iv, chain, chain_iv);
+                err = ofb_keystream(ctx, stream->state + ctx->key_size * chain,
+                                    stream->keystream, chain_iv, ctx->key_size, stream->threads);
+                explicit_bzero(chain_iv, KEYMIX_IV_SIZE);
+                stream->counter++;
+        } else {
+                err = ctr_keystream(ctx, stream->keystream, iv, stream->counter, stream->threads);
+                ctr64_inc(iv ? iv + KEYMIX_NONCE_SIZE : NULL);
+                stream->counter++;
+        }
+
+        if (!err)
+                stream->offset = 0;
+        return err;
+}
+
+int keymix_stream_init(keymix_stream_t *stream, ctx_t *ctx, byte *iv, uint8_t threads) {
+        assert(ctx->encrypt && "You must use an encryption context with a stream");
+
+        // The ofb chains of the stream start from the key, leaving the state
+        // of the context untouched
+        bool ofb          = (ctx->enc_mode == ENC_MODE_OFB || ctx->enc_mode == ENC_MODE_OFB_MULTI);
+        stream->keystream = malloc(ctx->key_size);
+        stream->state     = NULL;
+        if (ofb) {
+                stream->state = malloc(ctx->key_size * ctx->chains);
+                for (uint8_t c = 0; stream->state != NULL && c < ctx->chains; c++)
+                        memcpy(stream->state + ctx->key_size * c, ctx->key, ctx->key_size);
+        }
+        if (stream->keystream == NULL || (ofb && !stream->state)) {
+                _log(LOG_ERROR, "Cannot allocate the keystream\n");
+                free(stream->keystream);
+                free(stream->state);
+                return 1;
+        }
+
+        stream->ctx     = ctx;
+        stream->threads = threads;
+        stream->has_iv  = (iv != NULL);
+        stream->counter = 0;
+        if (iv) {
+                memcpy(stream->iv, iv, KEYMIX_IV_SIZE);
+        }
+        if (iv && !ofb) {
+                stream->counter = ctr64_get(stream->iv + KEYMIX_NONCE_SIZE);
+        }
+
+        // The first keystream is generated with the first data
+        stream->offset = ctx->key_size;
+        return 0;
+}
+
+int keymix_stream_update(keymix_stream_t *stream, byte *in, byte *out, size_t size) {
+        size_t key_size = stream->ctx->key_size;
+        size_t chunk_size;
+        byte *keystream;
+
+        while (size) {
+                if (stream->offset == key_size && next_keystream(stream)) {
+                        return 1;
+                }
+
+                chunk_size = MIN(size, key_size - stream->offset);
+                keystream  = stream->keystream + stream->offset;
+                if (stream->threads > 1 && chunk_size >= STREAM_THREADED_XOR_SIZE) {
+                        multi_threaded_memxor(out, keystream, in, chunk_size, stream->threads);
+                } else {
+                        memxor(out, keystream, in, chunk_size);
+                }
+
+                in += chunk_size;
+                out += chunk_size;
+                size -= chunk_size;
+                stream->offset += chunk_size;
+        }
+
+        return 0;
+}
+
+void keymix_stream_final(keymix_stream_t *stream) {
+        if (stream->keystream != NULL) {
+                explicit_bzero(stream->keystream, stream->ctx->key_size);
+                free(stream->keystream);
+        }
+        if (stream->state != NULL) {
+                explicit_bzero(stream->state, stream->ctx->key_size * stream->ctx->chains);
+                free(stream->state);
+        }
+        explicit_bzero(stream->iv, KEYMIX_IV_SIZE);
+        stream->keystream = NULL;
+        stream->state     = NULL;
+        stream->offset    = 0;
+}
@@ -1,13 +1,35 @@
 #include "file.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "keymix.h"
 #include "enc.h"
-#include "refresh.h"
+#include "log.h"
 #include "utils.h"
 
+// Available since Linux 5.14, older kernels reject it with EINVAL
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+typedef struct {
+        byte *data;
+        size_t size;
+        size_t page_size;
+} thr_prefault_t;
+
+typedef struct {
+        int fd;
+        byte *data;
+        size_t size;
+        size_t offset;
+        int err;
+} thr_read_t;
+
 size_t get_file_size(FILE *fp) {
         if (fp == NULL)
                 return 0;
@@ -27,25 +49,149 @@ size_t get_file_size(FILE *fp) {
         return (size_t)res;
 }
 
+// Fault in the pages of the thread extent by reading a byte from each of them
+void *w_thread_prefault(void *a) {
+        thr_prefault_t *thr = (thr_prefault_t *)a;
+        for (size_t offset = 0; offset < thr->size; offset += thr->page_size) {
+                (void)*(volatile byte *)(thr->data + offset);
+        }
+        return NULL;
+}
+
+byte *map_file(FILE *fp, size_t size, uint8_t threads, bool huge_pages) {
+        byte *data;
+
+        if (fp == NULL || !size) {
+                return NULL;
+        }
+
+        // No MAP_POPULATE, the pages must be faulted in after the huge pages
+        // hint for it to take effect
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+        if (data == MAP_FAILED) {
+                _log(LOG_DEBUG, "Cannot map the file, falling back to reading it\n");
+                return NULL;
+        }
+
+        // Huge pages are a best-effort hint, the mapping works regardless
+        if (huge_pages && madvise(data, size, MADV_HUGEPAGE)) {
+                _log(LOG_DEBUG, "Huge pages are not available for the file\n");
+        }
+
+        // A single thread is better off with the kernel populating the
+        // mapping on its own, when it can
+        if (threads <= 1) {
+                if (!madvise(data, size, MADV_POPULATE_READ)) {
+                        return data;
+                }
+                threads = 1;
+        }
+
+        // Otherwise, fault in an extent of the pages per thread
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        uint64_t pages   = CEILDIV(size, page_size);
+        pthread_t thread_ids[threads];
+        thr_prefault_t args[threads];
+
+        madvise(data, size, MADV_WILLNEED);
+        for (uint8_t t = 0; t < threads; t++) {
+                uint64_t offset = page_size * get_curr_thread_offset(pages, t, threads);
+
+                args[t].data      = data + offset;
+                args[t].size      = MIN(page_size * get_curr_thread_size(pages, t, threads),
+                                        size - MIN(offset, size));
+                args[t].page_size = page_size;
+                pthread_create(&thread_ids[t], NULL, w_thread_prefault, &args[t]);
+        }
+        for (uint8_t t = 0; t < threads; t++) {
+                pthread_join(thread_ids[t], NULL);
+        }
+
+        return data;
+}
+
+void unmap_file(byte *data, size_t size) {
+        if (data != NULL) {
+                munmap(data, size);
+        }
+}
+
+int read_file_extent(int fd, byte *data, size_t size, size_t offset) {
+        while (size) {
+                ssize_t res = pread(fd, data, size, offset);
+                if (res < 0 && errno == EINTR)
+                        continue;
+                if (res <= 0) {
+                        _log(LOG_ERROR, "Cannot read the file at offset %zu\n", offset);
+                        return 1;
+                }
+                data += res;
+                size -= res;
+                offset += res;
+        }
+        return 0;
+}
+
+void *w_thread_read(void *a) {
+        thr_read_t *thr = (thr_read_t *)a;
+        thr->err        = read_file_extent(thr->fd, thr->data, thr->size, thr->offset);
+        return NULL;
+}
+
+int read_file(int fd, byte *data, size_t size, uint8_t threads) {
+        if (threads <= 1) {
+                return read_file_extent(fd, data, size, 0);
+        }
+
+        // Split the file on page boundaries, so that the threads do not
+        // share pages of the page cache
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        uint64_t pages   = CEILDIV(size, page_size);
+        pthread_t thread_ids[threads];
+        thr_read_t args[threads];
+        int err = 0;
+
+        for (uint8_t t = 0; t < threads; t++) {
+                uint64_t offset = MIN(page_size * get_curr_thread_offset(pages, t, threads), size);
+
+                args[t].fd     = fd;
+                args[t].data   = data + offset;
+                args[t].size   = MIN(page_size * get_curr_thread_size(pages, t, threads),
+                                     size - offset);
+                args[t].offset = offset;
+                pthread_create(&thread_ids[t], NULL, w_thread_read, &args[t]);
+        }
+        for (uint8_t t = 0; t < threads; t++) {
+                pthread_join(thread_ids[t], NULL);
+                err |= args[t].err;
+        }
+
+        return err;
+}
+
 int stream_encrypt(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
                    uint8_t threads) {
         // Then, we encrypt the input resource in a "streamed" manner:
         // that is, we read a buffer of `ctx->key_size` size, use encrypt_t on
-        // that, and lastly write the result to the output.
-        size_t buffer_size = ctx->key_size;
+        // that, and lastly write the result to the output. With the
+        // ofb-multi encryption mode, the buffer holds a key of every chain,
+        // since each encryption starts from the 1st one
+        bool ofb           = (ctx->enc_mode == ENC_MODE_OFB || ctx->enc_mode == ENC_MODE_OFB_MULTI);
+        size_t buffer_size = ctx->key_size * ctx->chains;
         byte *buffer       = malloc(buffer_size);
 
         // Make a copy of the IV before changing its counter part, to avoid
         // unexpected side effects
         byte *tmpiv   = iv;
         byte *counter = NULL;
-        if (ctx->enc_mode != ENC_MODE_OFB && iv) {
+        if (!ofb && iv) {
                 tmpiv = malloc(KEYMIX_IV_SIZE);
                 memcpy(tmpiv, iv, KEYMIX_IV_SIZE);
                 counter = tmpiv + KEYMIX_NONCE_SIZE;
         }
 
         size_t read = 0;
+        int err     = 0;
         do {
                 // Read a certain number of bytes
                 read = fread(buffer, 1, buffer_size, fin);
@@ -55,18 +201,20 @@ int stream_encrypt(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
                 if (read == 0)
                         break;
 
-                encrypt_t(ctx, buffer, buffer, read, tmpiv, threads);
+                err = encrypt_t(ctx, buffer, buffer, read, tmpiv, threads);
+                if (err)
+                        break;
 
                 fwrite(buffer, read, 1, fout);
                 ctr64_inc(counter);
         } while (read == buffer_size);
 
         free(buffer);
-        if (ctx->enc_mode != ENC_MODE_OFB && iv) {
+        if (!ofb && iv) {
                 explicit_bzero(tmpiv, KEYMIX_IV_SIZE);
                 free(tmpiv);
         }
-        return 0;
+        return err;
 }
 
 // Equal to stream_encrypt, but allocates less RAM.
@@ -77,6 +225,13 @@ int stream_encrypt(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
 // don't check if the file has ended before.
 int stream_encrypt2(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
                     uint8_t threads) {
+        // The ofb-multi encryption mode needs the interleaved chains of
+        // `stream_encrypt`
+        if (ctx->enc_mode == ENC_MODE_OFB_MULTI) {
+                _log(LOG_ERROR, "Streams of the ofb-multi encryption mode need stream_encrypt\n");
+                return 1;
+        }
+
         size_t buffer_size = ctx->key_size;
 
         byte *src;
@@ -93,8 +248,12 @@ int stream_encrypt2(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
                 src = ctx->state;
                 break;
         case ENC_MODE_CTR_CTR:
-                src = buffer;
+                src = ctx->key;
                 break;
+        default:
+                // The ofb-multi encryption mode, rejected above
+                free(buffer);
+                return 1;
         }
 
         // We use key_size because it is surely a divisor of buffer_size.
@@ -125,12 +284,11 @@ int stream_encrypt2(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
                         break;
 
                 if (ctx->enc_mode == ENC_MODE_CTR_CTR) {
-                        multi_threaded_refresh(ctx->key, buffer,
-                                               ctx->key_size, tmpiv,
-                                               (ctx->key_size / BLOCK_SIZE_AES) * ctr64,
-                                               threads);
+                        keymix_refresh(ctx, dst, buffer_size, tmpiv,
+                                       (ctx->key_size / BLOCK_SIZE_AES) * ctr64, threads);
+                } else {
+                        keymix_ex(ctx, src, dst, buffer_size, tmpiv, threads);
                 }
-                keymix_ex(ctx, src, dst, buffer_size, tmpiv, threads);
                 if (ctx->enc_mode == ENC_MODE_OFB) {
                         multi_threaded_mixpass(ctx->one_way_mixpass,
                                                ctx->one_way_block_size,
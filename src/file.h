@@ -1,6 +1,7 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "enc.h"
@@ -9,6 +10,25 @@
 // Obtains the size of the stream `fp`.
 size_t get_file_size(FILE *fp);
 
+// Maps read-only the first `size` bytes of the file `fp`, so that processes
+// mapping the same file share a single page-cache copy. The pages are backed
+// by huge pages when `huge_pages` is set and the kernel supports it for the
+// file, then prefaulted upfront, by the kernel with 1 thread (Linux 5.14 or
+// later) or by `threads` threads otherwise. Returns NULL when the file cannot
+// be mapped (e.g., a pipe).
+byte *map_file(FILE *fp, size_t size, uint8_t threads, bool huge_pages);
+
+// Unmaps a file mapped with `map_file`.
+void unmap_file(byte *data, size_t size);
+
+// Reads `size` bytes of the file `fd` starting at `offset` into `data`,
+// without moving the file offset. Returns 0 on success.
+int read_file_extent(int fd, byte *data, size_t size, size_t offset);
+
+// Reads the first `size` bytes of the file `fd` into `data`, with `threads`
+// threads reading their own extent in parallel. Returns 0 on success.
+int read_file(int fd, byte *data, size_t size, uint8_t threads);
+
 // Encrypts a stream `fin` with the context `ctx` writing the result on `fout`,
 // Using `threads` threads.
 int stream_encrypt(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
@@ -16,7 +36,8 @@ int stream_encrypt(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
 
 // Encrypts a stream `fin` with the context `ctx` writing the result on `fout`,
 // Using `threads` threads.
-// This is an alternative version to `stream_encrypt2`.
+// This is an alternative version to `stream_encrypt`.
+// It does not support the ofb-multi encryption mode, for which it returns 1.
 int stream_encrypt2(ctx_t *ctx, FILE *fin, FILE *fout, byte *iv,
                     uint8_t threads);
 
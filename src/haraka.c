@@ -0,0 +1,185 @@
+#include "haraka.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <wmmintrin.h>
+
+#include "isa.h"
+#include "types.h"
+
+// Haraka v2 (https://eprint.iacr.org/2016/098.pdf) is a family of short-input
+// permutations made of 5 rounds, each one applying 2 AES rounds to every
+// 128-bit word of the state and then mixing the words by interleaving their
+// 32-bit columns. The output is the permutation of the input XOR'ed with the
+// input itself (feed-forward).
+// The 256-bit version is used as is, while the output of the 512-bit version
+// is not truncated, so that it preserves the size of the block (its words at
+// bytes 8, 24, 32 and 48 are the Haraka-512 output).
+
+#define HARAKA_ROUNDS 5
+
+// Round constants of Haraka v2 (least significant half 1st), as in the
+// reference implementation
+static const __m128i HARAKA_RC[8 * HARAKA_ROUNDS] = {
+    {0xB2C5FEF075817B9D, 0x0684704CE620C00A},
+    {0x640F6BA42F08F717, 0x8B66B4E188F3A06B},
+    {0xCF029D609F029114, 0x3402DE2D53F28498},
+    {0xBBF3BCAFFD5B4F79, 0x0ED6EAE62E7B4F08},
+    {0x79EECD1CBE397044, 0xCBCFB0CB4872448B},
+    {0x8D5335ED2B8A057B, 0x7EEACDEE6E9032B7},
+    {0xE2412761DA4FEF1B, 0x67C28F435E2E7CD0},
+    {0x675FFDE21FC70B3B, 0x2924D9B0AFCACC07},
+    {0xECDB8FCAB9D465EE, 0xAB4D63F1E6867FE9},
+    {0x5B2A404FAD037E33, 0x1C30BF84D4B7CD64},
+    {0x69028B2E8DF69800, 0xB2CC0BB9941723BF},
+    {0x4AAA9EC85C9D2D8A, 0xFA0478A6DE6F5572},
+    {0x0EFA4F2E29129FD4, 0xDFB49F2B6B772A12},
+    {0x32D611AEBB6A12EE, 0x1EA10344F449A236},
+    {0x5F9600C99CA8ECA6, 0xAF0449884B050084},
+    {0x78A2C7E327E593EC, 0x21025ED89D199C4F},
+    {0xB9282ECD82D40173, 0xBF3AAAF8A759C9B7},
+    {0x37F2EFD910307D6B, 0x6260700D6186B017},
+    {0x81C29153F6FC9AC6, 0x5ACA45C221300443},
+    {0x2CAF92E836D1943A, 0x9223973C226B68BB},
+    {0x6CBAB958E51071B4, 0xD3BF9238225886EB},
+    {0x933DFDDD24E1128D, 0xDB863CE5AEF0C677},
+    {0x83E48DE3CB2212B1, 0xBB606268FFEBA09C},
+    {0x2DB91A4EC72BF77D, 0x734BD3DCE2E4D19C},
+    {0x4B1415C42CB3924E, 0x43BB47C361301B43},
+    {0x03B231DD16EB6899, 0xDBA775A8E707EFF6},
+    {0x8E5E23027ECA472C, 0x6DF3614B3C755977},
+    {0x6D1BE5B9B88617F9, 0xCDA75A17D6DE7D77},
+    {0x9D6C069DA946EE5D, 0xEC6B43F06BA8E9AA},
+    {0xA25311593BF327C1, 0xCB1E6950F957332B},
+    {0xE4ED0353600ED0D9, 0x2CEE0C7500DA619C},
+    {0x80BBBABC63A4A350, 0xF0B1A5A196E90CAB},
+    {0xAB0DDE30938DCA39, 0xAE3DB1025E962988},
+    {0x8814F3A82E75B442, 0x17BB8F38D554A40B},
+    {0xAEB6B779360A16F6, 0x34BB8A5B5F427FD7},
+    {0x43CE5918FFBAAFDE, 0x26F65241CBE55438},
+    {0xA2CA9CF7839EC978, 0x4CE99A54B9F3026A},
+    {0x40C06E2822901235, 0xAE51A51A1BDFF7BE},
+    {0xC173BC0F48A659CF, 0xA0C1613CBA7ED22B},
+    {0x4AD6BDFDE9C59DA1, 0x756ACC0302288288},
+};
+
+ISA_AESNI static inline __attribute__((always_inline)) void
+haraka256_lanes(byte *in, byte *out) {
+        __m128i s[HARAKA_LANES][2];
+        __m128i tmp;
+
+        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                s[l][0] = _mm_loadu_si128((__m128i *)(in + l * HARAKA_256_BLOCK_SIZE));
+                s[l][1] = _mm_loadu_si128((__m128i *)(in + l * HARAKA_256_BLOCK_SIZE + 16));
+        }
+
+        for (uint8_t r = 0; r < HARAKA_ROUNDS; r++) {
+                for (uint8_t a = 0; a < 2; a++) {
+                        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                                s[l][0] = _mm_aesenc_si128(s[l][0], HARAKA_RC[4 * r + 2 * a]);
+                                s[l][1] = _mm_aesenc_si128(s[l][1], HARAKA_RC[4 * r + 2 * a + 1]);
+                        }
+                }
+
+                // Mix
+                for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                        tmp     = _mm_unpacklo_epi32(s[l][0], s[l][1]);
+                        s[l][1] = _mm_unpackhi_epi32(s[l][0], s[l][1]);
+                        s[l][0] = tmp;
+                }
+        }
+
+        // Feed-forward
+        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                for (uint8_t w = 0; w < 2; w++) {
+                        byte *word = in + l * HARAKA_256_BLOCK_SIZE + 16 * w;
+                        s[l][w]    = _mm_xor_si128(s[l][w], _mm_loadu_si128((__m128i *)word));
+                }
+        }
+        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                _mm_storeu_si128((__m128i *)(out + l * HARAKA_256_BLOCK_SIZE), s[l][0]);
+                _mm_storeu_si128((__m128i *)(out + l * HARAKA_256_BLOCK_SIZE + 16), s[l][1]);
+        }
+}
+
+ISA_AESNI static inline __attribute__((always_inline)) void
+haraka512_lanes(byte *in, byte *out) {
+        __m128i s[HARAKA_LANES][4];
+        __m128i tmp;
+
+        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                for (uint8_t w = 0; w < 4; w++) {
+                        byte *word = in + l * HARAKA_512_BLOCK_SIZE + 16 * w;
+                        s[l][w]    = _mm_loadu_si128((__m128i *)word);
+                }
+        }
+
+        for (uint8_t r = 0; r < HARAKA_ROUNDS; r++) {
+                for (uint8_t a = 0; a < 2; a++) {
+                        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                                for (uint8_t w = 0; w < 4; w++) {
+                                        s[l][w] = _mm_aesenc_si128(s[l][w], HARAKA_RC[8 * r + 4 * a + w]);
+                                }
+                        }
+                }
+
+                // Mix
+                for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                        tmp     = _mm_unpacklo_epi32(s[l][0], s[l][1]);
+                        s[l][0] = _mm_unpackhi_epi32(s[l][0], s[l][1]);
+                        s[l][1] = _mm_unpacklo_epi32(s[l][2], s[l][3]);
+                        s[l][2] = _mm_unpackhi_epi32(s[l][2], s[l][3]);
+                        s[l][3] = _mm_unpacklo_epi32(s[l][0], s[l][2]);
+                        s[l][0] = _mm_unpackhi_epi32(s[l][0], s[l][2]);
+                        s[l][2] = _mm_unpackhi_epi32(s[l][1], tmp);
+                        s[l][1] = _mm_unpacklo_epi32(s[l][1], tmp);
+                }
+        }
+
+        // Feed-forward
+        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                for (uint8_t w = 0; w < 4; w++) {
+                        byte *word = in + l * HARAKA_512_BLOCK_SIZE + 16 * w;
+                        s[l][w]    = _mm_xor_si128(s[l][w], _mm_loadu_si128((__m128i *)word));
+                }
+        }
+        for (uint8_t l = 0; l < HARAKA_LANES; l++) {
+                for (uint8_t w = 0; w < 4; w++) {
+                        _mm_storeu_si128((__m128i *)(out + l * HARAKA_512_BLOCK_SIZE + 16 * w),
+                                         s[l][w]);
+                }
+        }
+}
+
+#define HARAKA_MANY(permute_lanes, block_size)                                                     \
+        do {                                                                                       \
+                size_t batch_size = HARAKA_LANES * (block_size);                                   \
+                byte tail[HARAKA_LANES * (block_size)];                                            \
+                                                                                                   \
+                byte *last = in + size - size % batch_size;                                        \
+                for (; in < last; in += batch_size, out += batch_size) {                           \
+                        permute_lanes(in, out);                                                    \
+                }                                                                                  \
+                                                                                                   \
+                /* Process the remaining blocks in a zero-padded batch */                          \
+                size %= batch_size;                                                                \
+                if (size) {                                                                        \
+                        memcpy(tail, in, size);                                                    \
+                        memset(tail + size, 0, batch_size - size);                                 \
+                        permute_lanes(tail, tail);                                                 \
+                        memcpy(out, tail, size);                                                   \
+                }                                                                                  \
+        } while (0)
+
+ISA_AESNI static inline __attribute__((always_inline)) void
+haraka256_many_impl(byte *in, byte *out, size_t size) {
+        HARAKA_MANY(haraka256_lanes, HARAKA_256_BLOCK_SIZE);
+}
+
+ISA_AESNI static inline __attribute__((always_inline)) void
+haraka512_many_impl(byte *in, byte *out, size_t size) {
+        HARAKA_MANY(haraka512_lanes, HARAKA_512_BLOCK_SIZE);
+}
+
+ISA_AESNI_DISPATCH(haraka256_many, (byte *in, byte *out, size_t size), (in, out, size));
+ISA_AESNI_DISPATCH(haraka512_many, (byte *in, byte *out, size_t size), (in, out, size));
@@ -0,0 +1,25 @@
+#ifndef HARAKA_H
+#define HARAKA_H
+
+#include <stdlib.h>
+
+#include "types.h"
+
+// Number of independent blocks permuted together to hide the AES latency
+#define HARAKA_LANES 4
+
+// Size of the blocks (and outputs) supported by the kernels
+#define HARAKA_256_BLOCK_SIZE 32
+#define HARAKA_512_BLOCK_SIZE 64
+
+// Computes the Haraka-256 output of every 32-byte block of `in` into the
+// corresponding block of `out`. Here `size` must be a multiple of 32 and the
+// operation can be done in-place.
+void haraka256_many(byte *in, byte *out, size_t size);
+
+// Computes the untruncated Haraka-512 output of every 64-byte block of `in`
+// into the corresponding block of `out`. Here `size` must be a multiple of 64
+// and the operation can be done in-place.
+void haraka512_many(byte *in, byte *out, size_t size);
+
+#endif
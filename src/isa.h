@@ -0,0 +1,45 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdbool.h>
+
+// Runtime ISA dispatch, so that a library built for the baseline x86-64 ISA
+// (i.e., without -march=native) still runs the kernels with the best
+// instructions of the machine it is loaded on. The variant is picked once at
+// load time by an ifunc resolver reading CPUID.
+
+// Build the annotated function for the baseline, SSE4.2, AVX2 and AVX-512
+// ISAs. Best suited for plain C and GCC vector extensions code, which the
+// compiler vectorizes at the widest width available.
+#define ISA_CLONES __attribute__((target_clones("default", "sse4.2", "avx2", "arch=x86-64-v4")))
+
+// AES-NI kernels cannot have a baseline variant, so they are built for
+// AES-NI with SSE4.1 (legacy encoding) and with AVX2 (VEX encoding, no
+// SSE/AVX transition penalties). Mixes relying on them must be guarded by
+// `isa_has_aesni`.
+// There is no VAES/AVX-512 variant: the kernels are written with the 128-bit
+// AES intrinsics, for which such a target only yields the same code as AVX2.
+// It would need kernels of their own built on the 256/512-bit VAES ones.
+#define ISA_AESNI __attribute__((target("aes,sse4.1")))
+#define ISA_AESNI_AVX2 __attribute__((target("aes,avx2")))
+
+// Define `name` as an ifunc over the AES-NI variants of `name##_impl`, which
+// must be an always-inline function with the `ISA_AESNI` target. Here
+// `params` is the parenthesized parameter list and `args` the parenthesized
+// argument list.
+#define ISA_AESNI_DISPATCH(name, params, args)                                                     \
+        ISA_AESNI static void name##_sse4 params { name##_impl args; }                             \
+        ISA_AESNI_AVX2 static void name##_avx2 params { name##_impl args; }                        \
+        static void (*resolve_##name(void)) params {                                               \
+                __builtin_cpu_init();                                                              \
+                return __builtin_cpu_supports("avx2") ? &name##_avx2 : &name##_sse4;               \
+        }                                                                                          \
+        void name params __attribute__((ifunc("resolve_" #name)))
+
+// Whether the running CPU supports AES-NI.
+static inline bool isa_has_aesni(void) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("aes");
+}
+
+#endif
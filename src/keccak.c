@@ -0,0 +1,222 @@
+#include "keccak.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+
+// SHA3 and SHAKE hash a message through a sponge made of the Keccak-f[1600]
+// permutation. When both the message (plus its padding) and the output fit
+// in the rate, the sponge boils down to a single permutation of the padded
+// message. Since the mixpass hashes lots of messages of the same length, here
+// we skip the streaming bookkeeping of the general APIs and apply the padding
+// known at compile time directly to the state.
+// Bigger messages and outputs go through the general sponge, spanning several
+// blocks of the rate.
+// NOTE: Lanes are stored in little-endian order, as on the target platforms.
+
+#define KECCAK_ROUNDS 24
+
+// Rate in bytes of the sponge
+#define SHA3_256_RATE 136
+#define SHA3_512_RATE 72
+#define SHAKE256_RATE 136
+#define SHAKE128_RATE 168
+
+// Domain separation bits and 1st bit of the padding
+#define SHA3_SUFFIX 0x06
+#define SHAKE_SUFFIX 0x1F
+
+static const uint64_t KECCAK_RC[KECCAK_ROUNDS] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808A, 0x8000000080008000,
+    0x000000000000808B, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+    0x000000000000008A, 0x0000000000000088, 0x0000000080008009, 0x000000008000000A,
+    0x000000008000808B, 0x800000000000008B, 0x8000000000008089, 0x8000000000008003,
+    0x8000000000008002, 0x8000000000000080, 0x000000000000800A, 0x800000008000000A,
+    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008,
+};
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+// One round of Keccak-f[1600] from the lanes `a??` to the lanes `e??`, with
+// lane `xy` at position (x, y) of the state
+#define KECCAK_ROUND(a, e, rc)                                                                     \
+        do {                                                                                       \
+                c0 = a##00 ^ a##01 ^ a##02 ^ a##03 ^ a##04;                                        \
+                c1 = a##10 ^ a##11 ^ a##12 ^ a##13 ^ a##14;                                        \
+                c2 = a##20 ^ a##21 ^ a##22 ^ a##23 ^ a##24;                                        \
+                c3 = a##30 ^ a##31 ^ a##32 ^ a##33 ^ a##34;                                        \
+                c4 = a##40 ^ a##41 ^ a##42 ^ a##43 ^ a##44;                                        \
+                d0 = c4 ^ ROL(c1, 1);                                                              \
+                d1 = c0 ^ ROL(c2, 1);                                                              \
+                d2 = c1 ^ ROL(c3, 1);                                                              \
+                d3 = c2 ^ ROL(c4, 1);                                                              \
+                d4 = c3 ^ ROL(c0, 1);                                                              \
+                                                                                                   \
+                /* Theta, rho and pi of the lanes of the 1st output plane */                       \
+                b0 = a##00 ^ d0;                                                                   \
+                b1 = ROL(a##11 ^ d1, 44);                                                          \
+                b2 = ROL(a##22 ^ d2, 43);                                                          \
+                b3 = ROL(a##33 ^ d3, 21);                                                          \
+                b4 = ROL(a##44 ^ d4, 14);                                                          \
+                /* Chi and iota */                                                                 \
+                e##00 = b0 ^ (~b1 & b2) ^ (rc);                                                    \
+                e##10 = b1 ^ (~b2 & b3);                                                           \
+                e##20 = b2 ^ (~b3 & b4);                                                           \
+                e##30 = b3 ^ (~b4 & b0);                                                           \
+                e##40 = b4 ^ (~b0 & b1);                                                           \
+                                                                                                   \
+                b0 = ROL(a##30 ^ d3, 28);                                                          \
+                b1 = ROL(a##41 ^ d4, 20);                                                          \
+                b2 = ROL(a##02 ^ d0, 3);                                                           \
+                b3 = ROL(a##13 ^ d1, 45);                                                          \
+                b4 = ROL(a##24 ^ d2, 61);                                                          \
+                e##01 = b0 ^ (~b1 & b2);                                                           \
+                e##11 = b1 ^ (~b2 & b3);                                                           \
+                e##21 = b2 ^ (~b3 & b4);                                                           \
+                e##31 = b3 ^ (~b4 & b0);                                                           \
+                e##41 = b4 ^ (~b0 & b1);                                                           \
+                                                                                                   \
+                b0 = ROL(a##10 ^ d1, 1);                                                           \
+                b1 = ROL(a##21 ^ d2, 6);                                                           \
+                b2 = ROL(a##32 ^ d3, 25);                                                          \
+                b3 = ROL(a##43 ^ d4, 8);                                                           \
+                b4 = ROL(a##04 ^ d0, 18);                                                          \
+                e##02 = b0 ^ (~b1 & b2);                                                           \
+                e##12 = b1 ^ (~b2 & b3);                                                           \
+                e##22 = b2 ^ (~b3 & b4);                                                           \
+                e##32 = b3 ^ (~b4 & b0);                                                           \
+                e##42 = b4 ^ (~b0 & b1);                                                           \
+                                                                                                   \
+                b0 = ROL(a##40 ^ d4, 27);                                                          \
+                b1 = ROL(a##01 ^ d0, 36);                                                          \
+                b2 = ROL(a##12 ^ d1, 10);                                                          \
+                b3 = ROL(a##23 ^ d2, 15);                                                          \
+                b4 = ROL(a##34 ^ d3, 56);                                                          \
+                e##03 = b0 ^ (~b1 & b2);                                                           \
+                e##13 = b1 ^ (~b2 & b3);                                                           \
+                e##23 = b2 ^ (~b3 & b4);                                                           \
+                e##33 = b3 ^ (~b4 & b0);                                                           \
+                e##43 = b4 ^ (~b0 & b1);                                                           \
+                                                                                                   \
+                b0 = ROL(a##20 ^ d2, 62);                                                          \
+                b1 = ROL(a##31 ^ d3, 55);                                                          \
+                b2 = ROL(a##42 ^ d4, 39);                                                          \
+                b3 = ROL(a##03 ^ d0, 41);                                                          \
+                b4 = ROL(a##14 ^ d1, 2);                                                           \
+                e##04 = b0 ^ (~b1 & b2);                                                           \
+                e##14 = b1 ^ (~b2 & b3);                                                           \
+                e##24 = b2 ^ (~b3 & b4);                                                           \
+                e##34 = b3 ^ (~b4 & b0);                                                           \
+                e##44 = b4 ^ (~b0 & b1);                                                           \
+        } while (0)
+
+// Keccak-f[1600] on the state `s`, whose lanes are kept in local variables
+// across all the rounds
+static inline void keccak_f1600(uint64_t s[25]) {
+        uint64_t a00 = s[0], a10 = s[1], a20 = s[2], a30 = s[3], a40 = s[4];
+        uint64_t a01 = s[5], a11 = s[6], a21 = s[7], a31 = s[8], a41 = s[9];
+        uint64_t a02 = s[10], a12 = s[11], a22 = s[12], a32 = s[13], a42 = s[14];
+        uint64_t a03 = s[15], a13 = s[16], a23 = s[17], a33 = s[18], a43 = s[19];
+        uint64_t a04 = s[20], a14 = s[21], a24 = s[22], a34 = s[23], a44 = s[24];
+        uint64_t e00, e10, e20, e30, e40, e01, e11, e21, e31, e41, e02, e12, e22, e32, e42;
+        uint64_t e03, e13, e23, e33, e43, e04, e14, e24, e34, e44;
+        uint64_t b0, b1, b2, b3, b4;
+        uint64_t c0, c1, c2, c3, c4;
+        uint64_t d0, d1, d2, d3, d4;
+
+        for (uint8_t r = 0; r < KECCAK_ROUNDS; r += 2) {
+                KECCAK_ROUND(a, e, KECCAK_RC[r]);
+                KECCAK_ROUND(e, a, KECCAK_RC[r + 1]);
+        }
+
+        s[0] = a00, s[1] = a10, s[2] = a20, s[3] = a30, s[4] = a40;
+        s[5] = a01, s[6] = a11, s[7] = a21, s[8] = a31, s[9] = a41;
+        s[10] = a02, s[11] = a12, s[12] = a22, s[13] = a32, s[14] = a42;
+        s[15] = a03, s[16] = a13, s[17] = a23, s[18] = a33, s[19] = a43;
+        s[20] = a04, s[21] = a14, s[22] = a24, s[23] = a34, s[24] = a44;
+}
+
+// Hashes every `block_size` block of `in` into the corresponding block of
+// `out`, with a sponge of the given rate and domain separation suffix
+#define SINGLE_BLOCK_SPONGE(block_size, rate, suffix)                                              \
+        do {                                                                                       \
+                uint64_t state[25];                                                                \
+                                                                                                   \
+                byte *last = in + size;                                                            \
+                for (; in < last; in += (block_size), out += (block_size)) {                       \
+                        memcpy(state, in, (block_size));                                           \
+                        memset((byte *)state + (block_size), 0, sizeof(state) - (block_size));     \
+                        /* Padding */                                                              \
+                        ((byte *)state)[(block_size)] ^= (suffix);                                 \
+                        ((byte *)state)[(rate) - 1] ^= 0x80;                                       \
+                                                                                                   \
+                        keccak_f1600(state);                                                       \
+                        memcpy(out, state, (block_size));                                          \
+                }                                                                                  \
+        } while (0)
+
+void sha3_256_single_block(byte *in, byte *out, size_t size) {
+        SINGLE_BLOCK_SPONGE(KECCAK_SHA3_256_BLOCK_SIZE, SHA3_256_RATE, SHA3_SUFFIX);
+}
+
+void sha3_512_single_block(byte *in, byte *out, size_t size) {
+        SINGLE_BLOCK_SPONGE(KECCAK_SHA3_512_BLOCK_SIZE, SHA3_512_RATE, SHA3_SUFFIX);
+}
+
+void shake256_single_block(byte *in, byte *out, size_t size) {
+        SINGLE_BLOCK_SPONGE(KECCAK_SHAKE256_BLOCK_SIZE, SHAKE256_RATE, SHAKE_SUFFIX);
+}
+
+void shake128_single_block(byte *in, byte *out, size_t size) {
+        SINGLE_BLOCK_SPONGE(KECCAK_SHAKE128_BLOCK_SIZE, SHAKE128_RATE, SHAKE_SUFFIX);
+}
+
+// Hashes every `block_size` block of `in` into the corresponding block of
+// `out`, with a sponge of the given rate and domain separation suffix
+// absorbing and squeezing as many blocks of the rate as needed
+static inline void multi_block_sponge(byte *in, byte *out, size_t size, size_t block_size,
+                                      size_t rate, byte suffix) {
+        uint64_t state[25];
+        byte *bytes = (byte *)state;
+        size_t offset;
+        size_t n;
+
+        byte *last = in + size;
+        for (; in < last; in += block_size, out += block_size) {
+                memset(state, 0, sizeof(state));
+
+                // Absorb the whole input before squeezing, so that the
+                // operation can be done in-place
+                for (offset = 0; block_size - offset >= rate; offset += rate) {
+                        for (size_t i = 0; i < rate; i++) {
+                                bytes[i] ^= in[offset + i];
+                        }
+                        keccak_f1600(state);
+                }
+                for (size_t i = 0; i < block_size - offset; i++) {
+                        bytes[i] ^= in[offset + i];
+                }
+                // Padding
+                bytes[block_size - offset] ^= suffix;
+                bytes[rate - 1] ^= 0x80;
+                keccak_f1600(state);
+
+                for (offset = 0;; offset += n) {
+                        n = MIN(rate, block_size - offset);
+                        memcpy(out + offset, state, n);
+                        if (offset + n == block_size)
+                                break;
+                        keccak_f1600(state);
+                }
+        }
+}
+
+void shake256_multi_block(byte *in, byte *out, size_t size, size_t block_size) {
+        multi_block_sponge(in, out, size, block_size, SHAKE256_RATE, SHAKE_SUFFIX);
+}
+
+void shake128_multi_block(byte *in, byte *out, size_t size, size_t block_size) {
+        multi_block_sponge(in, out, size, block_size, SHAKE128_RATE, SHAKE_SUFFIX);
+}
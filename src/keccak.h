@@ -0,0 +1,44 @@
+#ifndef KECCAK_H
+#define KECCAK_H
+
+#include <stdlib.h>
+
+#include "types.h"
+
+// Size of the messages (and digests) supported by the kernels, each one fits
+// in a single block of the rate of the sponge
+#define KECCAK_SHA3_256_BLOCK_SIZE 32
+#define KECCAK_SHA3_512_BLOCK_SIZE 64
+#define KECCAK_SHAKE256_BLOCK_SIZE 128
+#define KECCAK_SHAKE128_BLOCK_SIZE 160
+
+// Computes the SHA3-256 digest of every 32-byte block of `in` into the
+// corresponding block of `out`. Here `size` must be a multiple of 32 and the
+// operation can be done in-place.
+void sha3_256_single_block(byte *in, byte *out, size_t size);
+
+// Computes the SHA3-512 digest of every 64-byte block of `in` into the
+// corresponding block of `out`. Here `size` must be a multiple of 64 and the
+// operation can be done in-place.
+void sha3_512_single_block(byte *in, byte *out, size_t size);
+
+// Computes the 128-byte SHAKE256 output of every 128-byte block of `in` into
+// the corresponding block of `out`. Here `size` must be a multiple of 128 and
+// the operation can be done in-place.
+void shake256_single_block(byte *in, byte *out, size_t size);
+
+// Computes the 160-byte SHAKE128 output of every 160-byte block of `in` into
+// the corresponding block of `out`. Here `size` must be a multiple of 160 and
+// the operation can be done in-place.
+void shake128_single_block(byte *in, byte *out, size_t size);
+
+// Computes the `block_size`-byte SHAKE256 output of every `block_size`-byte
+// block of `in` into the corresponding block of `out`, for any block size.
+// Here `size` must be a multiple of `block_size` and the operation can be
+// done in-place.
+void shake256_multi_block(byte *in, byte *out, size_t size, size_t block_size);
+
+// Same as `shake256_multi_block`, but computing SHAKE128 outputs.
+void shake128_multi_block(byte *in, byte *out, size_t size, size_t block_size);
+
+#endif
@@ -8,11 +8,20 @@
 #include "barrier.h"
 #include "ctx.h"
 #include "config.h"
+#include "file.h"
 #include "log.h"
+#include "refresh.h"
 #include "spread.h"
 #include "types.h"
 #include "utils.h"
 
+// Size up to which the lanes of a batch are kept contiguous, so that each
+// level of all of them is mixed with a single call
+#define BATCH_CONTIGUOUS_SIZE (256 * 1024)
+// Size of the tiles in which a slice of the state is copied into all the
+// lanes of a batch, small enough for each tile to stay in cache in between
+#define BATCH_STATE_TILE_SIZE (4 * 1024)
+
 // --------------------------------------------------------- Types for threading
 
 typedef struct {
@@ -29,8 +38,25 @@ typedef struct {
         uint8_t unsync_levels;
         uint8_t total_levels;
         byte *iv;
+        // With the ctr-ctr encryption mode, whether to refresh the key at the
+        // 1st level and the AES block of the refresh at `in`
+        bool refresh;
+        uint64_t refresh_counter;
+        // Per-thread states of the mixing functions
+        mix_ctx_t *mixer;
+        mix_ctx_t *one_way_mixer;
+        // Set when the thread could not read its extent of the key
+        int err;
 } thr_keymix_t;
 
+typedef struct {
+        ctx_t *ctx;
+        byte *out;
+        byte (*ivs)[KEYMIX_IV_SIZE];
+        uint32_t nof_lanes;
+        int err;
+} thr_batch_t;
+
 // --------------------------------------------------------- Some utility functions
 
 int get_fanouts_from_block_size(block_size_t block_size, uint8_t n, uint8_t *fanouts) {
@@ -75,7 +101,64 @@ int get_fanouts_from_mix_type(mix_impl_t mix_type, uint8_t n, uint8_t *fanouts)
 
 inline uint8_t get_levels(size_t size, block_size_t block_size, uint8_t fanout) {
         uint64_t nof_macros = size / block_size;
-        return 1 + LOGBASE(nof_macros, fanout);
+        uint8_t levels      = 1;
+        for (; nof_macros > 1; nof_macros /= fanout) {
+                levels++;
+        }
+        return levels;
+}
+
+int get_fanout_schedule(block_size_t block_size, size_t size, uint8_t *fanouts) {
+        uint8_t candidates[KEYMIX_MAX_LEVELS];
+        uint8_t nof_candidates;
+        uint64_t nof_macros;
+        uint8_t count = 0;
+
+        if (!block_size || size % block_size) {
+                return -1;
+        }
+
+        nof_macros     = size / block_size;
+        nof_candidates = get_fanouts_from_block_size(block_size, KEYMIX_MAX_LEVELS, candidates);
+
+        // Taking the highest fanout dividing the #macros left is enough, as
+        // long as the candidates include all the prime factors of the #macros
+        while (nof_macros > 1) {
+                uint8_t c = 0;
+                while (c < nof_candidates && nof_macros % candidates[c]) {
+                        c++;
+                }
+                if (c == nof_candidates || count == KEYMIX_MAX_LEVELS - 1) {
+                        return -1;
+                }
+
+                fanouts[count++] = candidates[c];
+                nof_macros /= candidates[c];
+        }
+
+        return count;
+}
+
+// Initialize the states of the mixing functions of `ctx` once for all the
+// levels. When using ofb encryption mode and the user provides an IV, the
+// states are bound to it, otherwise to the default mixpass IV
+int init_mixers(ctx_t *ctx, byte *iv, mix_ctx_t *mixer, mix_ctx_t *one_way_mixer) {
+        bool ofb         = (ctx->enc_mode == ENC_MODE_OFB || ctx->enc_mode == ENC_MODE_OFB_MULTI);
+        byte *mixpass_iv = (ofb && iv ? iv : (byte *)MIXPASS_DEFAULT_IV);
+
+        if (mix_ctx_init_sized(mixer, ctx->mix, mixpass_iv, ctx->block_size)) {
+                return 1;
+        }
+        if (mix_ctx_init(one_way_mixer, ctx->one_way_mix, mixpass_iv)) {
+                mix_ctx_free(mixer);
+                return 1;
+        }
+        return 0;
+}
+
+void free_mixers(mix_ctx_t *mixer, mix_ctx_t *one_way_mixer) {
+        mix_ctx_free(mixer);
+        mix_ctx_free(one_way_mixer);
 }
 
 // --------------------------------------------------------- Single-threaded keymix
@@ -84,25 +167,47 @@ inline uint8_t get_levels(size_t size, block_size_t block_size, uint8_t fanout)
 // it with the 128-bit IV
 // Then, encrypt the 1st block size, this is done to preserve the key and avoid
 // allocating extra memory
-void update_iv_block(mix_func_t mixpass, byte *in, byte *out,
-                     block_size_t block_size, byte *iv) {
+int update_iv_block(mix_ctx_t *mixer, byte *in, byte *out,
+                    block_size_t block_size, byte *iv) {
         byte block[block_size];
 
         memcpy(block, in, block_size);
         memxor(block, block, iv, KEYMIX_IV_SIZE);
-        (*mixpass)(block, out, block_size, MIXPASS_DEFAULT_IV);
+        return mix_ctx_process(mixer, block, out, block_size);
 }
 
-void keymix_inner(ctx_t *ctx, byte* in, byte* out, size_t size, byte* iv,
-                  uint8_t levels, uint8_t tot_levels) {
-        mix_func_t mixpass = ctx->mixpass;
-        byte *out_first    = out;
-        size_t size_first  = size;
-        byte *mixpass_iv   = MIXPASS_DEFAULT_IV;
+// Refreshes `in` into `out` with `refresh` and mixes it, a tile at a time so
+// that each refreshed tile is still in cache when mixed
+static int refresh_and_mixpass(refresh_ctx_t *refresh, mix_ctx_t *mixer, byte *in, byte *out,
+                               size_t size) {
+        block_size_t block_size = mixer->block_size;
+        size_t tile_size        = MAX(block_size, REFRESH_TILE_SIZE / block_size * block_size);
+        size_t chunk_size;
+
+        for (size_t offset = 0; offset < size; offset += chunk_size) {
+                chunk_size = MIN(tile_size, size - offset);
+                if (refresh_ctx_process(refresh, in + offset, out + offset, chunk_size) ||
+                    mix_ctx_process(mixer, out + offset, out + offset, chunk_size)) {
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+// When `refresh` is not NULL, the 1st level mixes `in` refreshed by it, as
+// required by the ctr-ctr encryption mode. Returns 1 when the refresh or the
+// mixing fails
+int keymix_inner(ctx_t *ctx, mix_ctx_t *mixer, mix_ctx_t *one_way_mixer, byte *in, byte *out,
+                 size_t size, byte *iv, refresh_ctx_t *refresh, uint8_t levels,
+                 uint8_t tot_levels) {
+        byte *out_first   = out;
+        int err           = 0;
+        size_t size_first = size;
 
         // If the enc mode is ctr/ctr-opt and a one-way mixing function is
         // specified, we do a one-way pass at the last level
         bool do_one_way_mixpass = (ctx->enc_mode != ENC_MODE_OFB &&
+                                   ctx->enc_mode != ENC_MODE_OFB_MULTI &&
                                    ctx->one_way_mix != NONE);
 
         spread_args_t args = {
@@ -112,19 +217,18 @@ void keymix_inner(ctx_t *ctx, byte* in, byte* out, size_t size, byte* iv,
                 .buffer_abs      = out,
                 .buffer_abs_size = size,
                 .buffer_size     = size,
-                .fanout          = ctx->fanout,
                 .block_size      = ctx->block_size,
         };
 
         if (do_one_way_mixpass && tot_levels == 1) {
-                mixpass = ctx->one_way_mixpass;
+                mixer = one_way_mixer;
         }
 
         if (iv) {
                 switch (ctx->enc_mode) {
                 case ENC_MODE_CTR:
                         // Update 1st block with IV and counter on its own
-                        update_iv_block(mixpass, in, out, ctx->block_size, iv);
+                        err = update_iv_block(mixer, in, out, ctx->block_size, iv);
 
                         // Skip 1st block with 1st encryption level
                         in += ctx->block_size;
@@ -136,28 +240,34 @@ void keymix_inner(ctx_t *ctx, byte* in, byte* out, size_t size, byte* iv,
                         out_first = out;
                         size_first = size;
 
-                        // The user provided IV was already applied beforehand
-                        // by refreshing the key in enc.c
+                        // The user provided IV is applied by refreshing the
+                        // key along with the 1st level
                         break;
                 case ENC_MODE_OFB:
+                case ENC_MODE_OFB_MULTI:
                         // No changes to blocks
                         out_first = out;
                         size_first = size;
 
-                        // But use user provided IV for the mixpass
-                        mixpass_iv = iv;
+                        // The user provided IV is passed down to the mixpass
+                        // when initializing the mixer
                         break;
                 }
         }
 
-        (*mixpass)(in, out_first, size_first, mixpass_iv);
-        for (args.level = 1; args.level < levels; args.level++) {
-                spread_opt(&args);
-                if (do_one_way_mixpass && args.level == tot_levels - 1) {
-                        mixpass = ctx->one_way_mixpass;
+        if (refresh)
+                err |= refresh_and_mixpass(refresh, mixer, in, out_first, size_first);
+        else
+                err |= mix_ctx_process(mixer, in, out_first, size_first);
+        for (uint8_t level = 1; level < levels && !err; level++) {
+                set_spread_level(ctx, &args, level);
+                (*ctx->spreads[level - 1])(&args);
+                if (do_one_way_mixpass && level == tot_levels - 1) {
+                        mixer = one_way_mixer;
                 }
-                (*mixpass)(out, out, size, mixpass_iv);
+                err = mix_ctx_process(mixer, out, out, size);
         }
+        return (err != 0);
 }
 
 // The input of the optimized version is not the key itself, but the result of
@@ -166,10 +276,11 @@ void keymix_inner(ctx_t *ctx, byte* in, byte* out, size_t size, byte* iv,
 // state, so we expect copies of the original state have been made by the
 // caller. On the other hand, when they are not inplace the input shall not be
 // be changed.
-void keymix_inner_opt(ctx_t *ctx, byte* in, byte* out, size_t size, byte* iv,
-                      uint8_t levels, uint8_t tot_levels) {
-        size_t curr_size   = ctx->block_size;
-        mix_func_t mixpass = ctx->mixpass;
+// Returns 1 when the mixing fails.
+int keymix_inner_opt(ctx_t *ctx, mix_ctx_t *mixer, mix_ctx_t *one_way_mixer, byte *in,
+                     byte *out, size_t size, byte *iv, uint8_t levels, uint8_t tot_levels) {
+        size_t curr_size = ctx->block_size;
+        int err          = 0;
 
         // If the enc mode is ctr/ctr-opt and a one-way mixing function is
         // specified, we do a one-way pass at the last level
@@ -182,7 +293,6 @@ void keymix_inner_opt(ctx_t *ctx, byte* in, byte* out, size_t size, byte* iv,
                 .buffer_abs      = out,
                 .buffer_abs_size = size,
                 .buffer_size     = size,
-                .fanout          = ctx->fanout,
                 .block_size      = ctx->block_size,
         };
 
@@ -191,45 +301,140 @@ void keymix_inner_opt(ctx_t *ctx, byte* in, byte* out, size_t size, byte* iv,
         }
 
         if (do_one_way_mixpass && tot_levels == 1) {
-                mixpass = ctx->one_way_mixpass;
+                mixer = one_way_mixer;
         }
 
         // 1st level
         if (iv) {
                 // Update 1st block with IV and counter on its own
-                update_iv_block(mixpass, in, out, ctx->block_size, iv);
+                err = update_iv_block(mixer, in, out, ctx->block_size, iv);
         } else {
                 // Encrypt 1st block as is
-                (*mixpass)(in, out, curr_size, MIXPASS_DEFAULT_IV);
+                err = mix_ctx_process(mixer, in, out, curr_size);
         }
 
         // Other levels
-        for (args.level = 1; args.level < levels; args.level++) {
-                curr_size *= ctx->fanout;
+        for (uint8_t level = 1; level < levels && !err; level++) {
+                curr_size *= ctx->fanouts[level - 1];
                 args.buffer_abs_size = curr_size;
                 args.buffer_size     = curr_size;
-                spread_opt(&args);
+                set_spread_level(ctx, &args, level);
+                (*ctx->spreads[level - 1])(&args);
 
-                if (do_one_way_mixpass && args.level == tot_levels - 1) {
-                        mixpass = ctx->one_way_mixpass;
+                if (do_one_way_mixpass && level == tot_levels - 1) {
+                        mixer = one_way_mixer;
                 }
 
-                (*mixpass)(out, out, curr_size, MIXPASS_DEFAULT_IV);
+                err = mix_ctx_process(mixer, out, out, curr_size);
         }
+        return (err != 0);
 }
 
-// --------------------------------------------------------- Multi-threaded keymix
+// Moves the first `size` bytes of each of the `nof_lanes` lanes of `out` from
+// a stride of `from` bytes to a larger one of `to` bytes
+static void stride_lanes(byte *out, uint32_t nof_lanes, size_t size, size_t from, size_t to) {
+        // Backwards, so that no lane is overwritten before being moved
+        for (uint32_t i = nof_lanes; i-- > 0;) {
+                memmove(out + to * i, out + from * i, size);
+        }
+}
 
-int sync_spread_and_mixpass(thr_keymix_t *thr, spread_args_t *args) {
-        ctx_t *ctx         = thr->ctx;
-        mix_func_t mixpass = ctx->mixpass;
-        byte *mixpass_iv   = MIXPASS_DEFAULT_IV;
+// Same as `keymix_inner_opt` from the precomputed `ctx->state` on all levels,
+// but for `nof_lanes` IVs in lockstep, with the keystream of the i-th IV
+// going to `out + i * ctx->key_size`. At each level, the slice of the state
+// reached by that level is copied into all the lanes a tile at a time, so that
+// it is read from memory once for all of them. While small enough, the lanes
+// are kept contiguous, so that the mixing primitive processes all of them with
+// a single call. Returns 1 when the mixing fails.
+int keymix_inner_opt_batch(ctx_t *ctx, mix_ctx_t *mixer, mix_ctx_t *one_way_mixer, byte *out,
+                           byte (*ivs)[KEYMIX_IV_SIZE], uint32_t nof_lanes) {
+        size_t key_size  = ctx->key_size;
+        size_t curr_size = ctx->block_size;
+        size_t prev_size;
+        size_t stride = curr_size;
+        size_t next_stride;
+        size_t tile_size;
+        byte *lane;
+        int err;
+
+        bool do_one_way_mixpass = (ctx->one_way_mix != NONE);
 
-        // When using ofb encryption mode and the user provides an IV pass it
-        // down to the mixpass
-        if (ctx->enc_mode == ENC_MODE_OFB && thr->iv) {
-                mixpass_iv = thr->iv;
+        spread_args_t args = {
+                .thread_id   = 0,
+                .nof_threads = 1,
+                .block_size  = ctx->block_size,
+        };
+
+        if (do_one_way_mixpass && ctx->levels == 1) {
+                mixer = one_way_mixer;
+        }
+
+        // 1st level
+        for (uint32_t i = 0; i < nof_lanes; i++) {
+                lane = out + stride * i;
+                memcpy(lane, ctx->state, curr_size);
+                memxor(lane, lane, ivs[i], KEYMIX_IV_SIZE);
         }
+        err = mix_ctx_process(mixer, out, out, curr_size * nof_lanes);
+
+        // Other levels
+        for (uint8_t level = 1; level < ctx->levels && !err; level++) {
+                prev_size = curr_size;
+                curr_size *= ctx->fanouts[level - 1];
+
+                // Make room for the new slice of each lane, moving them to
+                // their final place once too large to be contiguous
+                if (stride != key_size) {
+                        next_stride = (curr_size * nof_lanes <= BATCH_CONTIGUOUS_SIZE ? curr_size
+                                                                                      : key_size);
+                        stride_lanes(out, nof_lanes, prev_size, stride, next_stride);
+                        stride = next_stride;
+                }
+
+                args.buffer_abs_size = curr_size;
+                args.buffer_size     = curr_size;
+                set_spread_level(ctx, &args, level);
+
+                for (size_t offset = prev_size; offset < curr_size; offset += tile_size) {
+                        tile_size = MIN(BATCH_STATE_TILE_SIZE, curr_size - offset);
+                        for (uint32_t i = 0; i < nof_lanes; i++) {
+                                memcpy(out + stride * i + offset, ctx->state + offset, tile_size);
+                        }
+                }
+
+                for (uint32_t i = 0; i < nof_lanes; i++) {
+                        lane = out + stride * i;
+
+                        args.buffer     = lane;
+                        args.buffer_abs = lane;
+                        (*ctx->spreads[level - 1])(&args);
+                }
+
+                if (do_one_way_mixpass && level == ctx->levels - 1) {
+                        mixer = one_way_mixer;
+                }
+
+                if (stride == curr_size) {
+                        err = mix_ctx_process(mixer, out, out, curr_size * nof_lanes);
+                } else {
+                        for (uint32_t i = 0; i < nof_lanes && !err; i++) {
+                                lane = out + stride * i;
+                                err  = mix_ctx_process(mixer, lane, lane, curr_size);
+                        }
+                }
+        }
+        return (err != 0);
+}
+
+// --------------------------------------------------------- Multi-threaded keymix
+
+// A thread without mixers (i.e., `thr->mixer` is NULL, as their initialization
+// failed) still goes through the barriers, not to leave the others waiting,
+// but skips the work. Failures of the mixpass are recorded into `thr->err`,
+// while only the ones of the barriers are returned, since they are fatal
+int sync_spread_and_mixpass(thr_keymix_t *thr, spread_args_t *args) {
+        ctx_t *ctx        = thr->ctx;
+        mix_ctx_t *mixer  = thr->mixer;
 
         // Wait for all threads to finish the encryption step
         int err = barrier(thr->barrier, thr->nof_threads);
@@ -240,7 +445,8 @@ int sync_spread_and_mixpass(thr_keymix_t *thr, spread_args_t *args) {
 
         _log(LOG_DEBUG, "t=%d: sychronized swap (level %d)\n", thr->id,
              args->level - 1);
-        spread_opt(args);
+        if (mixer != NULL)
+                (*ctx->spreads[args->level - 1])(args);
 
         // Wait for all threads to finish the swap step
         err = barrier(thr->barrier, thr->nof_threads);
@@ -249,30 +455,69 @@ int sync_spread_and_mixpass(thr_keymix_t *thr, spread_args_t *args) {
                 return 1;
         }
 
+        if (mixer == NULL)
+                return 0;
+
         _log(LOG_DEBUG, "t=%d: sychronized encryption (level %d)\n", thr->id,
              args->level);
         // If the enc mode is ctr/ctr-opt, a one-way mixing function is
         // specified, and the current level is the last one, we do a one-way
         // pass
-        if (ctx->enc_mode != ENC_MODE_OFB && ctx->one_way_mix != NONE &&
-            args->level == thr->total_levels - 1) {
-                mixpass = ctx->one_way_mixpass;
+        if (ctx->enc_mode != ENC_MODE_OFB && ctx->enc_mode != ENC_MODE_OFB_MULTI &&
+            ctx->one_way_mix != NONE && args->level == thr->total_levels - 1) {
+                mixer = thr->one_way_mixer;
         }
-        err = (*(mixpass))(args->buffer, args->buffer, args->buffer_size,
-                           mixpass_iv);
+        err = mix_ctx_process(mixer, args->buffer, args->buffer, args->buffer_size);
         if (err) {
                 _log(LOG_ERROR, "t=%d: mixpass error %d\n", thr->id, err);
-                return 1;
+                thr->err = 1;
         }
 
         return 0;
 }
 
+// Reads the extent `in` of the key, when its loading is deferred to the first
+// keymix (see `ctx_defer_key_load`). Only the keymixes of the key, which hold
+// `ctx->key_lock` while loading it, read `ctx->key_fd`
+static int load_key_extent(ctx_t *ctx, byte *in, size_t size) {
+        if (in < ctx->key || in >= ctx->key + ctx->key_size || ctx->key_fd < 0) {
+                return 0;
+        }
+        return read_file_extent(ctx->key_fd, in, size, in - ctx->key);
+}
+
 void *w_thread_keymix(void *a) {
         thr_keymix_t *thr     = (thr_keymix_t *)a;
         ctx_t *ctx            = thr->ctx;
+        mix_ctx_t mixer;
+        mix_ctx_t one_way_mixer;
+        refresh_ctx_t refresh;
         byte *iv;
 
+        // The states of the mixing functions are not thread-safe, so each
+        // thread builds its own once for all the levels. On failure, it goes
+        // on anyway not to leave the others waiting on the barrier
+        thr->mixer         = NULL;
+        thr->one_way_mixer = NULL;
+        if (init_mixers(ctx, thr->iv, &mixer, &one_way_mixer)) {
+                _log(LOG_ERROR, "t=%d: cannot initialize the mixers\n", thr->id);
+                thr->err = 1;
+        } else {
+                thr->mixer         = &mixer;
+                thr->one_way_mixer = &one_way_mixer;
+        }
+
+        // Each thread refreshes its own extent of the key, right before
+        // mixing it
+        if (thr->mixer && thr->refresh &&
+            refresh_ctx_init(&refresh, thr->iv, thr->refresh_counter)) {
+                _log(LOG_ERROR, "t=%d: cannot initialize the refresh\n", thr->id);
+                free_mixers(&mixer, &one_way_mixer);
+                thr->mixer         = NULL;
+                thr->one_way_mixer = NULL;
+                thr->err           = 1;
+        }
+
         switch (ctx->enc_mode) {
         case ENC_MODE_CTR:
                 // The 1st thread owns the 1st block, as such, it is in charge
@@ -280,20 +525,36 @@ void *w_thread_keymix(void *a) {
                 iv = (!thr->id ? thr->iv : NULL);
                 break;
         case ENC_MODE_CTR_CTR:
-                // None of the threads must have the IV, since the IV was
-                // already applied beforehand by refreshing the key in enc.c
+                // None of the threads must have the IV, since the IV is
+                // applied by refreshing the key
                 iv = NULL;
                 break;
         case ENC_MODE_OFB:
+        case ENC_MODE_OFB_MULTI:
                 // All threads must have the IV, so they can pass it down to
                 // the mixpass
                 iv = thr->iv;
                 break;
         }
 
+        // The thread starts as soon as its own extent of the key is in, while
+        // the others are still reading theirs. On failure, it goes on anyway
+        // not to leave the others waiting on the barrier
+        if (load_key_extent(ctx, thr->in, thr->chunk_size)) {
+                _log(LOG_ERROR, "t=%d: cannot read the key\n", thr->id);
+                thr->err = 1;
+        }
+
         // No need to sync among other threads here
-        keymix_inner(thr->ctx, thr->in, thr->out, thr->chunk_size, iv,
-                     thr->unsync_levels, thr->total_levels);
+        if (thr->mixer &&
+            keymix_inner(thr->ctx, &mixer, &one_way_mixer, thr->in, thr->out, thr->chunk_size,
+                         iv, thr->refresh ? &refresh : NULL, thr->unsync_levels,
+                         thr->total_levels)) {
+                _log(LOG_ERROR, "t=%d: mixpass error\n", thr->id);
+                thr->err = 1;
+        }
+        if (thr->mixer && thr->refresh)
+                refresh_ctx_free(&refresh);
         _log(LOG_DEBUG, "t=%d: finished layers without coordination\n", thr->id);
 
         // Synchronized layers
@@ -305,12 +566,11 @@ void *w_thread_keymix(void *a) {
                 .buffer_abs      = thr->abs_out,
                 .buffer_abs_size = thr->total_size,
                 .buffer_size     = thr->chunk_size,
-                .fanout          = ctx->fanout,
                 .block_size      = ctx->block_size,
-                .level           = thr->unsync_levels,
         };
 
-        for (; args.level < thr->total_levels; args.level++) {
+        for (uint8_t level = thr->unsync_levels; level < thr->total_levels; level++) {
+                set_spread_level(ctx, &args, level);
                 int err = sync_spread_and_mixpass(thr, &args);
                 if (err) {
                         _log(LOG_ERROR, "t=%d: syncronization error (level %d)\n",
@@ -320,6 +580,8 @@ void *w_thread_keymix(void *a) {
         }
 
 thread_exit:
+        if (thr->mixer)
+                free_mixers(&mixer, &one_way_mixer);
         return NULL;
 }
 
@@ -338,20 +600,37 @@ void *w_thread_keymix_opt(void *a) {
         thr_keymix_t *thr = (thr_keymix_t *)a;
         ctx_t *ctx        = thr->ctx;
         byte *iv          = (!thr->id ? thr->iv : NULL);
+        mix_ctx_t mixer;
+        mix_ctx_t one_way_mixer;
 
         size_t curr_tot_size = thr->chunk_size;
 
+        // On failure, go on anyway not to leave the others waiting on the
+        // barrier
+        thr->mixer         = NULL;
+        thr->one_way_mixer = NULL;
+        if (init_mixers(ctx, thr->iv, &mixer, &one_way_mixer)) {
+                _log(LOG_ERROR, "t=%d: cannot initialize the mixers\n", thr->id);
+                thr->err = 1;
+        } else {
+                thr->mixer         = &mixer;
+                thr->one_way_mixer = &one_way_mixer;
+        }
+
         // No need for syncronization in the 1st layers
 
-        if (!thr->id) {
+        if (thr->mixer && !thr->id) {
                 // At the beginning only the 1st thread performs the keymix
                 // up to a predetermined number of levels
-                keymix_inner_opt(thr->ctx, thr->abs_in, thr->abs_out,
-                                 curr_tot_size, iv, thr->unsync_levels,
-                                 thr->total_levels);
+                if (keymix_inner_opt(thr->ctx, &mixer, &one_way_mixer, thr->abs_in,
+                                     thr->abs_out, curr_tot_size, iv, thr->unsync_levels,
+                                     thr->total_levels)) {
+                        _log(LOG_ERROR, "t=%d: mixpass error\n", thr->id);
+                        thr->err = 1;
+                }
                 _log(LOG_DEBUG, "t=%d: finished mixing prefix of internal state\n",
                      thr->id);
-        } else if (thr->abs_in != thr->abs_out) {
+        } else if (thr->mixer && thr->abs_in != thr->abs_out) {
                 // Other threads copy the remaining part of the internal state
                 // to the output buffer so that we are ready to perform the
                 // following levels
@@ -381,13 +660,11 @@ void *w_thread_keymix_opt(void *a) {
                 .thread_id   = thr->id,
                 .nof_threads = thr->nof_threads,
                 .buffer_abs  = thr->abs_out,
-                .fanout      = ctx->fanout,
                 .block_size  = ctx->block_size,
-                .level       = thr->unsync_levels,
         };
 
-        for (; args.level < thr->total_levels; args.level++) {
-                curr_tot_size *= ctx->fanout;
+        for (uint8_t level = thr->unsync_levels; level < thr->total_levels; level++) {
+                curr_tot_size *= ctx->fanouts[level - 1];
 
                 // #macros to mix at the current level
                 curr_tot_macros = curr_tot_size / ctx->block_size;
@@ -403,6 +680,7 @@ void *w_thread_keymix_opt(void *a) {
                 args.buffer          = thr->abs_out + ctx->block_size * offset;
                 args.buffer_abs_size = curr_tot_size;
                 args.buffer_size     = ctx->block_size * macros;
+                set_spread_level(ctx, &args, level);
 
                 int err = sync_spread_and_mixpass(thr, &args);
                 if (err) {
@@ -413,11 +691,150 @@ void *w_thread_keymix_opt(void *a) {
         }
 
 thread_exit:
+        if (thr->mixer)
+                free_mixers(&mixer, &one_way_mixer);
+        return NULL;
+}
+
+// Compute the levels of the internal state that are kept equal across all iv
+// and counter values (see `keymix_precompute`). At each level the thread owns
+// a window of the blocks not yet reached by the 1st one, which are
+// independent from the ones that precede them.
+void *w_thread_precompute(void *a) {
+        uint64_t tot_macros;
+        uint64_t slab_macros;
+        uint64_t region_macros;
+        uint64_t offset;
+        uint64_t macros;
+
+        thr_keymix_t *thr = (thr_keymix_t *)a;
+        ctx_t *ctx        = thr->ctx;
+        mix_ctx_t mixer;
+        mix_ctx_t one_way_mixer;
+
+        // On failure, go on anyway not to leave the others waiting on the
+        // barrier
+        thr->mixer         = NULL;
+        thr->one_way_mixer = NULL;
+        if (init_mixers(ctx, NULL, &mixer, &one_way_mixer)) {
+                _log(LOG_ERROR, "t=%d: cannot initialize the mixers\n", thr->id);
+                thr->err = 1;
+        } else {
+                thr->mixer         = &mixer;
+                thr->one_way_mixer = &one_way_mixer;
+        }
+
+        // 1st level, all blocks but the 1st one that is bound to the iv
+        tot_macros    = thr->total_size / ctx->block_size;
+        region_macros = tot_macros - 1;
+        offset        = 1 + get_curr_thread_offset(region_macros, thr->id, thr->nof_threads);
+        macros        = get_curr_thread_size(region_macros, thr->id, thr->nof_threads);
+        if (thr->mixer &&
+            mix_ctx_process(&mixer, thr->abs_in + ctx->block_size * offset,
+                            thr->abs_out + ctx->block_size * offset, ctx->block_size * macros)) {
+                _log(LOG_ERROR, "t=%d: mixpass error\n", thr->id);
+                thr->err = 1;
+        }
+
+        spread_args_t args = {
+                .thread_id   = thr->id,
+                .nof_threads = thr->nof_threads,
+                .block_size  = ctx->block_size,
+        };
+
+        // Other levels, except for the last one where the 1st block reaches
+        // all the others
+        for (uint8_t level = 1; level < thr->total_levels - 1; level++) {
+                // The blocks after the 1st slab of the current level
+                slab_macros   = get_slab_macros(ctx, level);
+                region_macros = tot_macros - slab_macros;
+                offset        = get_curr_thread_offset(region_macros, thr->id, thr->nof_threads);
+                macros        = get_curr_thread_size(region_macros, thr->id, thr->nof_threads);
+
+                args.buffer_abs      = thr->abs_out + ctx->block_size * slab_macros;
+                args.buffer_abs_size = ctx->block_size * region_macros;
+                args.buffer          = args.buffer_abs + ctx->block_size * offset;
+                args.buffer_size     = ctx->block_size * macros;
+                set_spread_level(ctx, &args, level);
+
+                int err = sync_spread_and_mixpass(thr, &args);
+                if (err) {
+                        _log(LOG_ERROR, "t=%d: syncronization error (level %d)\n", thr->id,
+                             args.level);
+                        break;
+                }
+        }
+
+        if (thr->mixer)
+                free_mixers(&mixer, &one_way_mixer);
         return NULL;
 }
 
-int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
-              uint8_t nof_threads) {
+int keymix_precompute(ctx_t *ctx, byte *state, uint8_t nof_threads) {
+        uint64_t tot_macros = ctx->key_size / ctx->block_size;
+
+        // Copy key changed with iv and counter
+        memcpy(state, ctx->key, ctx->block_size);
+
+        // Ensure 1 <= #threads <= #macros not bound to the iv
+        nof_threads = MAX(1, MIN(nof_threads, tot_macros - 1));
+        _log(LOG_DEBUG, "#threads:\t%d\n", nof_threads);
+
+        pthread_t threads[nof_threads];
+        thr_keymix_t args[nof_threads];
+        thr_barrier_t barrier;
+
+        int thr_err = 0;
+        int err     = barrier_init(&barrier);
+        if (err) {
+                _log(LOG_ERROR, "barrier_init error %d\n", err);
+                goto cleanup;
+        }
+
+        for (uint8_t t = 0; t < nof_threads; t++) {
+                thr_keymix_t *a = args + t;
+
+                a->id           = t;
+                a->nof_threads  = nof_threads;
+                a->barrier      = &barrier;
+                a->ctx          = ctx;
+                a->abs_in       = ctx->key;
+                a->abs_out      = state;
+                a->total_size   = ctx->key_size;
+                a->total_levels = ctx->levels;
+                a->err          = 0;
+
+                // With 1 thread, just use the function directly
+                if (nof_threads > 1) {
+                        pthread_create(&threads[t], NULL, w_thread_precompute, a);
+                } else {
+                        w_thread_precompute(a);
+                }
+        }
+
+        for (uint8_t t = 0; nof_threads > 1 && t < nof_threads; t++) {
+                err = pthread_join(threads[t], NULL);
+                if (err) {
+                        _log(LOG_ERROR, "pthread_join error %d (thread %d)\n", err, t);
+                        goto cleanup;
+                }
+        }
+        for (uint8_t t = 0; t < nof_threads; t++) {
+                thr_err |= args[t].err;
+        }
+
+cleanup:
+        err = barrier_destroy(&barrier);
+        if (err)
+                _log(LOG_ERROR, "barrier_destroy error %d\n", err);
+
+        return (err ? err : thr_err);
+}
+
+// Same as `keymix_ex`, refreshing `in` from the AES block `refresh_counter`
+// at the 1st level when `refresh` is set
+static int keymix_levels(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv, bool refresh,
+                         uint64_t refresh_counter, uint8_t nof_threads) {
         uint64_t tot_macros;
         uint64_t macros;
         uint8_t levels;
@@ -431,7 +848,7 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
 
         tot_macros = size / ctx->block_size;
         _log(LOG_DEBUG, "total macros:\t%d\n", tot_macros);
-        levels = get_levels(size, ctx->block_size, ctx->fanout);
+        levels = ctx->levels;
         _log(LOG_DEBUG, "total levels:\t%d\n", levels);
 
         // Ensure 1 <= #threads <= #macros
@@ -441,21 +858,52 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
         // If there is 1 thread, just use the function directly, no need to
         // allocate and deallocate a lot of stuff
         if (nof_threads == 1) {
+                mix_ctx_t mixer;
+                mix_ctx_t one_way_mixer;
+                refresh_ctx_t refresh_ctx;
+                int err = 0;
+                if (init_mixers(ctx, iv, &mixer, &one_way_mixer)) {
+                        _log(LOG_ERROR, "Cannot initialize the mixers\n");
+                        return 1;
+                }
+                if (refresh && refresh_ctx_init(&refresh_ctx, iv, refresh_counter)) {
+                        _log(LOG_ERROR, "Cannot initialize the refresh\n");
+                        free_mixers(&mixer, &one_way_mixer);
+                        return 1;
+                }
+
                 if (ctx->enc_mode != ENC_MODE_CTR_OPT) {
-                        keymix_inner(ctx, in, out, size, iv, levels, levels);
+                        if (load_key_extent(ctx, in, size)) {
+                                _log(LOG_ERROR, "Cannot read the key\n");
+                                if (refresh)
+                                        refresh_ctx_free(&refresh_ctx);
+                                free_mixers(&mixer, &one_way_mixer);
+                                return 1;
+                        }
+                        err = keymix_inner(ctx, &mixer, &one_way_mixer, in, out, size, iv,
+                                           refresh ? &refresh_ctx : NULL, levels, levels);
+                        if (refresh)
+                                refresh_ctx_free(&refresh_ctx);
                 } else {
-                        keymix_inner_opt(ctx, in, out, size, iv, levels, levels);
+                        err = keymix_inner_opt(ctx, &mixer, &one_way_mixer, in, out, size, iv,
+                                               levels, levels);
                 }
-                return 0;
+                if (err)
+                        _log(LOG_ERROR, "Cannot mix the key\n");
+
+                free_mixers(&mixer, &one_way_mixer);
+                if (in == ctx->key)
+                        ctx->key_fd = -1;
+                return err;
         }
 
         if (ctx->enc_mode != ENC_MODE_CTR_OPT) {
                 // If the #threads divides the #macros and #macros per thread
-                // is a multiple of a fanout power, the threads won't write in
-                // other threads memory up to the level exceeding that fanout
-                // power. So the threads can initially run without
-                // syncronization and only then be syncronized on the last few
-                // levels
+                // is a multiple of the product of the first fanouts of the
+                // schedule, the threads won't write in other threads memory up
+                // to the level exceeding that product. So the threads can
+                // initially run without syncronization and only then be
+                // syncronized on the last few levels
                 // NOTE: The 1st layer of encryption can always be done
                 // unsyncronized
                 unsync_levels = 1;
@@ -464,7 +912,7 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
                         macros = 1;
                         unsync_levels = 0;
                         while (thread_chunk_size % macros == 0) {
-                                macros *= ctx->fanout;
+                                macros *= ctx->fanouts[unsync_levels];
                                 unsync_levels += 1;
                         }
                 }
@@ -477,8 +925,8 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
                 // #threads available.
                 macros = 1;
                 unsync_levels = 0;
-                while (macros <= nof_threads) {
-                        macros *= ctx->fanout;
+                while (macros <= nof_threads && unsync_levels < levels) {
+                        macros *= ctx->fanouts[unsync_levels];
                         unsync_levels += 1;
                 }
         }
@@ -489,7 +937,8 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
         thr_barrier_t barrier;
 
         // Initialize barrier once for all threads
-        int err = 0;
+        int err     = 0;
+        int thr_err = 0;
         err = barrier_init(&barrier);
         if (err) {
                 _log(LOG_ERROR, "barrier_init error %d\n", err);
@@ -508,7 +957,7 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
                         thread_chunk_size = ctx->block_size * macros;
                 } else {
                         // #macros done by the 1st thread
-                        macros = intpow(ctx->fanout, unsync_levels - 1);
+                        macros = get_slab_macros(ctx, unsync_levels - 1);
                         thread_chunk_size = ctx->block_size * macros;
                 }
 
@@ -525,6 +974,12 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
                 a->unsync_levels = unsync_levels;
                 a->total_levels  = levels;
                 a->iv            = iv;
+                a->refresh       = refresh;
+                a->err           = 0;
+
+                // The refresh of the extent of the thread goes on from the
+                // AES blocks of the previous ones
+                a->refresh_counter = refresh_counter + (in_offset - in) / BLOCK_SIZE_AES;
 
                 if (ctx->enc_mode != ENC_MODE_CTR_OPT) {
                         pthread_create(&threads[t], NULL, w_thread_keymix, a);
@@ -543,17 +998,53 @@ int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte* iv,
                         _log(LOG_ERROR, "pthread_join error %d (thread %d)\n", err, t);
                         goto cleanup;
                 }
+                thr_err |= args[t].err;
         }
 
+        // The threads have read the whole key by now
+        if (!thr_err && in == ctx->key)
+                ctx->key_fd = -1;
+
 cleanup:
         _log(LOG_DEBUG, "[i] safe obj destruction\n");
         err = barrier_destroy(&barrier);
         if (err)
                 _log(LOG_ERROR, "barrier_destroy error %d\n", err);
 
+        return (err ? err : thr_err);
+}
+
+// Same as `keymix_levels`, loading the key first if it is deferred (see
+// `ctx_defer_key_load`). The keymix loading it holds `ctx->key_lock` until the
+// key is in, the others only take it to check that it is.
+static int keymix_run(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv, bool refresh,
+                      uint64_t refresh_counter, uint8_t nof_threads) {
+        bool loading = false;
+        int err;
+
+        if (in == ctx->key) {
+                pthread_mutex_lock(&ctx->key_lock);
+                loading = (ctx->key_fd >= 0);
+                if (!loading)
+                        pthread_mutex_unlock(&ctx->key_lock);
+        }
+
+        err = keymix_levels(ctx, in, out, size, iv, refresh, refresh_counter, nof_threads);
+
+        if (loading)
+                pthread_mutex_unlock(&ctx->key_lock);
         return err;
 }
 
+int keymix_ex(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv, uint8_t nof_threads) {
+        return keymix_run(ctx, in, out, size, iv, false, 0, nof_threads);
+}
+
+int keymix_refresh(ctx_t *ctx, byte *out, size_t size, byte *iv, uint64_t counter,
+                   uint8_t nof_threads) {
+        return keymix_run(ctx, ctx->key, out, size, iv, true, counter, nof_threads);
+}
+
 int keymix(ctx_t *ctx, byte *out, size_t size) {
         assert(!ctx->encrypt && "You can't use an encryption context with keymix");
         return keymix_ex(ctx, ctx->key, out, size, NULL, 1);
@@ -563,3 +1054,81 @@ int keymix_t(ctx_t *ctx, byte *out, size_t size, uint8_t threads) {
         assert(!ctx->encrypt && "You can't use an encryption context with keymix");
         return keymix_ex(ctx, ctx->key, out, size, NULL, threads);
 }
+
+void *w_thread_keymix_batch(void *a) {
+        thr_batch_t *thr = (thr_batch_t *)a;
+        mix_ctx_t mixer;
+        mix_ctx_t one_way_mixer;
+
+        if (init_mixers(thr->ctx, NULL, &mixer, &one_way_mixer)) {
+                _log(LOG_ERROR, "Cannot initialize the mixers\n");
+                thr->err = 1;
+                return NULL;
+        }
+
+        if (keymix_inner_opt_batch(thr->ctx, &mixer, &one_way_mixer, thr->out, thr->ivs,
+                                   thr->nof_lanes)) {
+                _log(LOG_ERROR, "Cannot mix the batch\n");
+                thr->err = 1;
+        }
+
+        free_mixers(&mixer, &one_way_mixer);
+        return NULL;
+}
+
+int keymix_opt_batch(ctx_t *ctx, byte *out, byte (*ivs)[KEYMIX_IV_SIZE], uint32_t nof_lanes,
+                     uint8_t nof_threads) {
+        assert(ctx->enc_mode == ENC_MODE_CTR_OPT &&
+               "Batches need the precomputed state of the ctr-opt encryption mode");
+
+        // With fewer lanes than threads, windows of lanes would leave threads
+        // idle, so the threads split each lane among themselves instead
+        if (nof_lanes < nof_threads) {
+                int err = 0;
+                for (uint32_t l = 0; l < nof_lanes && !err; l++) {
+                        err = keymix_ex(ctx, ctx->state, out + ctx->key_size * l, ctx->key_size,
+                                        ivs[l], nof_threads);
+                }
+                return err;
+        }
+
+        // Lanes are independent, so each thread gets its own window of them
+        nof_threads = MAX(1, nof_threads);
+        _log(LOG_DEBUG, "#threads:\t%d\n", nof_threads);
+
+        pthread_t threads[nof_threads];
+        thr_batch_t args[nof_threads];
+        int err = 0;
+
+        for (uint8_t t = 0; t < nof_threads; t++) {
+                thr_batch_t *a = args + t;
+                uint64_t offset = get_curr_thread_offset(nof_lanes, t, nof_threads);
+
+                a->ctx       = ctx;
+                a->out       = out + ctx->key_size * offset;
+                a->ivs       = ivs + offset;
+                a->nof_lanes = get_curr_thread_size(nof_lanes, t, nof_threads);
+                a->err       = 0;
+
+                // With 1 thread, just use the function directly
+                if (nof_threads > 1) {
+                        pthread_create(&threads[t], NULL, w_thread_keymix_batch, a);
+                } else {
+                        w_thread_keymix_batch(a);
+                }
+        }
+
+        for (uint8_t t = 0; t < nof_threads; t++) {
+                if (nof_threads > 1) {
+                        int join_err = pthread_join(threads[t], NULL);
+                        if (join_err) {
+                                _log(LOG_ERROR, "pthread_join error %d (thread %d)\n", join_err,
+                                     t);
+                                err = join_err;
+                        }
+                }
+                err |= args[t].err;
+        }
+
+        return err;
+}
@@ -11,20 +11,51 @@
 #include "types.h"
 
 // --- XKCP Kravatte-WBC in ECB mode ---
-int xkcp_kravette_wbc_ecb(byte *in, byte *out, size_t size, byte *iv) {
-        Kravatte_Instance kwiEnc;
 
-        int result = Kravatte_WBC_Initialize(&kwiEnc, iv, 8 * strlen(iv)); // max 1600 bit key
+int xkcp_kravette_wbc_create(void **state, byte *iv) {
+        Kravatte_Instance *kwiEnc =
+            aligned_alloc(_Alignof(Kravatte_Instance), sizeof(Kravatte_Instance));
+        *state = kwiEnc;
+        if (!kwiEnc) {
+                _log(LOG_ERROR, "Cannot allocate memory\n");
+                return 1;
+        }
+
+        int result = Kravatte_WBC_Initialize(kwiEnc, iv, 8 * strlen(iv)); // max 1600 bit key
         if (result) {
                 _log(LOG_ERROR, "Kravatte_WBC_Initialize error %d\n", result);
+                return 1;
         }
+        return 0;
+}
+
+int xkcp_kravette_wbc_process(void *state, byte *in, byte *out, size_t size) {
+        Kravatte_Instance *kwiEnc = (Kravatte_Instance *)state;
+        int result;
 
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_KRAVETTE_WBC, out += BLOCK_SIZE_KRAVETTE_WBC) {
-                result = Kravatte_WBC_Encipher(&kwiEnc, in, out, 8 * BLOCK_SIZE_KRAVETTE_WBC, NULL, 0); // ignore tweakable part
+                result = Kravatte_WBC_Encipher(kwiEnc, in, out, 8 * BLOCK_SIZE_KRAVETTE_WBC, NULL, 0); // ignore tweakable part
                 if (result) {
                         _log(LOG_ERROR, "Kravatte_WBC_Encipher error %d\n", result);
                 }
         }
         return 0;
 }
+
+void xkcp_kravette_wbc_destroy(void *state) {
+        if (state) {
+                explicit_bzero(state, sizeof(Kravatte_Instance));
+                free(state);
+        }
+}
+
+const mix_hooks_t XKCP_KRAVETTE_WBC_HOOKS = {
+    &xkcp_kravette_wbc_create,
+    &xkcp_kravette_wbc_process,
+    &xkcp_kravette_wbc_destroy,
+};
+
+int xkcp_kravette_wbc_ecb(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&XKCP_KRAVETTE_WBC_HOOKS, in, out, size, iv);
+}
@@ -11,10 +11,18 @@
 #include <wolfssl/wolfcrypt/aes.h>
 #include <wolfssl/wolfcrypt/hash.h>
 #include <xkcp/KangarooTwelve.h>
+#include <xkcp/Xoodoo-times16-SnP.h>
+#include <xkcp/Xoodoo-times4-SnP.h>
+#include <xkcp/Xoodoo-times8-SnP.h>
 #include <xkcp/Xoodyak.h>
 
 #include "aesni.h"
+#include "blake2-many.h"
+#include "blake3-many.h"
 #include "config.h"
+#include "haraka.h"
+#include "isa.h"
+#include "keccak.h"
 #include "kravette-wbc.h"
 #include "log.h"
 #include "types.h"
@@ -24,33 +32,172 @@
 // Maximum size of the OpenSSL encryption batch multiple of the AES block size
 #define MAX_BATCH_SIZE 2147483520
 
-// *** SYMMETRIC CIPHER FUNCTIONS ***
+// Size of the tiles of `mix_ctx_process_xor`, so that they stay in the L1
+// cache between the mixing and the XOR
+#define MIX_XOR_TILE_SIZE (4 * 1024)
 
-// --- OpenSSL AES in ECB mode ---
-int openssl_aes_ecb(byte *in, byte *out, size_t size, byte *iv) {
-        size_t remaining_size;
-        size_t curr_size;
-        int outl;
+// *** STATEFUL MIX IMPLEMENTATIONS ***
 
-        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-        if (!ctx) {
-                _log(LOG_ERROR, "EVP_MD_CTX_create error\n");
+// Most of the implementations below are built on top of a state that does not
+// depend on the input (e.g., fetched algorithms, cipher contexts and expanded
+// keys). Their `mix_hooks_t` build it once, while their mix functions just
+// run the hooks on a single call.
+
+int mix_hooks_run(const mix_hooks_t *hooks, byte *in, byte *out, size_t size, byte *iv) {
+        void *state = NULL;
+
+        int err = (*hooks->create)(&state, iv);
+        if (!err) {
+                err = (*hooks->process)(state, in, out, size);
+        }
+        (*hooks->destroy)(state);
+        return err;
+}
+
+// --- OpenSSL cipher state ---
+
+typedef struct {
+        EVP_CIPHER *cipher;
+        EVP_CIPHER_CTX *ctx;
+        byte *iv;
+} openssl_cipher_state_t;
+
+int openssl_cipher_create(void **state, const char *algorithm, byte *key, byte *iv) {
+        openssl_cipher_state_t *st = calloc(1, sizeof(openssl_cipher_state_t));
+        *state                     = st;
+        if (!st) {
+                _log(LOG_ERROR, "Cannot allocate memory\n");
+                return 1;
         }
+        st->iv = iv;
 
-        if (!EVP_EncryptInit(ctx, EVP_aes_128_ecb(), iv, NULL)) {
+        st->cipher = EVP_CIPHER_fetch(NULL, algorithm, NULL);
+        if (!st->cipher) {
+                _log(LOG_ERROR, "EVP_CIPHER_fetch error\n");
+                return 1;
+        }
+
+        st->ctx = EVP_CIPHER_CTX_new();
+        if (!st->ctx) {
+                _log(LOG_ERROR, "EVP_CIPHER_CTX_new error\n");
+                return 1;
+        }
+
+        if (!EVP_EncryptInit(st->ctx, st->cipher, key, NULL)) {
                 _log(LOG_ERROR, "EVP_EncryptInit error\n");
+                return 1;
+        }
+
+        EVP_CIPHER_CTX_set_padding(st->ctx, 0); // disable padding
+        return 0;
+}
+
+void openssl_cipher_destroy(void *state) {
+        openssl_cipher_state_t *st = (openssl_cipher_state_t *)state;
+        if (!st) {
+                return;
+        }
+
+        EVP_CIPHER_CTX_free(st->ctx);
+        EVP_CIPHER_free(st->cipher);
+        free(st);
+}
+
+// --- wolfCrypt AES state ---
+
+typedef struct {
+        Aes aes;
+        byte *iv;
+} wolfcrypt_aes_state_t;
+
+int wolfcrypt_aes_create(void **state, byte *key, uint32_t key_size, byte *iv) {
+        int ret;
+        wolfcrypt_aes_state_t *st = aligned_alloc(_Alignof(wolfcrypt_aes_state_t),
+                                                  sizeof(wolfcrypt_aes_state_t));
+        *state = st;
+        if (!st) {
+                _log(LOG_ERROR, "Cannot allocate memory\n");
+                return 1;
+        }
+        st->iv = iv;
+
+        ret = wc_AesInit(&st->aes, NULL, INVALID_DEVID);
+        if (ret) {
+                _log(LOG_ERROR, "wc_AesInit error\n");
+                return 1;
+        }
+
+        if (key) {
+                ret = wc_AesSetKey(&st->aes, key, key_size, NULL, AES_ENCRYPTION);
+                if (ret) {
+                        _log(LOG_ERROR, "wc_AesSetKey error\n");
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+void wolfcrypt_aes_destroy(void *state) {
+        wolfcrypt_aes_state_t *st = (wolfcrypt_aes_state_t *)state;
+        if (!st) {
+                return;
         }
 
-        EVP_CIPHER_CTX_set_padding(ctx, 0); // disable padding
+        wc_AesFree(&st->aes);
+        explicit_bzero(st, sizeof(wolfcrypt_aes_state_t));
+        free(st);
+}
+
+// --- AES-NI key schedule state ---
+
+typedef struct {
+        __m128i key_schedule[AESNI_128_KEY_SCHEDULE_SIZE];
+} aesni_128_state_t;
+
+int aesni_128_create(void **state, byte *iv) {
+        aesni_128_state_t *st =
+            aligned_alloc(_Alignof(aesni_128_state_t), sizeof(aesni_128_state_t));
+        *state = st;
+        if (!st) {
+                _log(LOG_ERROR, "Cannot allocate memory\n");
+                return 1;
+        }
+
+        aes128_key_expansion(iv, st->key_schedule);
+        return 0;
+}
+
+void aesni_128_destroy(void *state) {
+        if (state) {
+                explicit_bzero(state, sizeof(aesni_128_state_t));
+                free(state);
+        }
+}
+
+// *** SYMMETRIC CIPHER FUNCTIONS ***
+
+// --- OpenSSL AES in ECB mode ---
+
+int openssl_aes_ecb_create(void **state, byte *iv) {
+        return openssl_cipher_create(state, "AES-128-ECB", iv, iv);
+}
+
+int openssl_aes_ecb_process(void *state, byte *in, byte *out, size_t size) {
+        openssl_cipher_state_t *st = (openssl_cipher_state_t *)state;
+        size_t remaining_size;
+        size_t curr_size;
+        int outl;
 
         // EVP_EncryptUpdate works up to sizes of 2^31 - 1. Bigger keys require
         // to call the function multiple times.
         remaining_size = size;
         while (remaining_size) {
                 curr_size = MIN(remaining_size, MAX_BATCH_SIZE);
-                if (!EVP_EncryptUpdate(ctx, out, &outl, in, curr_size)) {
+                if (!EVP_EncryptUpdate(st->ctx, out, &outl, in, curr_size)) {
                         _log(LOG_ERROR, "EVP_EncryptUpdate error\n");
                 }
+                in += curr_size;
+                out += curr_size;
                 remaining_size -= curr_size;
         }
 
@@ -58,37 +205,49 @@ int openssl_aes_ecb(byte *in, byte *out, size_t size, byte *iv) {
         //         _log(LOG_ERROR, "EVP_EncryptFinal_ex error\n");
         // }
 
-        EVP_CIPHER_CTX_free(ctx);
         return 0;
 }
 
+static const mix_hooks_t OPENSSL_AES_ECB_HOOKS = {
+    &openssl_aes_ecb_create,
+    &openssl_aes_ecb_process,
+    &openssl_cipher_destroy,
+};
+
+int openssl_aes_ecb(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&OPENSSL_AES_ECB_HOOKS, in, out, size, iv);
+}
+
 // --- wolfCrypt AES in ECB mode ---
-int wolfcrypt_aes_ecb(byte *in, byte *out, size_t size, byte *iv) {
-        int ret;
-        Aes aes;
 
-        ret = wc_AesInit(&aes, NULL, INVALID_DEVID);
-        if (ret) {
-                _log(LOG_ERROR, "wc_AesInit error\n");
-        }
+int wolfcrypt_aes_ecb_create(void **state, byte *iv) {
+        return wolfcrypt_aes_create(state, iv, BLOCK_SIZE_AES, iv);
+}
 
-        ret = wc_AesSetKey(&aes, iv, BLOCK_SIZE_AES, NULL, AES_ENCRYPTION);
-        if (ret) {
-                _log(LOG_ERROR, "wc_AesSetKey error\n");
-        }
+int wolfcrypt_aes_ecb_process(void *state, byte *in, byte *out, size_t size) {
+        wolfcrypt_aes_state_t *st = (wolfcrypt_aes_state_t *)state;
+        int ret;
 
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_AES, out += BLOCK_SIZE_AES) {
-                ret = wc_AesEncryptDirect(&aes, out, in);
+                ret = wc_AesEncryptDirect(&st->aes, out, in);
                 if (ret) {
                         _log(LOG_ERROR, "wc_AesEncryptDirect error\n");
                 }
         }
-
-        wc_AesFree(&aes);
         return 0;
 }
 
+static const mix_hooks_t WOLFCRYPT_AES_ECB_HOOKS = {
+    &wolfcrypt_aes_ecb_create,
+    &wolfcrypt_aes_ecb_process,
+    &wolfcrypt_aes_destroy,
+};
+
+int wolfcrypt_aes_ecb(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&WOLFCRYPT_AES_ECB_HOOKS, in, out, size, iv);
+}
+
 // NOTE: Conflicting enum naming force us to implement Kravatte-WBC and
 // Xoofff-WBC in separate files
 
@@ -96,9 +255,12 @@ int wolfcrypt_aes_ecb(byte *in, byte *out, size_t size, byte *iv) {
 
 // --- WolfSSL ---
 
-int wolfssl(byte *in, byte *out, size_t size, byte *iv) {
-        Aes aes;
-        wc_AesInit(&aes, NULL, INVALID_DEVID);
+int wolfssl_create(void **state, byte *iv) {
+        return wolfcrypt_aes_create(state, NULL, 0, iv);
+}
+
+int wolfssl_process(void *state, byte *in, byte *out, size_t size) {
+        wolfcrypt_aes_state_t *st = (wolfcrypt_aes_state_t *)state;
 
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_MIXCTR, out += BLOCK_SIZE_MIXCTR) {
@@ -108,22 +270,32 @@ int wolfssl(byte *in, byte *out, size_t size, byte *iv) {
                 if (DEBUG)
                         assert(sizeof(in) == BLOCK_SIZE_MIXCTR);
 
-                wc_AesSetKey(&aes, key, 2 * BLOCK_SIZE_AES, NULL, AES_ENCRYPTION);
+                wc_AesSetKey(&st->aes, key, 2 * BLOCK_SIZE_AES, NULL, AES_ENCRYPTION);
 
                 for (uint8_t b = 0; b < BLOCKS_PER_MACRO; b++)
-                        wc_AesEncryptDirect(&aes, out + b * BLOCK_SIZE_AES, (byte *)(in + b));
+                        wc_AesEncryptDirect(&st->aes, out + b * BLOCK_SIZE_AES, (byte *)(in + b));
         }
-
-        wc_AesFree(&aes);
         return 0;
 }
 
+static const mix_hooks_t WOLFSSL_HOOKS = {
+    &wolfssl_create,
+    &wolfssl_process,
+    &wolfcrypt_aes_destroy,
+};
+
+int wolfssl(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&WOLFSSL_HOOKS, in, out, size, iv);
+}
+
 // --- OpenSSL ---
 
-int openssl(byte *in, byte *out, size_t size, byte *iv) {
-        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-        EVP_EncryptInit(ctx, EVP_aes_256_ecb(), NULL, NULL);
-        EVP_CIPHER_CTX_set_padding(ctx, 0);
+int openssl_create(void **state, byte *iv) {
+        return openssl_cipher_create(state, "AES-256-ECB", NULL, iv);
+}
+
+int openssl_process(void *state, byte *in, byte *out, size_t size) {
+        openssl_cipher_state_t *st = (openssl_cipher_state_t *)state;
         int outl;
 
         byte *last = in + size;
@@ -134,14 +306,20 @@ int openssl(byte *in, byte *out, size_t size, byte *iv) {
                 uint128_t in[] = {data, data + 1, data + 2};
                 if (DEBUG)
                         assert(sizeof(in) == BLOCK_SIZE_MIXCTR);
-                EVP_EncryptInit(ctx, NULL, key, NULL);
-                EVP_EncryptUpdate(ctx, out, &outl, (byte *)in, BLOCK_SIZE_MIXCTR);
+                EVP_EncryptInit(st->ctx, NULL, key, NULL);
+                EVP_EncryptUpdate(st->ctx, out, &outl, (byte *)in, BLOCK_SIZE_MIXCTR);
         }
+        return 0;
+}
 
-        EVP_CIPHER_CTX_cleanup(ctx);
-        EVP_CIPHER_CTX_free(ctx);
+static const mix_hooks_t OPENSSL_HOOKS = {
+    &openssl_create,
+    &openssl_process,
+    &openssl_cipher_destroy,
+};
 
-        return 0;
+int openssl(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&OPENSSL_HOOKS, in, out, size, iv);
 }
 
 // --- AES-NI as implemented by Intel ---
@@ -180,18 +358,17 @@ int aesni_davies_meyer(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
-int aesni_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+int aesni_matyas_meyer_oseas_process(void *state, byte *in, byte *out, size_t size) {
+        aesni_128_state_t *st = (aesni_128_state_t *)state;
+
         // To support inplace execution of the function we need avoid
         // overwriting the input
         bool is_inplace = (in == out);
         byte *out_enc   = (is_inplace ? malloc(BLOCK_SIZE_AES) : out);
 
-        __m128i key_schedule[AESNI_128_KEY_SCHEDULE_SIZE];
-        aes128_key_expansion(iv, key_schedule);
-
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_AES, out += BLOCK_SIZE_AES) {
-                aes128_enc(key_schedule, in, out_enc);
+                aes128_enc(st->key_schedule, in, out_enc);
                 memxor(out, out_enc, in, BLOCK_SIZE_AES);
                 if (!is_inplace) {
                         out_enc += BLOCK_SIZE_AES;
@@ -204,111 +381,183 @@ int aesni_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
+static const mix_hooks_t AESNI_MATYAS_MEYER_OSEAS_HOOKS = {
+    &aesni_128_create,
+    &aesni_matyas_meyer_oseas_process,
+    &aesni_128_destroy,
+};
+
+int aesni_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&AESNI_MATYAS_MEYER_OSEAS_HOOKS, in, out, size, iv);
+}
+
+// --- AES-NI-based Haraka functions ---
+// Short-input hash functions made of a few AES rounds with fixed round
+// constants, trading security margin for throughput
+
+int aesni_haraka256_hash(byte *in, byte *out, size_t size, byte *iv) {
+        haraka256_many(in, out, size);
+        return 0;
+}
+
+int aesni_haraka512_hash(byte *in, byte *out, size_t size, byte *iv) {
+        haraka512_many(in, out, size);
+        return 0;
+}
+
 // --- OpenSSL hash functions ---
 
-int generic_openssl_hash(const EVP_MD *digest, block_size_t block_size, byte *in, byte *out,
-                         size_t size, bool is_xof) {
+typedef struct {
+        EVP_MD *digest;
         EVP_MD_CTX *mdctx;
-        if ((mdctx = EVP_MD_CTX_create()) == NULL) {
+        block_size_t block_size;
+        bool is_xof;
+} openssl_hash_state_t;
+
+int openssl_hash_create(void **state, const char *algorithm, block_size_t block_size,
+                        bool is_xof) {
+        openssl_hash_state_t *st = calloc(1, sizeof(openssl_hash_state_t));
+        *state                   = st;
+        if (!st) {
+                _log(LOG_ERROR, "Cannot allocate memory\n");
+                return 1;
+        }
+        st->block_size = block_size;
+        st->is_xof     = is_xof;
+
+        st->digest = EVP_MD_fetch(NULL, algorithm, NULL);
+        if (!st->digest) {
+                _log(LOG_ERROR, "EVP_MD_fetch error\n");
+                return 1;
+        }
+
+        if ((st->mdctx = EVP_MD_CTX_create()) == NULL) {
                 _log(LOG_ERROR, "EVP_MD_CTX_create error\n");
+                return 1;
         }
-        if (!EVP_DigestInit_ex(mdctx, digest, NULL)) {
+        if (!EVP_DigestInit_ex(st->mdctx, st->digest, NULL)) {
                 _log(LOG_ERROR, "EVP_DigestInit_ex error\n");
+                return 1;
         }
+        return 0;
+}
+
+int openssl_hash_process(void *state, byte *in, byte *out, size_t size) {
+        openssl_hash_state_t *st = (openssl_hash_state_t *)state;
+        block_size_t block_size  = st->block_size;
 
         byte *last = in + size;
         for (; in < last; in += block_size, out += block_size) {
-                if (!EVP_DigestInit_ex(mdctx, NULL, NULL)) {
+                if (!EVP_DigestInit_ex(st->mdctx, NULL, NULL)) {
                         _log(LOG_ERROR, "EVP_DigestInit_ex error\n");
                 }
-                if (!EVP_DigestUpdate(mdctx, in, block_size)) {
+                if (!EVP_DigestUpdate(st->mdctx, in, block_size)) {
                         _log(LOG_ERROR, "EVP_DigestUpdate error\n");
                 }
-                if (is_xof) {
-                        if (!EVP_DigestFinalXOF(mdctx, out, block_size)) {
+                if (st->is_xof) {
+                        if (!EVP_DigestFinalXOF(st->mdctx, out, block_size)) {
                                 _log(LOG_ERROR, "EVP_DigestFinalXOF error\n");
                         }
                 } else {
-                        if (!EVP_DigestFinal_ex(mdctx, out, NULL)) {
+                        if (!EVP_DigestFinal_ex(st->mdctx, out, NULL)) {
                                 _log(LOG_ERROR, "EVP_DigestFinal_ex error\n");
                         }
                 }
         }
-
-        EVP_MD_CTX_free(mdctx);
         return 0;
 }
 
-int openssl_sha3_256_hash(byte *in, byte *out, size_t size, byte *iv) {
-        const EVP_MD *digest = EVP_sha3_256();
-        int err = generic_openssl_hash(digest, BLOCK_SIZE_SHA3_256, in, out, size, false);
-        return err;
-}
+void openssl_hash_destroy(void *state) {
+        openssl_hash_state_t *st = (openssl_hash_state_t *)state;
+        if (!st) {
+                return;
+        }
 
-int openssl_sha3_512_hash(byte *in, byte *out, size_t size, byte *iv) {
-        const EVP_MD *digest = EVP_sha3_512();
-        int err = generic_openssl_hash(digest, BLOCK_SIZE_SHA3_512, in, out, size, false);
-        return err;
+        EVP_MD_CTX_free(st->mdctx);
+        EVP_MD_free(st->digest);
+        free(st);
 }
 
-int openssl_shake128_hash(byte *in, byte *out, size_t size, byte *iv) {
-        const EVP_MD *digest = EVP_shake128();
-        int err = generic_openssl_hash(digest, BLOCK_SIZE_SHAKE128, in, out, size, true);
+#define OPENSSL_HASH(name, NAME, algorithm, block_size, is_xof)                                    \
+        int openssl_##name##_create(void **state, byte *iv) {                                      \
+                return openssl_hash_create(state, algorithm, block_size, is_xof);                  \
+        }                                                                                          \
+                                                                                                   \
+        static const mix_hooks_t OPENSSL_##NAME##_HOOKS = {                                        \
+            &openssl_##name##_create,                                                              \
+            &openssl_hash_process,                                                                 \
+            &openssl_hash_destroy,                                                                 \
+        };                                                                                         \
+                                                                                                   \
+        int openssl_##name##_hash(byte *in, byte *out, size_t size, byte *iv) {                    \
+                return mix_hooks_run(&OPENSSL_##NAME##_HOOKS, in, out, size, iv);                  \
+        }
+
+OPENSSL_HASH(sha3_256, SHA3_256, "SHA3-256", BLOCK_SIZE_SHA3_256, false)
+OPENSSL_HASH(sha3_512, SHA3_512, "SHA3-512", BLOCK_SIZE_SHA3_512, false)
+OPENSSL_HASH(shake128, SHAKE128, "SHAKE128", BLOCK_SIZE_SHAKE128, true)
+OPENSSL_HASH(shake256, SHAKE256, "SHAKE256", BLOCK_SIZE_SHAKE256, true)
+OPENSSL_HASH(blake2s, BLAKE2S, "BLAKE2S-256", BLOCK_SIZE_BLAKE2S, false)
+OPENSSL_HASH(blake2b, BLAKE2B, "BLAKE2B-512", BLOCK_SIZE_BLAKE2B, false)
+
+#undef OPENSSL_HASH
+
+int openssl_generic_xof(const char *algorithm, byte *in, byte *out, size_t size,
+                        block_size_t block_size) {
+        void *state;
+        int err = openssl_hash_create(&state, algorithm, block_size, true);
+        if (!err) {
+                err = openssl_hash_process(state, in, out, size);
+        }
+        openssl_hash_destroy(state);
         return err;
 }
 
-int openssl_shake256_hash(byte *in, byte *out, size_t size, byte *iv) {
-        const EVP_MD *digest = EVP_shake256();
-        int err = generic_openssl_hash(digest, BLOCK_SIZE_SHAKE256, in, out, size, true);
-        return err;
+int openssl_shake128_xof(byte *in, byte *out, size_t size, block_size_t block_size, byte *iv) {
+        return openssl_generic_xof("SHAKE128", in, out, size, block_size);
 }
 
-int openssl_blake2s_hash(byte *in, byte *out, size_t size, byte *iv) {
-        const EVP_MD *digest = EVP_blake2s256();
-        int err = generic_openssl_hash(digest, BLOCK_SIZE_BLAKE2S, in, out, size, false);
-        return err;
+int openssl_shake256_xof(byte *in, byte *out, size_t size, block_size_t block_size, byte *iv) {
+        return openssl_generic_xof("SHAKE256", in, out, size, block_size);
 }
 
-int openssl_blake2b_hash(byte *in, byte *out, size_t size, byte *iv) {
-        const EVP_MD *digest = EVP_blake2b512();
-        int err = generic_openssl_hash(digest, BLOCK_SIZE_BLAKE2B, in, out, size, false);
-        return err;
+int openssl_davies_meyer_create(void **state, byte *iv) {
+        return openssl_cipher_create(state, "AES-128-ECB", NULL, iv);
 }
 
-int openssl_davies_meyer(byte *in, byte *out, size_t size, byte *iv) {
+int openssl_davies_meyer_process(void *state, byte *in, byte *out, size_t size) {
+        openssl_cipher_state_t *st = (openssl_cipher_state_t *)state;
         int outl;
 
-        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-        if (!ctx) {
-                _log(LOG_ERROR, "EVP_MD_CTX_create error\n");
-        }
-
-        if (!EVP_EncryptInit(ctx, EVP_aes_128_ecb(), NULL, NULL)) {
-                _log(LOG_ERROR, "EVP_EncryptInit error\n");
-        }
-
-        EVP_CIPHER_CTX_set_padding(ctx, 0); // disable padding
-
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_AES, out += BLOCK_SIZE_AES) {
-                if (!EVP_EncryptInit(ctx, NULL, in, NULL)) {
+                if (!EVP_EncryptInit(st->ctx, NULL, in, NULL)) {
                         _log(LOG_ERROR, "EVP_EncryptInit error\n");
                 }
-                if (!EVP_EncryptUpdate(ctx, out, &outl, iv, BLOCK_SIZE_AES)) {
+                if (!EVP_EncryptUpdate(st->ctx, out, &outl, st->iv, BLOCK_SIZE_AES)) {
                         _log(LOG_ERROR, "EVP_EncryptUpdate error\n");
                 }
-                memxor(out, out, iv, BLOCK_SIZE_AES);
+                memxor(out, out, st->iv, BLOCK_SIZE_AES);
         }
 
         // if (!EVP_EncryptFinal(ctx, out, &outl)) {
         //         _log(LOG_ERROR, "EVP_EncryptFinal_ex error\n");
         // }
 
-        EVP_CIPHER_CTX_free(ctx);
         return 0;
 }
 
-int openssl_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+static const mix_hooks_t OPENSSL_DAVIES_MEYER_HOOKS = {
+    &openssl_davies_meyer_create,
+    &openssl_davies_meyer_process,
+    &openssl_cipher_destroy,
+};
+
+int openssl_davies_meyer(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&OPENSSL_DAVIES_MEYER_HOOKS, in, out, size, iv);
+}
+
+int openssl_matyas_meyer_oseas_process(void *state, byte *in, byte *out, size_t size) {
         // To support inplace execution of the function we need avoid
         // overwriting the input
         // NOTE: To achieve higher time/speed performance, here we create a
@@ -316,7 +565,7 @@ int openssl_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
         // constraint, we suggest using the other implementation of Matyas
         // Meyer Oseas
         unsigned char *out_enc = (in == out ? malloc(size) : out);
-        openssl_aes_ecb(in, out_enc, size, iv);
+        openssl_aes_ecb_process(state, in, out_enc, size);
         memxor(out, out_enc, in, size);
         if (in == out) {
                 free(out_enc);
@@ -324,7 +573,18 @@ int openssl_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
-int openssl_new_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+static const mix_hooks_t OPENSSL_MATYAS_MEYER_OSEAS_HOOKS = {
+    &openssl_aes_ecb_create,
+    &openssl_matyas_meyer_oseas_process,
+    &openssl_cipher_destroy,
+};
+
+int openssl_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&OPENSSL_MATYAS_MEYER_OSEAS_HOOKS, in, out, size, iv);
+}
+
+int openssl_new_matyas_meyer_oseas_process(void *state, byte *in, byte *out, size_t size) {
+        openssl_cipher_state_t *st = (openssl_cipher_state_t *)state;
         int outl;
 
         // To support inplace execution of the function we need avoid
@@ -332,20 +592,9 @@ int openssl_new_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
         bool is_inplace = (in == out);
         byte *out_enc   = (is_inplace ? malloc(BLOCK_SIZE_AES) : out);
 
-        EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-        if (!ctx) {
-                _log(LOG_ERROR, "EVP_MD_CTX_create error\n");
-        }
-
-        if (!EVP_EncryptInit(ctx, EVP_aes_128_ecb(), iv, NULL)) {
-                _log(LOG_ERROR, "EVP_EncryptInit error\n");
-        }
-
-        EVP_CIPHER_CTX_set_padding(ctx, 0); // disable padding
-
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_AES, out += BLOCK_SIZE_AES) {
-                if (!EVP_EncryptUpdate(ctx, out_enc, &outl, in, BLOCK_SIZE_AES)) {
+                if (!EVP_EncryptUpdate(st->ctx, out_enc, &outl, in, BLOCK_SIZE_AES)) {
                         _log(LOG_ERROR, "EVP_EncryptUpdate error\n");
                 }
                 memxor(out, out_enc, in, BLOCK_SIZE_AES);
@@ -359,13 +608,22 @@ int openssl_new_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
         //         _log(LOG_ERROR, "EVP_EncryptFinal_ex error\n");
         // }
 
-        EVP_CIPHER_CTX_free(ctx);
         if (is_inplace) {
                 free(out_enc);
         }
         return 0;
 }
 
+static const mix_hooks_t OPENSSL_NEW_MATYAS_MEYER_OSEAS_HOOKS = {
+    &openssl_aes_ecb_create,
+    &openssl_new_matyas_meyer_oseas_process,
+    &openssl_cipher_destroy,
+};
+
+int openssl_new_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&OPENSSL_NEW_MATYAS_MEYER_OSEAS_HOOKS, in, out, size, iv);
+}
+
 // --- wolfCrypt hash functions ---
 
 int generic_wolfcrypt_hash(enum wc_HashType hash_type, block_size_t block_size, byte *in, byte *out,
@@ -388,19 +646,20 @@ int wolfcrypt_sha3_512_hash(byte *in, byte *out, size_t size, byte *iv) {
         return generic_wolfcrypt_hash(WC_HASH_TYPE_SHA3_512, BLOCK_SIZE_SHA3_512, in, out, size);
 }
 
-int wolfcrypt_shake128_hash(byte *in, byte *out, size_t size, byte *iv) {
+int wolfcrypt_shake128_xof(byte *in, byte *out, size_t size, block_size_t block_size,
+                          byte *iv) {
         wc_Shake shake;
         int ret = wc_InitShake128(&shake, NULL, INVALID_DEVID);
         if (ret) {
                 _log(LOG_ERROR, "wc_InitShake128 error %d\n", ret);
         }
         byte *last = in + size;
-        for (; in < last; in += BLOCK_SIZE_SHAKE128, out += BLOCK_SIZE_SHAKE128) {
-                int ret = wc_Shake128_Update(&shake, in, BLOCK_SIZE_SHAKE128);
+        for (; in < last; in += block_size, out += block_size) {
+                int ret = wc_Shake128_Update(&shake, in, block_size);
                 if (ret) {
                         _log(LOG_ERROR, "wc_Shake128_Update error %d\n", ret);
                 }
-                ret = wc_Shake128_Final(&shake, out, BLOCK_SIZE_SHAKE128);
+                ret = wc_Shake128_Final(&shake, out, block_size);
                 if (ret) {
                         _log(LOG_ERROR, "wc_Shake128_Final error %d\n", ret);
                 }
@@ -408,19 +667,24 @@ int wolfcrypt_shake128_hash(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
-int wolfcrypt_shake256_hash(byte *in, byte *out, size_t size, byte *iv) {
+int wolfcrypt_shake128_hash(byte *in, byte *out, size_t size, byte *iv) {
+        return wolfcrypt_shake128_xof(in, out, size, BLOCK_SIZE_SHAKE128, iv);
+}
+
+int wolfcrypt_shake256_xof(byte *in, byte *out, size_t size, block_size_t block_size,
+                          byte *iv) {
         wc_Shake shake;
         int ret = wc_InitShake256(&shake, NULL, INVALID_DEVID);
         if (ret) {
                 _log(LOG_ERROR, "wc_InitShake256 error %d\n", ret);
         }
         byte *last = in + size;
-        for (; in < last; in += BLOCK_SIZE_SHAKE256, out += BLOCK_SIZE_SHAKE256) {
-                int ret = wc_Shake256_Update(&shake, in, BLOCK_SIZE_SHAKE256);
+        for (; in < last; in += block_size, out += block_size) {
+                int ret = wc_Shake256_Update(&shake, in, block_size);
                 if (ret) {
                         _log(LOG_ERROR, "wc_Shake256_Update error %d\n", ret);
                 }
-                ret = wc_Shake256_Final(&shake, out, BLOCK_SIZE_SHAKE256);
+                ret = wc_Shake256_Final(&shake, out, block_size);
                 if (ret) {
                         _log(LOG_ERROR, "wc_Shake256_Final error %d\n", ret);
                 }
@@ -428,6 +692,10 @@ int wolfcrypt_shake256_hash(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
+int wolfcrypt_shake256_hash(byte *in, byte *out, size_t size, byte *iv) {
+        return wolfcrypt_shake256_xof(in, out, size, BLOCK_SIZE_SHAKE256, iv);
+}
+
 int wolfcrypt_blake2s_hash(byte *in, byte *out, size_t size, byte *iv) {
         int ret;
         Blake2s b2s;
@@ -470,53 +738,52 @@ int wolfcrypt_blake2b_hash(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
-int wolfcrypt_davies_meyer(byte *in, byte *out, size_t size, byte *iv) {
-        int ret;
-        Aes aes;
 
-        ret = wc_AesInit(&aes, NULL, INVALID_DEVID);
-        if (ret) {
-                _log(LOG_ERROR, "wc_AesInit error\n");
-        }
+int wolfcrypt_davies_meyer_create(void **state, byte *iv) {
+        return wolfcrypt_aes_create(state, NULL, 0, iv);
+}
+
+int wolfcrypt_davies_meyer_process(void *state, byte *in, byte *out, size_t size) {
+        wolfcrypt_aes_state_t *st = (wolfcrypt_aes_state_t *)state;
+        int ret;
 
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_AES, out += BLOCK_SIZE_AES) {
-                ret = wc_AesSetKey(&aes, in, BLOCK_SIZE_AES, NULL, AES_ENCRYPTION);
+                ret = wc_AesSetKey(&st->aes, in, BLOCK_SIZE_AES, NULL, AES_ENCRYPTION);
                 if (ret) {
                         _log(LOG_ERROR, "wc_AesSetKey error\n");
                 }
-                ret = wc_AesEncryptDirect(&aes, out, iv);
+                ret = wc_AesEncryptDirect(&st->aes, out, st->iv);
                 if (ret) {
                         _log(LOG_ERROR, "wc_AesEncryptDirect error\n");
                 }
-                memxor(out, out, iv, BLOCK_SIZE_AES);
+                memxor(out, out, st->iv, BLOCK_SIZE_AES);
         }
-
-        wc_AesFree(&aes);
         return 0;
 }
 
-int wolfcrypt_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+static const mix_hooks_t WOLFCRYPT_DAVIES_MEYER_HOOKS = {
+    &wolfcrypt_davies_meyer_create,
+    &wolfcrypt_davies_meyer_process,
+    &wolfcrypt_aes_destroy,
+};
+
+int wolfcrypt_davies_meyer(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&WOLFCRYPT_DAVIES_MEYER_HOOKS, in, out, size, iv);
+}
+
+int wolfcrypt_matyas_meyer_oseas_process(void *state, byte *in, byte *out, size_t size) {
+        wolfcrypt_aes_state_t *st = (wolfcrypt_aes_state_t *)state;
         int ret;
-        Aes aes;
+
         // To support inplace execution of the function we need avoid
         // overwriting the input
         bool is_inplace = (in == out);
         byte *out_enc   = (is_inplace ? malloc(BLOCK_SIZE_AES) : out);
 
-        ret = wc_AesInit(&aes, NULL, INVALID_DEVID);
-        if (ret) {
-                _log(LOG_ERROR, "wc_AesInit error\n");
-        }
-
-        ret = wc_AesSetKey(&aes, iv, BLOCK_SIZE_AES, NULL, AES_ENCRYPTION);
-        if (ret) {
-                _log(LOG_ERROR, "wc_AesSetKey error\n");
-        }
-
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_AES, out += BLOCK_SIZE_AES) {
-                ret = wc_AesEncryptDirect(&aes, out_enc, in);
+                ret = wc_AesEncryptDirect(&st->aes, out_enc, in);
                 if (ret) {
                         _log(LOG_ERROR, "wc_AesEncryptDirect error\n");
                 }
@@ -527,13 +794,66 @@ int wolfcrypt_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
                 }
         }
 
-        wc_AesFree(&aes);
         if (is_inplace) {
                 free(out_enc);
         }
         return 0;
 }
 
+static const mix_hooks_t WOLFCRYPT_MATYAS_MEYER_OSEAS_HOOKS = {
+    &wolfcrypt_aes_ecb_create,
+    &wolfcrypt_matyas_meyer_oseas_process,
+    &wolfcrypt_aes_destroy,
+};
+
+int wolfcrypt_matyas_meyer_oseas(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&WOLFCRYPT_MATYAS_MEYER_OSEAS_HOOKS, in, out, size, iv);
+}
+
+// --- Single-block Keccak hash functions ---
+
+int keccak_sha3_256_hash(byte *in, byte *out, size_t size, byte *iv) {
+        sha3_256_single_block(in, out, size);
+        return 0;
+}
+
+int keccak_sha3_512_hash(byte *in, byte *out, size_t size, byte *iv) {
+        sha3_512_single_block(in, out, size);
+        return 0;
+}
+
+int keccak_shake256_hash(byte *in, byte *out, size_t size, byte *iv) {
+        shake256_single_block(in, out, size);
+        return 0;
+}
+
+int keccak_shake128_hash(byte *in, byte *out, size_t size, byte *iv) {
+        shake128_single_block(in, out, size);
+        return 0;
+}
+
+int keccak_shake256_xof(byte *in, byte *out, size_t size, block_size_t block_size, byte *iv) {
+        shake256_multi_block(in, out, size, block_size);
+        return 0;
+}
+
+int keccak_shake128_xof(byte *in, byte *out, size_t size, block_size_t block_size, byte *iv) {
+        shake128_multi_block(in, out, size, block_size);
+        return 0;
+}
+
+// --- Multi-buffer SIMD hash functions ---
+
+int simd_blake2s_hash(byte *in, byte *out, size_t size, byte *iv) {
+        blake2s_hash_many_32(in, out, size);
+        return 0;
+}
+
+int simd_blake2b_hash(byte *in, byte *out, size_t size, byte *iv) {
+        blake2b_hash_many_64(in, out, size);
+        return 0;
+}
+
 // --- XKCP hash functions ---
 
 // Keccak-p[1600, 12]: Keccak 1600-bit permutations and 12 rounds
@@ -561,11 +881,19 @@ int xkcp_turboshake256_hash(byte *in, byte *out, size_t size, byte *iv) {
         return xkcp_generic_turboshake_hash(512, BLOCK_SIZE_TURBOSHAKE256, in, out, size);
 }
 
-int xkcp_kangarootwelve_hash(byte *in, byte *out, size_t size, byte *iv) {
+int xkcp_turboshake128_xof(byte *in, byte *out, size_t size, block_size_t block_size, byte *iv) {
+        return xkcp_generic_turboshake_hash(256, block_size, in, out, size);
+}
+
+int xkcp_turboshake256_xof(byte *in, byte *out, size_t size, block_size_t block_size, byte *iv) {
+        return xkcp_generic_turboshake_hash(512, block_size, in, out, size);
+}
+
+int xkcp_kangarootwelve_xof(byte *in, byte *out, size_t size, block_size_t block_size,
+                            byte *iv) {
         byte *last = in + size;
-        for (; in < last; in += BLOCK_SIZE_KANGAROOTWELVE, out += BLOCK_SIZE_KANGAROOTWELVE) {
-                int result = KangarooTwelve(in, BLOCK_SIZE_KANGAROOTWELVE, out,
-                                            BLOCK_SIZE_KANGAROOTWELVE, NULL, 0);
+        for (; in < last; in += block_size, out += block_size) {
+                int result = KangarooTwelve(in, block_size, out, block_size, NULL, 0);
                 if (result) {
                         _log(LOG_ERROR, "KangarooTwelve error %d\n", result);
                 }
@@ -573,6 +901,10 @@ int xkcp_kangarootwelve_hash(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
+int xkcp_kangarootwelve_hash(byte *in, byte *out, size_t size, byte *iv) {
+        return xkcp_kangarootwelve_xof(in, out, size, BLOCK_SIZE_KANGAROOTWELVE, iv);
+}
+
 // Xoodoo[12]: Xoodoo 384-bit permutations and 12 rounds
 
 int xkcp_xoodyak_hash(byte *in, byte *out, size_t size, byte *iv) {
@@ -587,6 +919,88 @@ int xkcp_xoodyak_hash(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
+// Xoodyak in hash mode absorbs and squeezes 16 bytes at a time, so a 48-byte
+// block costs 6 permutations. The following implementations replay the same
+// Cyclist sequence on many independent blocks at once using the parallel
+// Xoodoo permutations of XKCP. Blocks that do not fill a whole batch fall back
+// to the sequential implementation, so the output is always equivalent to
+// `xkcp_xoodyak_hash`.
+
+#define XOODOO_STATE_LANES 12
+#define XOODYAK_RATE 16
+#define XOODYAK_LANE_SIZE 4
+#define XOODYAK_RATE_LANES (XOODYAK_RATE / XOODYAK_LANE_SIZE)
+// Distance in lanes between the blocks of consecutive instances
+#define XOODYAK_BLOCK_LANES (BLOCK_SIZE_XOODYAK / XOODYAK_LANE_SIZE)
+// Absorb and squeeze calls needed by a block
+#define XOODYAK_BLOCK_RATES (BLOCK_SIZE_XOODYAK / XOODYAK_RATE)
+
+_Static_assert(XOODYAK_BLOCK_RATES * XOODYAK_RATE == BLOCK_SIZE_XOODYAK,
+               "A Xoodyak block must be made of whole rates");
+_Static_assert(XOODYAK_RATE_LANES < XOODOO_STATE_LANES,
+               "The Xoodyak rate and its padding must fit in the Xoodoo state");
+
+// Padding of the Down calls: 0x01 right after the 16-byte rate, and the Cd
+// byte (0x03 & 0x01 in hash mode) at the end of the state for the 1st one
+static const uint32_t XOODYAK_PAD_FIRST[XOODOO_STATE_LANES] = {0, 0, 0, 0, 0x01, 0, 0,
+                                                               0, 0, 0, 0, 0x01000000};
+static const uint32_t XOODYAK_PAD[XOODOO_STATE_LANES] = {0, 0, 0, 0, 0x01};
+// Padding of the Down calls on an empty input while squeezing
+static const uint32_t XOODYAK_PAD_EMPTY[XOODOO_STATE_LANES] = {0x01};
+
+#define XKCP_XOODYAK_TIMES(N)                                                                      \
+        int xkcp_xoodyak_times##N##_hash(byte *in, byte *out, size_t size, byte *iv) {             \
+                Xoodootimes##N##_states states;                                                    \
+                uint32_t pad_first[N][XOODOO_STATE_LANES];                                         \
+                uint32_t pad[N][XOODOO_STATE_LANES];                                               \
+                uint32_t pad_empty[N][XOODOO_STATE_LANES];                                         \
+                size_t batch_size = N * BLOCK_SIZE_XOODYAK;                                        \
+                                                                                                   \
+                for (uint8_t i = 0; i < N; i++) {                                                  \
+                        memcpy(pad_first[i], XOODYAK_PAD_FIRST, sizeof(XOODYAK_PAD_FIRST));        \
+                        memcpy(pad[i], XOODYAK_PAD, sizeof(XOODYAK_PAD));                          \
+                        memcpy(pad_empty[i], XOODYAK_PAD_EMPTY, sizeof(XOODYAK_PAD_EMPTY));        \
+                }                                                                                  \
+                                                                                                   \
+                byte *last = in + size - size % batch_size;                                        \
+                for (; in < last; in += batch_size, out += batch_size) {                           \
+                        Xoodootimes##N##_InitializeAll(&states);                                   \
+                                                                                                   \
+                        /* Absorb (the whole input is read before any output                       \
+                         * is written, so inplace execution is supported) */                       \
+                        for (uint8_t r = 0; r < XOODYAK_BLOCK_RATES; r++) {                        \
+                                if (r)                                                             \
+                                        Xoodootimes##N##_PermuteAll_12rounds(&states);             \
+                                Xoodootimes##N##_AddLanesAll(&states, in + r * XOODYAK_RATE,       \
+                                                             XOODYAK_RATE_LANES,                   \
+                                                             XOODYAK_BLOCK_LANES);                 \
+                                Xoodootimes##N##_AddLanesAll(                                      \
+                                    &states, (byte *)(r ? pad : pad_first), XOODOO_STATE_LANES,    \
+                                    XOODOO_STATE_LANES);                                           \
+                        }                                                                          \
+                                                                                                   \
+                        /* Squeeze */                                                              \
+                        for (uint8_t r = 0; r < XOODYAK_BLOCK_RATES; r++) {                        \
+                                if (r)                                                             \
+                                        Xoodootimes##N##_AddLanesAll(&states, (byte *)pad_empty,   \
+                                                                     XOODOO_STATE_LANES,           \
+                                                                     XOODOO_STATE_LANES);          \
+                                Xoodootimes##N##_PermuteAll_12rounds(&states);                     \
+                                Xoodootimes##N##_ExtractLanesAll(&states, out + r * XOODYAK_RATE,  \
+                                                                 XOODYAK_RATE_LANES,               \
+                                                                 XOODYAK_BLOCK_LANES);             \
+                        }                                                                          \
+                }                                                                                  \
+                                                                                                   \
+                return xkcp_xoodyak_hash(in, out, size % batch_size, iv);                          \
+        }
+
+XKCP_XOODYAK_TIMES(4)
+XKCP_XOODYAK_TIMES(8)
+XKCP_XOODYAK_TIMES(16)
+
+#undef XKCP_XOODYAK_TIMES
+
 // --- BLAKE3 hash function ---
 
 int blake3_blake3_hash(byte *in, byte *out, size_t size, byte *iv) {
@@ -602,57 +1016,122 @@ int blake3_blake3_hash(byte *in, byte *out, size_t size, byte *iv) {
         return 0;
 }
 
+int blake3_blake3_many_hash(byte *in, byte *out, size_t size, byte *iv) {
+        blake3_hash_many_32(in, out, size);
+        return 0;
+}
+
 // *** COMPLETE LIST OF MIX FUNCTIONS ***
 
 mix_info_t MIX_FUNCTIONS[] = {
-    // name, function, primitive, block size, one-way flag, iv support
+    // name, function, primitive, block size, one-way flag, hooks, xof function
     {"none", NULL, MIX_NONE, 0, true},
-    {"openssl-aes-128", &openssl_aes_ecb, MIX_AES, BLOCK_SIZE_AES, false},
-    {"openssl-davies-meyer", &openssl_davies_meyer, MIX_DAVIES_MEYER, BLOCK_SIZE_AES, true},
+    {"openssl-aes-128", &openssl_aes_ecb, MIX_AES, BLOCK_SIZE_AES, false, &OPENSSL_AES_ECB_HOOKS},
+    {"openssl-davies-meyer", &openssl_davies_meyer, MIX_DAVIES_MEYER, BLOCK_SIZE_AES, true,
+     &OPENSSL_DAVIES_MEYER_HOOKS},
     {"openssl-matyas-meyer-oseas", &openssl_matyas_meyer_oseas, MIX_MATYAS_MEYER_OSEAS,
-     BLOCK_SIZE_AES, true},
+     BLOCK_SIZE_AES, true, &OPENSSL_MATYAS_MEYER_OSEAS_HOOKS},
     {"openssl-new-matyas-meyer-oseas", &openssl_new_matyas_meyer_oseas, MIX_MATYAS_MEYER_OSEAS,
-     BLOCK_SIZE_AES, true},
-    {"wolfcrypt-aes-128", &wolfcrypt_aes_ecb, MIX_AES, BLOCK_SIZE_AES, false},
-    {"wolfcrypt-davies-meyer", &wolfcrypt_davies_meyer, MIX_DAVIES_MEYER, BLOCK_SIZE_AES, true},
+     BLOCK_SIZE_AES, true, &OPENSSL_NEW_MATYAS_MEYER_OSEAS_HOOKS},
+    {"wolfcrypt-aes-128", &wolfcrypt_aes_ecb, MIX_AES, BLOCK_SIZE_AES, false,
+     &WOLFCRYPT_AES_ECB_HOOKS},
+    {"wolfcrypt-davies-meyer", &wolfcrypt_davies_meyer, MIX_DAVIES_MEYER, BLOCK_SIZE_AES, true,
+     &WOLFCRYPT_DAVIES_MEYER_HOOKS},
     {"wolfcrypt-matyas-meyer-oseas", &wolfcrypt_matyas_meyer_oseas, MIX_MATYAS_MEYER_OSEAS,
-     BLOCK_SIZE_AES, true},
+     BLOCK_SIZE_AES, true, &WOLFCRYPT_MATYAS_MEYER_OSEAS_HOOKS},
     {"aesni-davies-meyer", &aesni_davies_meyer, MIX_DAVIES_MEYER, BLOCK_SIZE_AES, true},
-    {"aesni-matyas-meyer-oseas", &aesni_matyas_meyer_oseas, MIX_MATYAS_MEYER_OSEAS, BLOCK_SIZE_AES, true},
-    {"openssl-sha3-256", &openssl_sha3_256_hash, MIX_SHA3_256, BLOCK_SIZE_SHA3_256, true},
-    {"openssl-blake2s", &openssl_blake2s_hash, MIX_BLAKE2S, BLOCK_SIZE_BLAKE2S, true},
+    {"aesni-matyas-meyer-oseas", &aesni_matyas_meyer_oseas, MIX_MATYAS_MEYER_OSEAS, BLOCK_SIZE_AES,
+     true, &AESNI_MATYAS_MEYER_OSEAS_HOOKS},
+    {"openssl-sha3-256", &openssl_sha3_256_hash, MIX_SHA3_256, BLOCK_SIZE_SHA3_256, true,
+     &OPENSSL_SHA3_256_HOOKS},
+    {"openssl-blake2s", &openssl_blake2s_hash, MIX_BLAKE2S, BLOCK_SIZE_BLAKE2S, true,
+     &OPENSSL_BLAKE2S_HOOKS},
     {"wolfcrypt-sha3-256", &wolfcrypt_sha3_256_hash, MIX_SHA3_256, BLOCK_SIZE_SHA3_256, true},
+    {"keccak-sha3-256", &keccak_sha3_256_hash, MIX_SHA3_256, BLOCK_SIZE_SHA3_256, true},
     {"wolfcrypt-blake2s", &wolfcrypt_blake2s_hash, MIX_BLAKE2S, BLOCK_SIZE_BLAKE2S, true},
+    {"simd-blake2s", &simd_blake2s_hash, MIX_BLAKE2S, BLOCK_SIZE_BLAKE2S, true},
     {"blake3-blake3", &blake3_blake3_hash, MIX_BLAKE3, BLOCK_SIZE_BLAKE3, true},
+    {"blake3-blake3-many", &blake3_blake3_many_hash, MIX_BLAKE3, BLOCK_SIZE_BLAKE3, true},
+    {"aesni-haraka-256", &aesni_haraka256_hash, MIX_HARAKA_256, BLOCK_SIZE_HARAKA_256, true},
     {"aes-ni-mixctr", &aesni, MIX_MIXCTR, BLOCK_SIZE_MIXCTR, true},
-    {"openssl-mixctr", &openssl, MIX_MIXCTR, BLOCK_SIZE_MIXCTR, true},
-    {"wolfcrypt-mixctr", &wolfssl, MIX_MIXCTR, BLOCK_SIZE_MIXCTR, true},
-    {"openssl-sha3-512", &openssl_sha3_512_hash, MIX_SHA3_512, BLOCK_SIZE_SHA3_512, true},
-    {"openssl-blake2b", &openssl_blake2b_hash, MIX_BLAKE2B, BLOCK_SIZE_BLAKE2B, true},
+    {"openssl-mixctr", &openssl, MIX_MIXCTR, BLOCK_SIZE_MIXCTR, true, &OPENSSL_HOOKS},
+    {"wolfcrypt-mixctr", &wolfssl, MIX_MIXCTR, BLOCK_SIZE_MIXCTR, true, &WOLFSSL_HOOKS},
+    {"openssl-sha3-512", &openssl_sha3_512_hash, MIX_SHA3_512, BLOCK_SIZE_SHA3_512, true,
+     &OPENSSL_SHA3_512_HOOKS},
+    {"openssl-blake2b", &openssl_blake2b_hash, MIX_BLAKE2B, BLOCK_SIZE_BLAKE2B, true,
+     &OPENSSL_BLAKE2B_HOOKS},
     {"wolfcrypt-sha3-512", &wolfcrypt_sha3_512_hash, MIX_SHA3_512, BLOCK_SIZE_SHA3_512, true},
+    {"keccak-sha3-512", &keccak_sha3_512_hash, MIX_SHA3_512, BLOCK_SIZE_SHA3_512, true},
     {"wolfcrypt-blake2b", &wolfcrypt_blake2b_hash, MIX_BLAKE2B, BLOCK_SIZE_BLAKE2B, true},
+    {"simd-blake2b", &simd_blake2b_hash, MIX_BLAKE2B, BLOCK_SIZE_BLAKE2B, true},
+    {"aesni-haraka-512", &aesni_haraka512_hash, MIX_HARAKA_512, BLOCK_SIZE_HARAKA_512, true},
     {"xkcp-xoodyak", &xkcp_xoodyak_hash, MIX_XOODYAK, BLOCK_SIZE_XOODYAK, true},
-    {"xkcp-xoofff-wbc", &xkcp_xoofff_wbc_ecb, MIX_XOOFFF_WBC, BLOCK_SIZE_XOOFFF_WBC, false},
-    {"openssl-shake256", &openssl_shake256_hash, MIX_SHAKE256, BLOCK_SIZE_SHAKE256, true},
-    {"wolfcrypt-shake256", &wolfcrypt_shake256_hash, MIX_SHAKE256, BLOCK_SIZE_SHAKE256, true},
-    {"xkcp-turboshake256", &xkcp_turboshake256_hash, MIX_SHAKE256, BLOCK_SIZE_SHAKE256, true},
-    {"openssl-shake128", &openssl_shake128_hash, MIX_SHAKE128, BLOCK_SIZE_SHAKE128, true},
-    {"wolfcrypt-shake128", &wolfcrypt_shake128_hash, MIX_SHAKE128, BLOCK_SIZE_SHAKE128, true},
+    {"xkcp-xoodyak-times4", &xkcp_xoodyak_times4_hash, MIX_XOODYAK, BLOCK_SIZE_XOODYAK, true},
+    {"xkcp-xoodyak-times8", &xkcp_xoodyak_times8_hash, MIX_XOODYAK, BLOCK_SIZE_XOODYAK, true},
+    {"xkcp-xoodyak-times16", &xkcp_xoodyak_times16_hash, MIX_XOODYAK, BLOCK_SIZE_XOODYAK, true},
+    {"xkcp-xoofff-wbc", &xkcp_xoofff_wbc_ecb, MIX_XOOFFF_WBC, BLOCK_SIZE_XOOFFF_WBC, false,
+     &XKCP_XOOFFF_WBC_HOOKS},
+    {"openssl-shake256", &openssl_shake256_hash, MIX_SHAKE256, BLOCK_SIZE_SHAKE256, true,
+     &OPENSSL_SHAKE256_HOOKS, &openssl_shake256_xof},
+    {"wolfcrypt-shake256", &wolfcrypt_shake256_hash, MIX_SHAKE256, BLOCK_SIZE_SHAKE256, true, NULL,
+     &wolfcrypt_shake256_xof},
+    {"keccak-shake256", &keccak_shake256_hash, MIX_SHAKE256, BLOCK_SIZE_SHAKE256, true, NULL,
+     &keccak_shake256_xof},
+    {"xkcp-turboshake256", &xkcp_turboshake256_hash, MIX_TURBOSHAKE256, BLOCK_SIZE_TURBOSHAKE256,
+     true, NULL, &xkcp_turboshake256_xof},
+    {"openssl-shake128", &openssl_shake128_hash, MIX_SHAKE128, BLOCK_SIZE_SHAKE128, true,
+     &OPENSSL_SHAKE128_HOOKS, &openssl_shake128_xof},
+    {"wolfcrypt-shake128", &wolfcrypt_shake128_hash, MIX_SHAKE128, BLOCK_SIZE_SHAKE128, true, NULL,
+     &wolfcrypt_shake128_xof},
+    {"keccak-shake128", &keccak_shake128_hash, MIX_SHAKE128, BLOCK_SIZE_SHAKE128, true, NULL,
+     &keccak_shake128_xof},
     {"xkcp-turboshake128", &xkcp_turboshake128_hash, MIX_TURBOSHAKE128, BLOCK_SIZE_TURBOSHAKE128,
-     true},
+     true, NULL, &xkcp_turboshake128_xof},
     {"xkcp-kangarootwelve", &xkcp_kangarootwelve_hash, MIX_KANGAROOTWELVE,
-     BLOCK_SIZE_KANGAROOTWELVE, true},
-    {"xkcp-kravette-wbc", &xkcp_kravette_wbc_ecb, MIX_KRAVETTE_WBC, BLOCK_SIZE_KRAVETTE_WBC, false},
+     BLOCK_SIZE_KANGAROOTWELVE, true, NULL, &xkcp_kangarootwelve_xof},
+    {"xkcp-kravette-wbc", &xkcp_kravette_wbc_ecb, MIX_KRAVETTE_WBC, BLOCK_SIZE_KRAVETTE_WBC, false,
+     &XKCP_KRAVETTE_WBC_HOOKS},
 };
 
 // *** GET IMPLEMENTATION BY NAME ***
 
+bool is_mix_supported(mix_impl_t mix_type) {
+        switch (mix_type) {
+        case AESNI_DAVIES_MEYER_128:
+        case AESNI_MATYAS_MEYER_OSEAS_128:
+        case AESNI_HARAKA_256:
+        case AESNI_MIXCTR:
+        case AESNI_HARAKA_512:
+                return isa_has_aesni();
+        default:
+                return true;
+        }
+}
+
+bool is_block_size_supported(mix_impl_t mix_type, block_size_t block_size) {
+        mix_info_t *info = get_mix_info(mix_type);
+        if (!info || !info->block_size) {
+                return false;
+        }
+        if (block_size == info->block_size) {
+                return true;
+        }
+
+        return info->xof_function && block_size % info->block_size == 0 &&
+               block_size / info->block_size <= MAX_BLOCK_SIZE_FACTOR;
+}
+
 int get_mix_func(mix_impl_t mix_type, mix_func_t *func, block_size_t *block_size) {
         uint8_t n = sizeof(MIX_FUNCTIONS) / sizeof(*MIX_FUNCTIONS);
         if (mix_type < 0 || mix_type >= n) {
                 return 1;
         }
 
+        if (!is_mix_supported(mix_type)) {
+                _log(LOG_ERROR, "%s is not supported by this CPU\n", MIX_FUNCTIONS[mix_type].name);
+                return 1;
+        }
+
         *func       = MIX_FUNCTIONS[mix_type].function;
         *block_size = MIX_FUNCTIONS[mix_type].block_size;
         return 0;
@@ -684,6 +1163,87 @@ mix_impl_t get_mix_type(char *name) {
         return -1;
 }
 
+// *** STATEFUL MIX CONTEXT ***
+
+int mix_ctx_init(mix_ctx_t *mix_ctx, mix_impl_t mix_type, byte *iv) {
+        mix_info_t *info = get_mix_info(mix_type);
+        return mix_ctx_init_sized(mix_ctx, mix_type, iv, info ? info->block_size : 0);
+}
+
+int mix_ctx_init_sized(mix_ctx_t *mix_ctx, mix_impl_t mix_type, byte *iv,
+                       block_size_t block_size) {
+        mix_ctx->info       = get_mix_info(mix_type);
+        mix_ctx->state      = NULL;
+        mix_ctx->iv         = iv;
+        mix_ctx->block_size = block_size;
+        if (!mix_ctx->info) {
+                _log(LOG_ERROR, "Unknown mix type %d\n", mix_type);
+                return 1;
+        }
+        if (!is_mix_supported(mix_type)) {
+                _log(LOG_ERROR, "%s is not supported by this CPU\n", mix_ctx->info->name);
+                return 1;
+        }
+        if (mix_type != NONE && !is_block_size_supported(mix_type, block_size)) {
+                _log(LOG_ERROR, "%s does not support a block size of %d\n", mix_ctx->info->name,
+                     block_size);
+                return 1;
+        }
+
+        // The hooks are bound to the default block size, custom block sizes
+        // go through the stateless xof function
+        const mix_hooks_t *hooks = mix_ctx->info->hooks;
+        if (block_size != mix_ctx->info->block_size) {
+                return 0;
+        }
+        if (hooks && (*hooks->create)(&mix_ctx->state, iv)) {
+                (*hooks->destroy)(mix_ctx->state);
+                mix_ctx->state = NULL;
+                return 1;
+        }
+        return 0;
+}
+
+int mix_ctx_process(mix_ctx_t *mix_ctx, byte *in, byte *out, size_t size) {
+        const mix_hooks_t *hooks = mix_ctx->info->hooks;
+        if (mix_ctx->block_size != mix_ctx->info->block_size) {
+                return (*mix_ctx->info->xof_function)(in, out, size, mix_ctx->block_size,
+                                                      mix_ctx->iv);
+        }
+        if (hooks) {
+                return (*hooks->process)(mix_ctx->state, in, out, size);
+        }
+        return (*mix_ctx->info->function)(in, out, size, mix_ctx->iv);
+}
+
+void mix_ctx_free(mix_ctx_t *mix_ctx) {
+        if (mix_ctx->info && mix_ctx->info->hooks && mix_ctx->state) {
+                (*mix_ctx->info->hooks->destroy)(mix_ctx->state);
+        }
+        mix_ctx->state = NULL;
+}
+
+int mix_ctx_process_xor(mix_ctx_t *mix_ctx, byte *in, byte *src, byte *out, size_t size) {
+        block_size_t block_size = mix_ctx->block_size;
+        size_t tile_size        = MAX(block_size, MIX_XOR_TILE_SIZE / block_size * block_size);
+        byte tile[tile_size];
+        size_t chunk_size;
+        int err = 0;
+
+        for (size_t offset = 0; offset < size && !err; offset += chunk_size) {
+                chunk_size = MIN(tile_size, size - offset);
+
+                // The last tile is mixed up to a whole block
+                err = mix_ctx_process(mix_ctx, in + offset, tile,
+                                      block_size * CEILDIV(chunk_size, block_size));
+                if (!err)
+                        memxor(out + offset, tile, src + offset, chunk_size);
+        }
+
+        explicit_bzero(tile, tile_size);
+        return err;
+}
+
 // *** RUN MIX FUNCTION WITH MULTIPLE THREADS ***
 
 typedef struct {
@@ -740,3 +1300,75 @@ int multi_threaded_mixpass(mix_func_t mixpass, block_size_t block_size, byte *in
 
         return err;
 }
+
+typedef struct {
+        mix_impl_t mix_type;
+        byte *in;
+        byte *src;
+        byte *out;
+        size_t size;
+        byte *iv;
+        int err;
+} thr_mixpass_xor_t;
+
+void *w_thread_mixpass_xor(void *a) {
+        thr_mixpass_xor_t *thr = (thr_mixpass_xor_t *)a;
+        mix_ctx_t mix_ctx;
+
+        thr->err = mix_ctx_init(&mix_ctx, thr->mix_type, thr->iv);
+        if (!thr->err) {
+                thr->err = mix_ctx_process_xor(&mix_ctx, thr->in, thr->src, thr->out, thr->size);
+                mix_ctx_free(&mix_ctx);
+        }
+        return NULL;
+}
+
+int multi_threaded_mixpass_xor(mix_impl_t mix_type, byte *in, byte *src, byte *out, size_t size,
+                               byte *iv, uint8_t nof_threads) {
+        block_size_t block_size = get_mix_info(mix_type)->block_size;
+        uint64_t tot_macros     = CEILDIV(size, block_size);
+        int err                 = 0;
+
+        // Ensure 1 <= #threads <= #macros
+        nof_threads = MAX(1, MIN(nof_threads, tot_macros));
+
+        pthread_t threads[nof_threads];
+        thr_mixpass_xor_t args[nof_threads];
+        size_t offset = 0;
+
+        for (uint8_t t = 0; t < nof_threads; t++) {
+                thr_mixpass_xor_t *arg = args + t;
+                size_t chunk_size = block_size * get_curr_thread_size(tot_macros, t, nof_threads);
+
+                arg->mix_type = mix_type;
+                arg->in       = in + offset;
+                arg->src      = src + offset;
+                arg->out      = out + offset;
+                arg->size     = MIN(chunk_size, size - offset);
+                arg->iv       = iv;
+                arg->err      = 0;
+
+                // With 1 thread, just use the function directly
+                if (nof_threads > 1) {
+                        pthread_create(&threads[t], NULL, w_thread_mixpass_xor, arg);
+                } else {
+                        w_thread_mixpass_xor(arg);
+                }
+
+                offset += arg->size;
+        }
+
+        for (uint8_t t = 0; t < nof_threads; t++) {
+                if (nof_threads > 1) {
+                        int join_err = pthread_join(threads[t], NULL);
+                        if (join_err) {
+                                _log(LOG_ERROR, "pthread_join error %d (thread %d)\n", join_err,
+                                     t);
+                                err = join_err;
+                        }
+                }
+                err |= args[t].err;
+        }
+
+        return err;
+}
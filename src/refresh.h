@@ -3,7 +3,22 @@
 
 #include "types.h"
 
-// Use multiple-threads to refresh the initial state of the current keymix
-// counter
-int multi_threaded_refresh(byte *in, byte *out, size_t size, byte *nonce,
-                           uint64_t counter, uint8_t threads);
+// Size of the tiles in which the ctr-ctr encryption mode refreshes and mixes
+// the key at the 1st level of keymix, small enough to stay in cache in between
+#define REFRESH_TILE_SIZE (4 * 1024)
+
+// The AES-128-CTR refresh of the key of the ctr-ctr encryption mode, going
+// through consecutive chunks of it.
+typedef struct {
+        void *state;
+} refresh_ctx_t;
+
+// Initializes the refresh `ctx` with the 64-bit `nonce` (zero if NULL), from
+// the AES block `counter` of the key.
+int refresh_ctx_init(refresh_ctx_t *ctx, byte *nonce, uint64_t counter);
+
+// Refreshes the next `size` bytes of the key from `in` to `out`.
+int refresh_ctx_process(refresh_ctx_t *ctx, byte *in, byte *out, size_t size);
+
+// Frees the refresh `ctx`.
+void refresh_ctx_free(refresh_ctx_t *ctx);
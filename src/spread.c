@@ -1,7 +1,10 @@
 #include "spread.h"
 
 #include <assert.h>
+#include <stdbool.h>
+#include <string.h>
 
+#include "isa.h"
 #include "log.h"
 #include "mix.h"
 #include "utils.h"
@@ -10,7 +13,7 @@
 // following threads belonging to the same slab. The operation despite being
 // done inplace is thread-safe since there is no overlap between the read and
 // write operations of the threads.
-void spread(spread_args_t *args) {
+ISA_CLONES void spread(spread_args_t *args) {
         uint64_t tot_macros;
         uint64_t offset;
         uint64_t macros;
@@ -33,7 +36,7 @@ void spread(spread_args_t *args) {
              args->thread_id, tot_macros, offset, macros);
 
         assert(args->level >= 1);
-        prev_slab_macros = intpow(args->fanout, args->level - 1);
+        prev_slab_macros = args->prev_slab_macros;
         mini_size        = args->block_size / args->fanout;
 
         for (uint64_t macro = offset; macro < offset + macros; macro++) {
@@ -55,13 +58,14 @@ void spread(spread_args_t *args) {
         }
 }
 
-void spread_opt(spread_args_t *args) {
-        block_size_t block_size;
-        uint64_t tot_macros;
+// Body of the optimized spread. When `specialized` is true, `block_size` and
+// `fanout` must be compile-time constants, so that the slab arithmetic and the
+// swaps of the minis are resolved by the compiler.
+static inline __attribute__((always_inline)) void
+spread_opt_impl(spread_args_t *args, block_size_t block_size, uint8_t fanout, bool specialized) {
         uint64_t offset;
         uint64_t macros;
         uint64_t end;
-        uint8_t fanout;
         uint64_t prev_slab_macros;
         block_size_t mini_size;
         uint64_t prev_slabs;
@@ -72,28 +76,25 @@ void spread_opt(spread_args_t *args) {
         byte *from;
         byte *to;
 
-        buffer     = args->buffer_abs;
-        block_size = args->block_size;
-        tot_macros = args->buffer_abs_size / block_size;
+        buffer = args->buffer_abs;
 
         // Thread window start
         offset = (args->buffer - buffer) / block_size;
         // Thread window size
-        macros = args->buffer_size / args->block_size;
+        macros = args->buffer_size / block_size;
         // Thread window end
         end = offset + macros;
 
-        // _log(LOG_DEBUG, "[t=%d] tot_macros = %ld, offset = %ld, macros = %ld\n",
-        //      args->thread_id, tot_macros, offset, macros);
+        // _log(LOG_DEBUG, "[t=%d] offset = %ld, macros = %ld\n", args->thread_id, offset,
+        //      macros);
 
         assert(args->level >= 1);
-        fanout           = args->fanout;
-        prev_slab_macros = intpow(fanout, args->level - 1);
+        prev_slab_macros = args->prev_slab_macros;
         mini_size        = block_size / fanout;
 
         // To improve performance, we need to know how many previous slabs we
         // process, the one we are in and its number of macros
-        prev_slabs = ceil((double) end / prev_slab_macros) - offset / prev_slab_macros;
+        prev_slabs = CEILDIV(end, prev_slab_macros) - offset / prev_slab_macros;
         prev_slab  = (offset / prev_slab_macros) % fanout;
 
         // _log(LOG_DEBUG, "[t=%d] prev_slab_macros = %ld, prev_slabs = %ld, prev_slab = %ld\n",
@@ -137,7 +138,14 @@ void spread_opt(spread_args_t *args) {
                                 //      args->thread_id, mini, macro * fanout + mini,
                                 //      (macro + prev_slab_macros * (mini - prev_slab)) * fanout + prev_slab);
 
-                                memswap(from, to, mini_size);
+                                if (specialized) {
+                                        byte tmp[block_size / fanout];
+                                        memcpy(tmp, from, mini_size);
+                                        memcpy(from, to, mini_size);
+                                        memcpy(to, tmp, mini_size);
+                                } else {
+                                        memswap(from, to, mini_size);
+                                }
                         }
                 }
 
@@ -145,3 +153,56 @@ void spread_opt(spread_args_t *args) {
                 offset += curr_macros;
         }
 }
+
+ISA_CLONES void spread_opt(spread_args_t *args) {
+        spread_opt_impl(args, args->block_size, args->fanout, false);
+}
+
+// --------------------------------------------------------- Specialized engines
+
+// Instantiate the optimized spread for a given block size and fanout
+#define SPREAD_OPT_ENGINE(block_size, fanout)                                                      \
+        ISA_CLONES static void spread_opt_##block_size##_##fanout(spread_args_t *args) {          \
+                spread_opt_impl(args, block_size, fanout, true);                                   \
+        }
+
+FOR_EACH_ENGINE(SPREAD_OPT_ENGINE)
+
+typedef struct {
+        block_size_t block_size;
+        uint8_t fanout;
+        spread_func_t spread;
+} spread_engine_t;
+
+#define SPREAD_ENGINE_ENTRY(block_size, fanout)                                                    \
+        {block_size, fanout, &spread_opt_##block_size##_##fanout},
+
+static const spread_engine_t SPREAD_ENGINES[] = {FOR_EACH_ENGINE(SPREAD_ENGINE_ENTRY)};
+
+spread_func_t get_spread_func(block_size_t block_size, uint8_t fanout) {
+        uint8_t n = sizeof(SPREAD_ENGINES) / sizeof(*SPREAD_ENGINES);
+        for (uint8_t i = 0; i < n; i++) {
+                if (SPREAD_ENGINES[i].block_size == block_size &&
+                    SPREAD_ENGINES[i].fanout == fanout) {
+                        return SPREAD_ENGINES[i].spread;
+                }
+        }
+
+        // Fall back to the generic implementation
+        return &spread_opt;
+}
+
+uint64_t get_slab_macros(ctx_t *ctx, uint8_t level) {
+        uint64_t macros = 1;
+        for (uint8_t l = 0; l < level; l++) {
+                macros *= ctx->fanouts[l];
+        }
+        return macros;
+}
+
+void set_spread_level(ctx_t *ctx, spread_args_t *args, uint8_t level) {
+        assert(level >= 1 && level < ctx->levels);
+        args->level            = level;
+        args->fanout           = ctx->fanouts[level - 1];
+        args->prev_slab_macros = get_slab_macros(ctx, level - 1);
+}
@@ -1,13 +1,14 @@
 #ifndef SPREAD_H
 #define SPREAD_H
 
+#include "ctx.h"
 #include "mix.h"
 #include "types.h"
 #include <stdint.h>
 #include <stdlib.h>
 
 // Data needed by the in-place `spread` algorithm.
-typedef struct {
+typedef struct spread_args {
         // The (progressive) number of the thread, starting from 0.
         uint8_t thread_id;
 
@@ -27,11 +28,15 @@ typedef struct {
         // Block size of the mixing primitive
         block_size_t block_size;
 
-        // The fanout to consider.
+        // The fanout to consider at the current level.
         uint8_t fanout;
 
         // The current level at which to apply the spread.
         uint8_t level;
+
+        // The number of macros mixed together by the previous levels, i.e.,
+        // the product of their fanouts.
+        uint64_t prev_slab_macros;
 } spread_args_t;
 
 // Implements the spread algorithm in-place and can be called by multiple
@@ -41,4 +46,28 @@ void spread(spread_args_t *args);
 // Optimized version of the spread function.
 void spread_opt(spread_args_t *args);
 
+// The block sizes of the available mixing primitives paired with the fanouts
+// returned for them by `get_fanouts_from_block_size`, for which
+// `get_spread_func` has a specialized spread
+#define FOR_EACH_ENGINE(ENGINE)                                                                    \
+        ENGINE(16, 2)                                                                              \
+        ENGINE(32, 2)                                                                              \
+        ENGINE(48, 4) ENGINE(48, 3) ENGINE(48, 2)                                                  \
+        ENGINE(64, 4) ENGINE(64, 2)                                                                \
+        ENGINE(128, 8) ENGINE(128, 4) ENGINE(128, 2)                                               \
+        ENGINE(160, 10) ENGINE(160, 8) ENGINE(160, 5) ENGINE(160, 4) ENGINE(160, 2)                \
+        ENGINE(192, 12) ENGINE(192, 8) ENGINE(192, 6) ENGINE(192, 4) ENGINE(192, 3)                \
+        ENGINE(192, 2)
+
+// Get the optimized spread specialized for the given block size and fanout,
+// or the generic `spread_opt` when there is no such specialization.
+spread_func_t get_spread_func(block_size_t block_size, uint8_t fanout);
+
+// Get the number of macros mixed together by the first `level` levels of the
+// fanout schedule of `ctx`, i.e., the product of their fanouts.
+uint64_t get_slab_macros(ctx_t *ctx, uint8_t level);
+
+// Set `args` up for the spread at `level` of the fanout schedule of `ctx`.
+void set_spread_level(ctx_t *ctx, spread_args_t *args, uint8_t level);
+
 #endif
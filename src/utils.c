@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "isa.h"
 #include "log.h"
 #include "types.h"
 
@@ -39,7 +40,7 @@ inline uint64_t intpow(uint64_t base, uint64_t exp) {
         return res;
 }
 
-inline void memxor(void *dst, void *a, void *b, size_t size) {
+ISA_CLONES void memxor(void *dst, void *a, void *b, size_t size) {
         byte *d  = (byte *)dst;
         byte *s1 = (byte *)a;
         byte *s2 = (byte *)b;
@@ -49,7 +50,7 @@ inline void memxor(void *dst, void *a, void *b, size_t size) {
         }
 }
 
-inline void memswap(byte *restrict a, byte *restrict b, size_t bytes) {
+ISA_CLONES void memswap(byte *restrict a, byte *restrict b, size_t bytes) {
         byte *a_end = a + bytes;
         while (a < a_end) {
                 byte tmp = *a;
@@ -43,7 +43,7 @@
 #define LOGBASE(x, base) (round(log(x) / log(base)))
 #define ISPOWEROF(x, base) (x == pow(base, (int)LOGBASE(x, base)))
 
-#define CEILDIV(a, b) ((__typeof__(a))ceil((double)(a) / (b)))
+#define CEILDIV(a, b) ((__typeof__(a))((a) / (b) + ((a) % (b) != 0)))
 
 byte *checked_malloc(size_t size);
 
@@ -11,20 +11,50 @@
 #include "types.h"
 
 // --- XKCP Xoofff-WBC in ECB mode ---
-int xkcp_xoofff_wbc_ecb(byte *in, byte *out, size_t size, byte *iv) {
-        Xoofff_Instance xpiEnc;
 
-        int result = XoofffWBC_Initialize(&xpiEnc, iv, 8 * strlen(iv)); // max 384 bit key
+int xkcp_xoofff_wbc_create(void **state, byte *iv) {
+        Xoofff_Instance *xpiEnc = aligned_alloc(_Alignof(Xoofff_Instance), sizeof(Xoofff_Instance));
+        *state                  = xpiEnc;
+        if (!xpiEnc) {
+                _log(LOG_ERROR, "Cannot allocate memory\n");
+                return 1;
+        }
+
+        int result = XoofffWBC_Initialize(xpiEnc, iv, 8 * strlen(iv)); // max 384 bit key
         if (result) {
                 _log(LOG_ERROR, "XoofffWBC_Initialize error %d\n", result);
+                return 1;
         }
+        return 0;
+}
+
+int xkcp_xoofff_wbc_process(void *state, byte *in, byte *out, size_t size) {
+        Xoofff_Instance *xpiEnc = (Xoofff_Instance *)state;
+        int result;
 
         byte *last = in + size;
         for (; in < last; in += BLOCK_SIZE_XOOFFF_WBC, out += BLOCK_SIZE_XOOFFF_WBC) {
-                result = XoofffWBC_Encipher(&xpiEnc, in, out, 8 * BLOCK_SIZE_XOOFFF_WBC, NULL, 0); // ignore tweakable part
+                result = XoofffWBC_Encipher(xpiEnc, in, out, 8 * BLOCK_SIZE_XOOFFF_WBC, NULL, 0); // ignore tweakable part
                 if (result) {
                         _log(LOG_ERROR, "XoofffWBC_Encipher error %d\n", result);
                 }
         }
         return 0;
 }
+
+void xkcp_xoofff_wbc_destroy(void *state) {
+        if (state) {
+                explicit_bzero(state, sizeof(Xoofff_Instance));
+                free(state);
+        }
+}
+
+const mix_hooks_t XKCP_XOOFFF_WBC_HOOKS = {
+    &xkcp_xoofff_wbc_create,
+    &xkcp_xoofff_wbc_process,
+    &xkcp_xoofff_wbc_destroy,
+};
+
+int xkcp_xoofff_wbc_ecb(byte *in, byte *out, size_t size, byte *iv) {
+        return mix_hooks_run(&XKCP_XOOFFF_WBC_HOOKS, in, out, size, iv);
+}
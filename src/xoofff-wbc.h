@@ -1,5 +1,8 @@
 #include <stdlib.h>
 
+#include "mix.h"
 #include "types.h"
 
 int xkcp_xoofff_wbc_ecb(byte *in, byte *out, size_t size, byte *iv);
+
+extern const mix_hooks_t XKCP_XOOFFF_WBC_HOOKS;
@@ -1,15 +1,20 @@
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <openssl/err.h>
 #include <openssl/evp.h>
 
+#include "daemon.h"
 #include "enc.h"
 #include "keymix.h"
 #include "log.h"
+#include "spread.h"
 #include "types.h"
 #include "utils.h"
 
@@ -23,6 +28,16 @@
 #define NUM_OF_FANOUTS 3
 #define NUM_OF_FANOUTS_ENC 1
 
+#define DAEMON_CLIENTS 4
+#define DAEMON_REQUEST_SIZE (64 * SIZE_1KiB)
+#define DAEMON_REQUESTS 1000
+
+#define BATCH_LEVELS 6
+#define BATCH_MSG_SIZE 512
+#define BATCH_MESSAGES 4096
+
+#define SPREAD_KEY_SIZE (16 * SIZE_1MiB)
+
 #define MIN_KEY_SIZE (8 * SIZE_1MiB)
 #define MAX_KEY_SIZE (1.9 * SIZE_1GiB)
 
@@ -199,6 +214,38 @@ void test_ofb_enc_stream(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
         _log(LOG_INFO, "\n");
 }
 
+// Each encryption starts from the 1st chain, so the resource goes through
+// `encrypt_t` a round of keys (one per chain) at a time
+void test_ofb_multi_enc_stream(ctx_t *ctx, byte *in, byte *out, size_t size, byte *iv,
+                               uint8_t threads) {
+        size_t round_size = ctx->key_size * ctx->chains;
+
+        _log(LOG_INFO,
+             "[TEST (i=%d)] mode %s, main impl %s, one-way impl %s, fanout %d, expansion %zu: ",
+             threads, get_enc_mode_name(ctx->enc_mode), get_mix_name(ctx->mix),
+             get_mix_name(ctx->one_way_mix), ctx->fanout, CEILDIV(size, ctx->key_size));
+
+        for (uint8_t test = 0; test < NUM_OF_TESTS; test++) {
+                double time = MEASURE({
+                        size_t remaining_size = size;
+
+                        while (remaining_size > 0) {
+                                size_t to_encrypt = MIN(remaining_size, round_size);
+                                // Don't need to forward in/out
+                                encrypt_t(ctx, in, out, to_encrypt, iv, threads);
+                                remaining_size -= to_encrypt;
+                        }
+                });
+                csv_line(ctx->key_size, size, threads, ctx->enc_mode, ctx->mix, ctx->one_way_mix,
+                         ctx->fanout, time);
+                _log(LOG_INFO, ".");
+
+                // Reset ctx state for next test
+                ctx_set_ofb_chains(ctx, ctx->chains);
+        }
+        _log(LOG_INFO, "\n");
+}
+
 void do_encryption_tests(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_mix_type) {
         int err;
         byte *key;
@@ -247,19 +294,22 @@ void do_encryption_tests(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t on
                                 size_t size = *sizep;
 
                                 ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_mix_type, key,
-                                                 key_size, fanout);
+                                                 key_size, fanout, *thr);
                                 if (size < 100 * SIZE_1GiB) {
                                         out = malloc(size);
                                         in  = out;
                                         test_enc(&ctx, in, out, size, iv, *thr);
                                         free(out);
                                 } else {
-                                        out = malloc(key_size);
+                                        out = malloc(key_size * ctx.chains);
                                         in  = out;
-                                        if (enc_mode != ENC_MODE_OFB) {
-                                                test_ctr_enc_stream(&ctx, in, out, size, iv, *thr);
-                                        } else {
+                                        if (enc_mode == ENC_MODE_OFB) {
                                                 test_ofb_enc_stream(&ctx, in, out, size, iv, *thr);
+                                        } else if (enc_mode == ENC_MODE_OFB_MULTI) {
+                                                test_ofb_multi_enc_stream(&ctx, in, out, size, iv,
+                                                                          *thr);
+                                        } else {
+                                                test_ctr_enc_stream(&ctx, in, out, size, iv, *thr);
                                         }
                                         free(out);
                                 }
@@ -273,9 +323,247 @@ void do_encryption_tests(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t on
         }
 }
 
+// -------------------------------------------------- Daemon load generator
+
+typedef struct {
+        const char *path;
+        size_t size;
+        uint32_t requests;
+        // Latency of each request in ms
+        double *latencies;
+        int err;
+} thr_daemon_client_t;
+
+void *w_thread_daemon_client(void *a) {
+        thr_daemon_client_t *thr = (thr_daemon_client_t *)a;
+        byte iv[KEYMIX_IV_SIZE]  = {0};
+        byte *buffer;
+
+        int sock = keymixd_connect(thr->path);
+        if (sock < 0) {
+                thr->err = 1;
+                return NULL;
+        }
+
+        buffer = keymixd_attach(sock, thr->size);
+        if (buffer == NULL) {
+                thr->err = 1;
+                close(sock);
+                return NULL;
+        }
+        memset(buffer, 0, thr->size);
+
+        for (uint32_t r = 0; r < thr->requests && !thr->err; r++) {
+                thr->latencies[r] = MEASURE(thr->err = keymixd_encrypt(sock, 0, thr->size, iv));
+        }
+
+        munmap(buffer, thr->size);
+        close(sock);
+        return NULL;
+}
+
+int compare_latencies(const void *a, const void *b) {
+        double x = *(const double *)a;
+        double y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+// Loads the keymixd daemon listening at `path` with `clients` concurrent
+// clients, each one doing `requests` encryptions of `size` bytes, and reports
+// the throughput and the latency percentiles of the requests
+int test_daemon(const char *path, uint8_t clients, size_t size, uint32_t requests) {
+        pthread_t threads[clients];
+        thr_daemon_client_t args[clients];
+        uint64_t total_requests = (uint64_t)clients * requests;
+        double *latencies       = malloc(total_requests * sizeof(double));
+        int err                 = 0;
+
+        _log(LOG_INFO, "[TEST] daemon %s, %d clients, %zu B requests: ", path, clients, size);
+
+        double time = MEASURE({
+                for (uint8_t c = 0; c < clients; c++) {
+                        args[c].path      = path;
+                        args[c].size      = size;
+                        args[c].requests  = requests;
+                        args[c].latencies = latencies + (uint64_t)c * requests;
+                        args[c].err       = 0;
+                        pthread_create(&threads[c], NULL, w_thread_daemon_client, &args[c]);
+                }
+                for (uint8_t c = 0; c < clients; c++) {
+                        pthread_join(threads[c], NULL);
+                        err |= args[c].err;
+                }
+        });
+
+        if (err) {
+                _log(LOG_ERROR, "requests to the daemon failed\n");
+                free(latencies);
+                return 1;
+        }
+
+        qsort(latencies, total_requests, sizeof(double), compare_latencies);
+        _log(LOG_INFO, "%.2f MiB/s, %.0f req/s, p50 %.3f ms, p99 %.3f ms\n",
+             MiB(size * total_requests) / (time / 1000), total_requests / (time / 1000),
+             latencies[total_requests / 2], latencies[total_requests * 99 / 100]);
+
+        free(latencies);
+        return 0;
+}
+
+// -------------------------------------------------- Batched encryption
+
+// Encrypts `messages` messages of `size` bytes, each with its own IV, with the
+// ctr-opt encryption mode and a key of `levels` levels, one at a time and then
+// in batches of increasing size, and reports the throughput of each
+int test_batch(uint8_t levels, size_t size, uint32_t messages) {
+        mix_impl_t mix_type = AESNI_MIXCTR;
+        uint32_t nof_batches[] = {1, 2, 4, 8, 16, 32};
+        mix_func_t mix;
+        block_size_t block_size;
+        uint8_t fanout;
+        ctx_t ctx;
+        int err = 0;
+
+        if (get_mix_func(mix_type, &mix, &block_size)) {
+                _log(LOG_ERROR, "%s is not available\n", get_mix_name(mix_type));
+                return 1;
+        }
+        get_fanouts_from_mix_type(mix_type, 1, &fanout);
+
+        size_t key_size = block_size * pow(fanout, levels);
+        byte *key       = malloc(key_size);
+        byte *data      = malloc(size * messages);
+        byte *ivs_data  = malloc(KEYMIX_IV_SIZE * messages);
+        byte **ins      = malloc(messages * sizeof(byte *));
+        byte **ivs      = malloc(messages * sizeof(byte *));
+        size_t *sizes   = malloc(messages * sizeof(size_t));
+
+        memset(key, 0, key_size);
+        memset(data, 0, size * messages);
+        for (uint32_t m = 0; m < messages; m++) {
+                memset(ivs_data + KEYMIX_IV_SIZE * m, 0, KEYMIX_IV_SIZE);
+                memcpy(ivs_data + KEYMIX_IV_SIZE * m, &m, sizeof(m));
+                ins[m]   = data + size * m;
+                ivs[m]   = ivs_data + KEYMIX_IV_SIZE * m;
+                sizes[m] = size;
+        }
+
+        err = ctx_encrypt_init(&ctx, ENC_MODE_CTR_OPT, mix_type, NONE, key, key_size, fanout, 1);
+        if (err) {
+                _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
+                goto cleanup;
+        }
+
+        _log(LOG_INFO, "[TEST] batch, key %.2f MiB, %zu B messages\n", MiB(key_size), size);
+        for (uint8_t b = 0; b < sizeof(nof_batches) / sizeof(uint32_t) && !err; b++) {
+                uint32_t n  = nof_batches[b];
+                double time = MEASURE({
+                        for (uint32_t m = 0; m < messages && !err; m += n) {
+                                if (n == 1)
+                                        err = encrypt(&ctx, ins[m], ins[m], size, ivs[m]);
+                                else
+                                        err = encrypt_batch(&ctx, ins + m, ins + m, sizes + m,
+                                                            ivs + m, MIN(n, messages - m), 1);
+                        }
+                });
+                _log(LOG_INFO, "%2u messages per call: %.0f msg/s, %.2f MiB/s\n", n,
+                     messages / (time / 1000), MiB(size * messages) / (time / 1000));
+        }
+        ctx_free(&ctx);
+
+cleanup:
+        free(key);
+        free(data);
+        free(ivs_data);
+        free(ins);
+        free(ivs);
+        free(sizes);
+        return err;
+}
+
+// -------------------------------------------------- Spread engines
+
+// Spreads all the levels of `buffer`, a key of `levels` levels, with `spread`
+void spread_levels(spread_func_t spread, byte *buffer, size_t size, block_size_t block_size,
+                   uint8_t fanout, uint8_t levels) {
+        spread_args_t args = {
+                .thread_id       = 0,
+                .nof_threads     = 1,
+                .buffer          = buffer,
+                .buffer_size     = size,
+                .buffer_abs      = buffer,
+                .buffer_abs_size = size,
+                .block_size      = block_size,
+                .fanout          = fanout,
+        };
+
+        for (uint8_t l = 1; l <= levels; l++) {
+                args.level            = l;
+                args.prev_slab_macros = intpow(fanout, l - 1);
+                (*spread)(&args);
+        }
+}
+
+// Times the spreads of all the levels of a key of at least `size` bytes with
+// the generic `spread_opt` and with the engine of `get_spread_func`, for all
+// the block sizes and fanouts that have one
+void test_spread(size_t size) {
+        _log(LOG_INFO, "[TEST] spread, single thread, key of at least %.2f MiB\n", MiB(size));
+
+#define TEST_SPREAD_ENGINE(block_size, fanout)                                                     \
+        {                                                                                          \
+                uint8_t levels    = first_x_that_surpasses(size, block_size, fanout);              \
+                size_t key_size   = block_size * intpow(fanout, levels);                           \
+                byte *buffer      = malloc(key_size);                                              \
+                double time_opt   = 0;                                                             \
+                double time_spec  = 0;                                                             \
+                spread_func_t spec = get_spread_func(block_size, fanout);                          \
+                memset(buffer, 0x5c, key_size);                                                    \
+                for (uint8_t test = 0; test < NUM_OF_TESTS; test++) {                              \
+                        time_opt += MEASURE(spread_levels(&spread_opt, buffer, key_size,           \
+                                                          block_size, fanout, levels));            \
+                        time_spec += MEASURE(spread_levels(spec, buffer, key_size, block_size,     \
+                                                           fanout, levels));                       \
+                }                                                                                  \
+                double spread_mib = MiB(key_size) * levels * NUM_OF_TESTS;                         \
+                _log(LOG_INFO, "block size %3d, fanout %2d: %8.2f -> %8.2f MiB/s (%+.0f%%)\n",     \
+                     block_size, fanout, spread_mib / (time_opt / 1000),                           \
+                     spread_mib / (time_spec / 1000), 100 * (time_opt / time_spec - 1));           \
+                free(buffer);                                                                      \
+        }
+        FOR_EACH_ENGINE(TEST_SPREAD_ENGINE)
+#undef TEST_SPREAD_ENGINE
+}
+
 // -------------------------------------------------- Main loops
 
 int main(int argc, char *argv[]) {
+        if (argc > 1 && !strcmp(argv[1], "daemon")) {
+                if (argc < 3) {
+                        fprintf(stderr, "Usage: %s daemon SOCKET [CLIENTS [SIZE [REQUESTS]]]\n",
+                                argv[0]);
+                        return EXIT_FAILURE;
+                }
+                uint8_t clients   = (argc > 3 ? MAX(1, MIN(atoi(argv[3]), UINT8_MAX))
+                                              : DAEMON_CLIENTS);
+                size_t size       = (argc > 4 ? MAX(1, atol(argv[4])) : DAEMON_REQUEST_SIZE);
+                uint32_t requests = (argc > 5 ? MAX(1, atol(argv[5])) : DAEMON_REQUESTS);
+                return test_daemon(argv[2], clients, size, requests);
+        }
+
+        if (argc > 1 && !strcmp(argv[1], "batch")) {
+                uint8_t levels    = (argc > 2 ? MAX(1, MIN(atoi(argv[2]), KEYMIX_MAX_LEVELS))
+                                              : BATCH_LEVELS);
+                size_t size       = (argc > 3 ? MAX(1, atol(argv[3])) : BATCH_MSG_SIZE);
+                uint32_t messages = (argc > 4 ? MAX(1, atol(argv[4])) : BATCH_MESSAGES);
+                return test_batch(levels, size, messages);
+        }
+
+        if (argc > 1 && !strcmp(argv[1], "spread")) {
+                test_spread(argc > 2 ? MAX(1, atol(argv[2])) : SPREAD_KEY_SIZE);
+                return 0;
+        }
+
         _log(LOG_INFO, "Doing keymix\n");
         _log(LOG_INFO, "Doing encryption\n");
 
@@ -359,16 +647,21 @@ int main(int argc, char *argv[]) {
 
         csv_header();
 
-        enc_mode_t enc_modes[] = {ENC_MODE_CTR, ENC_MODE_CTR_OPT, ENC_MODE_CTR_CTR, ENC_MODE_OFB};
+        // The ofb encryption modes, which need a one-way mixing function,
+        // come last
+        enc_mode_t enc_modes[] = {ENC_MODE_CTR, ENC_MODE_CTR_OPT, ENC_MODE_CTR_CTR, ENC_MODE_OFB,
+                                  ENC_MODE_OFB_MULTI};
 
         // Run encryption modes with a mixing function (i.e., no one-way mixing)
         mix_impl_t enc_mix_types[] = {OPENSSL_AES_128,
                                       OPENSSL_MATYAS_MEYER_OSEAS_128,
                                       WOLFCRYPT_MATYAS_MEYER_OSEAS_128,
                                       AESNI_MIXCTR,
+                                      AESNI_HARAKA_256,
+                                      AESNI_HARAKA_512,
                                       XKCP_TURBOSHAKE_256,
                                       XKCP_TURBOSHAKE_128};
-        for (int i = 0; i < sizeof(enc_modes) / sizeof(enc_mode_t) - 1; i++) {
+        for (int i = 0; i < sizeof(enc_modes) / sizeof(enc_mode_t) - 2; i++) {
                 enc_mode_t enc_mode = enc_modes[i];
                 for (int j = 0; j < sizeof(enc_mix_types) / sizeof(mix_impl_t); j++) {
                         do_encryption_tests(enc_mode, enc_mix_types[j], NONE);
@@ -378,7 +671,8 @@ int main(int argc, char *argv[]) {
         // Run encryption modes with the OpenSSL AES-128-ECB mixing function and
         // another one-way mixing function
         mix_impl_t one_way_mix_types[] = {OPENSSL_MATYAS_MEYER_OSEAS_128,
-                                          WOLFCRYPT_MATYAS_MEYER_OSEAS_128, XKCP_TURBOSHAKE_256};
+                                          WOLFCRYPT_MATYAS_MEYER_OSEAS_128, AESNI_HARAKA_256,
+                                          XKCP_TURBOSHAKE_256};
         for (int i = 0; i < sizeof(enc_modes) / sizeof(enc_mode_t); i++) {
                 enc_mode_t enc_mode = enc_modes[i];
                 for (int j = 0; j < sizeof(one_way_mix_types) / sizeof(mix_impl_t); j++) {
@@ -1,14 +1,19 @@
 #include <assert.h>
 #include <math.h>
+#include <poll.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "async.h"
 #include "config.h"
 #include "enc.h"
 #include "keymix.h"
 #include "log.h"
 #include "mix.h"
+#include "refresh.h"
 #include "spread.h"
 #include "types.h"
 #include "utils.h"
@@ -18,6 +23,22 @@
 #define MIN_LEVEL 1
 #define MAX_LEVEL 5
 
+#define XOF_MAX_LEVEL 3
+
+// Levels of the keys on which the specialized spreads are verified
+#define SPREAD_ENGINE_LEVEL 4
+
+#define SCHEDULE_MAX_THREADS 8
+
+// Pairs of implementations of the same XOF, checked against each other with
+// non-default block sizes
+static const mix_impl_t XOF_PAIRS[][2] = {
+        {KECCAK_SHAKE128, OPENSSL_SHAKE128},
+        {KECCAK_SHAKE256, OPENSSL_SHAKE256},
+        {WOLFCRYPT_SHAKE128, OPENSSL_SHAKE128},
+        {WOLFCRYPT_SHAKE256, OPENSSL_SHAKE256},
+};
+
 #define COMPARE(a, b, size, ...)                                                                   \
         ({                                                                                         \
                 int _err = 0;                                                                      \
@@ -72,15 +93,16 @@ void emulate_spread(byte *buffer, size_t size, uint8_t level, block_size_t block
                 macros = tot_macros / nof_threads + (t < tot_macros % nof_threads);
                 thread_chunk_size = block_size * macros;
 
-                arg->thread_id       = t;
-                arg->nof_threads     = nof_threads;
-                arg->buffer          = offset;
-                arg->buffer_abs      = buffer;
-                arg->buffer_abs_size = size;
-                arg->buffer_size     = thread_chunk_size;
-                arg->fanout          = fanout;
-                arg->level           = level;
-                arg->block_size      = block_size;
+                arg->thread_id        = t;
+                arg->nof_threads      = nof_threads;
+                arg->buffer           = offset;
+                arg->buffer_abs       = buffer;
+                arg->buffer_abs_size  = size;
+                arg->buffer_size      = thread_chunk_size;
+                arg->fanout           = fanout;
+                arg->level            = level;
+                arg->prev_slab_macros = intpow(fanout, level - 1);
+                arg->block_size       = block_size;
 
                 if (!opt) {
                         pthread_create(&threads[t], NULL, _run_thr, arg);
@@ -189,6 +211,75 @@ int verify_shuffles_with_varying_threads(block_size_t block_size, size_t fanout,
         return err;
 }
 
+// Verify that the specialized spread of `get_spread_func` is equal to the
+// generic one at all the levels of a key of fanout^level macro blocks, with the
+// windows of any number of threads
+int verify_spread_engine(block_size_t block_size, uint8_t fanout, uint8_t level) {
+        spread_func_t engine;
+        spread_args_t args;
+        size_t size;
+        uint64_t tot_macros;
+        byte *in;
+        byte *out1;
+        byte *out2;
+        int err = 0;
+
+        size       = block_size * pow(fanout, level);
+        tot_macros = size / block_size;
+        engine     = get_spread_func(block_size, fanout);
+
+        _log(LOG_INFO, "> Verifying the spread specialized for block size %d and fanout %d\n",
+             block_size, fanout);
+
+        in   = setup(size, true);
+        out1 = setup(size, false);
+        out2 = setup(size, false);
+
+        for (uint8_t l = 1; l <= level && !err; l++) {
+                args = (spread_args_t){
+                        .thread_id        = 0,
+                        .nof_threads      = 1,
+                        .buffer           = out1,
+                        .buffer_size      = size,
+                        .buffer_abs       = out1,
+                        .buffer_abs_size  = size,
+                        .block_size       = block_size,
+                        .fanout           = fanout,
+                        .level            = l,
+                        .prev_slab_macros = intpow(fanout, l - 1),
+                };
+                memcpy(out1, in, size);
+                spread(&args);
+
+                // The windows of the threads do not overlap, so they can be
+                // spread one after the other
+                for (uint8_t nof_threads = 1; nof_threads <= fanout && !err; nof_threads++) {
+                        memcpy(out2, in, size);
+                        args.nof_threads = nof_threads;
+                        args.buffer_abs  = out2;
+                        for (uint8_t t = 0; t < nof_threads; t++) {
+                                uint64_t offset = get_curr_thread_offset(tot_macros, t,
+                                                                         nof_threads);
+                                uint64_t macros = get_curr_thread_size(tot_macros, t, nof_threads);
+
+                                args.thread_id   = t;
+                                args.buffer      = out2 + block_size * offset;
+                                args.buffer_size = block_size * macros;
+                                (*engine)(&args);
+                        }
+                        err = COMPARE(out1, out2, size,
+                                      "Spread != spread (specialized) at level %d (%d threads)\n",
+                                      l, nof_threads);
+                }
+        }
+
+        free(in);
+        free(out1);
+        free(out2);
+
+        return err;
+}
+
 // Verify the equivalence of the results when using different encryption and
 // hash libraries
 int verify_keymix(block_size_t block_size, size_t fanout, uint8_t level) {
@@ -235,35 +326,56 @@ int verify_keymix(block_size_t block_size, size_t fanout, uint8_t level) {
                 groups[6][1] = AESNI_MATYAS_MEYER_OSEAS_128;
                 break;
         case BLOCK_SIZE_SHA3_256:
-                nof_groups = 2;
+                nof_groups = 5;
                 groups[0][0] = OPENSSL_SHA3_256;
                 groups[0][1] = WOLFCRYPT_SHA3_256;
-                groups[1][0] = OPENSSL_BLAKE2S;
-                groups[1][1] = WOLFCRYPT_BLAKE2S;
+                groups[1][0] = OPENSSL_SHA3_256;
+                groups[1][1] = KECCAK_SHA3_256;
+                groups[2][0] = OPENSSL_BLAKE2S;
+                groups[2][1] = WOLFCRYPT_BLAKE2S;
+                groups[3][0] = OPENSSL_BLAKE2S;
+                groups[3][1] = SIMD_BLAKE2S;
+                groups[4][0] = BLAKE3_BLAKE3;
+                groups[4][1] = BLAKE3_BLAKE3_MANY;
                 break;
         case BLOCK_SIZE_MIXCTR:
-                nof_groups = 2;
+                nof_groups = 5;
                 groups[0][0] = AESNI_MIXCTR;
                 groups[0][1] = OPENSSL_MIXCTR;
                 groups[1][0] = OPENSSL_MIXCTR;
                 groups[1][1] = WOLFSSL_MIXCTR;
+
+                groups[2][0] = XKCP_XOODYAK;
+                groups[2][1] = XKCP_XOODYAK_TIMES4;
+                groups[3][0] = XKCP_XOODYAK;
+                groups[3][1] = XKCP_XOODYAK_TIMES8;
+                groups[4][0] = XKCP_XOODYAK;
+                groups[4][1] = XKCP_XOODYAK_TIMES16;
                 break;
         case BLOCK_SIZE_SHA3_512:
-                nof_groups = 2;
+                nof_groups = 4;
                 groups[0][0] = OPENSSL_SHA3_512;
                 groups[0][1] = WOLFCRYPT_SHA3_512;
-                groups[1][0] = OPENSSL_BLAKE2B;
-                groups[1][1] = WOLFCRYPT_BLAKE2B;
+                groups[1][0] = OPENSSL_SHA3_512;
+                groups[1][1] = KECCAK_SHA3_512;
+                groups[2][0] = OPENSSL_BLAKE2B;
+                groups[2][1] = WOLFCRYPT_BLAKE2B;
+                groups[3][0] = OPENSSL_BLAKE2B;
+                groups[3][1] = SIMD_BLAKE2B;
                 break;
         case BLOCK_SIZE_SHAKE256:
-                nof_groups = 1;
+                nof_groups = 2;
                 groups[0][0] = OPENSSL_SHAKE256;
                 groups[0][1] = WOLFCRYPT_SHAKE256;
+                groups[1][0] = OPENSSL_SHAKE256;
+                groups[1][1] = KECCAK_SHAKE256;
                 break;
         case BLOCK_SIZE_SHAKE128:
-                nof_groups = 1;
+                nof_groups = 2;
                 groups[0][0] = OPENSSL_SHAKE128;
                 groups[0][1] = WOLFCRYPT_SHAKE128;
+                groups[1][0] = OPENSSL_SHAKE128;
+                groups[1][1] = KECCAK_SHAKE128;
                 break;
         }
 
@@ -379,7 +491,7 @@ int verify_enc(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_type
         out1 = setup(resource_size, false);
         outt = setup(resource_size, false);
         
-        err = ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_type, key, key_size, fanout);
+        err = ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_type, key, key_size, fanout, 1);
         if (err) {
                 _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
                 goto cleanup;
@@ -387,9 +499,9 @@ int verify_enc(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_type
 
         encrypt(&ctx, in, out1, resource_size, iv);
         for (uint8_t nof_threads = 2; nof_threads <= fanout; nof_threads++) {
-                if (enc_mode == ENC_MODE_OFB) {
+                if (enc_mode == ENC_MODE_OFB || enc_mode == ENC_MODE_OFB_MULTI) {
                         // Reset context state for encryption
-                        memcpy(ctx.state, ctx.key, ctx.key_size);
+                        ctx_set_ofb_chains(&ctx, ctx.chains);
                 }
 
                 encrypt_t(&ctx, in, outt, resource_size, iv, fanout);
@@ -400,6 +512,41 @@ int verify_enc(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_type
                 }
         }
 
+        // The ofb chains go on from an encryption to the next one, which
+        // starts from the 1st chain
+        if (!err && (enc_mode == ENC_MODE_OFB || enc_mode == ENC_MODE_OFB_MULTI)) {
+                size_t round_size = key_size * ctx.chains;
+                size_t first_size = round_size * (resource_size / round_size / 2);
+
+                ctx_set_ofb_chains(&ctx, ctx.chains);
+                encrypt_t(&ctx, in, outt, first_size, iv, fanout);
+                encrypt_t(&ctx, in + first_size, outt + first_size, resource_size - first_size, iv,
+                          fanout);
+                err = COMPARE(out1, outt, resource_size, "Encrypt != Encrypt (2 encryptions)\n");
+        }
+
+        // With a single chain, the ofb-multi encryption mode is the ofb one
+        if (!err && enc_mode == ENC_MODE_OFB_MULTI) {
+                ctx_free(&ctx);
+                err = ctx_encrypt_init(&ctx, ENC_MODE_OFB, mix_type, one_way_type, key, key_size,
+                                       fanout, 1);
+                if (!err)
+                        encrypt(&ctx, in, out1, resource_size, iv);
+                ctx_free(&ctx);
+                if (!err)
+                        err = ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_type, key,
+                                               key_size, fanout, 1);
+                if (!err)
+                        err = ctx_set_ofb_chains(&ctx, 1);
+                if (err) {
+                        _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
+                        goto cleanup;
+                }
+                encrypt_t(&ctx, in, outt, resource_size, iv, fanout);
+                err = COMPARE(out1, outt, resource_size, "Encrypt (ofb) != Encrypt (%s, 1 chain)\n",
+                              get_enc_mode_name(enc_mode));
+        }
+
 cleanup:
         ctx_free(&ctx);
         free(key);
@@ -411,6 +558,262 @@ cleanup:
         return err;
 }
 
+// Verify that an incremental encryption, pushing chunks of random sizes (from
+// a few bytes up to more than a key), is equal to a single encryption
+int verify_stream(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_type,
+                  size_t fanout, uint8_t level) {
+        mix_func_t mix;
+        block_size_t block_size;
+        size_t key_size;
+        size_t resource_size;
+        size_t offset;
+        size_t chunk_size;
+        byte *key;
+        byte *iv;
+        byte *in;
+        byte *out1;
+        byte *outs;
+        keymix_stream_t stream;
+        ctx_t ctx;
+        int err;
+
+        if (get_mix_func(mix_type, &mix, &block_size)) {
+                _log(LOG_ERROR, "Unknown mixing implementation\n");
+                return 1;
+        }
+
+        key_size      = block_size * pow(fanout, level);
+        resource_size = (rand() % 5) * key_size + (rand() % key_size);
+
+        _log(LOG_INFO, "> Verifying incremental encryption for key size %.2f MiB\n",
+             MiB(key_size));
+
+        key  = setup(key_size, true);
+        iv   = setup(KEYMIX_IV_SIZE, true);
+        in   = setup(resource_size, true);
+        out1 = setup(resource_size, false);
+        outs = setup(resource_size, false);
+
+        err = ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_type, key, key_size, fanout, 1);
+        if (err) {
+                _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
+                goto cleanup;
+        }
+        encrypt(&ctx, in, out1, resource_size, iv);
+
+        // The stream does not depend on the state left by the encryption
+        err = keymix_stream_init(&stream, &ctx, iv, fanout);
+        if (err) {
+                _log(LOG_ERROR, "Stream initialization exited with %d\n", err);
+                goto cleanup;
+        }
+        for (offset = 0; offset < resource_size && !err; offset += chunk_size) {
+                chunk_size = rand() % (rand() % 2 ? 64 : key_size + key_size / 2);
+                chunk_size = MIN(chunk_size, resource_size - offset);
+                err        = keymix_stream_update(&stream, in + offset, outs + offset, chunk_size);
+        }
+        keymix_stream_final(&stream);
+        if (err) {
+                _log(LOG_ERROR, "Stream update exited with %d\n", err);
+                goto cleanup;
+        }
+
+        err = COMPARE(out1, outs, resource_size, "Encrypt != Encrypt (stream)\n");
+
+cleanup:
+        ctx_free(&ctx);
+        free(key);
+        free(iv);
+        free(in);
+        free(out1);
+        free(outs);
+
+        return err;
+}
+
+#define NOF_SESSIONS 4
+
+typedef struct {
+        ctx_t *ctx;
+        byte *in;
+        byte *out;
+        size_t size;
+        byte *iv;
+        unsigned int seed;
+        int err;
+} thr_session_t;
+
+void *w_thread_session(void *a) {
+        thr_session_t *thr = (thr_session_t *)a;
+        keymix_stream_t stream;
+        size_t chunk_size;
+
+        thr->err = keymix_stream_init(&stream, thr->ctx, thr->iv, 2);
+        if (thr->err)
+                return NULL;
+
+        for (size_t offset = 0; offset < thr->size && !thr->err; offset += chunk_size) {
+                chunk_size = rand_r(&thr->seed) % (thr->ctx->key_size + 1);
+                chunk_size = MIN(chunk_size, thr->size - offset);
+                thr->err   = keymix_stream_update(&stream, thr->in + offset, thr->out + offset,
+                                                  chunk_size);
+        }
+        keymix_stream_final(&stream);
+        return NULL;
+}
+
+// Verify that concurrent streams with different IVs on a shared context are
+// equal to the encryptions with a context of their own
+int verify_sessions(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_type,
+                    size_t fanout, uint8_t level) {
+        mix_func_t mix;
+        block_size_t block_size;
+        size_t key_size;
+        byte *key;
+        byte *refs[NOF_SESSIONS];
+        pthread_t threads[NOF_SESSIONS];
+        thr_session_t args[NOF_SESSIONS];
+        ctx_t ctx;
+        int err;
+
+        if (get_mix_func(mix_type, &mix, &block_size)) {
+                _log(LOG_ERROR, "Unknown mixing implementation\n");
+                return 1;
+        }
+
+        key_size = block_size * pow(fanout, level);
+
+        _log(LOG_INFO, "> Verifying concurrent sessions for key size %.2f MiB\n", MiB(key_size));
+
+        key = setup(key_size, true);
+        err = ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_type, key, key_size, fanout, 1);
+        if (err) {
+                _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
+                ctx_free(&ctx);
+                free(key);
+                return err;
+        }
+
+        for (uint8_t s = 0; s < NOF_SESSIONS; s++) {
+                args[s].ctx  = &ctx;
+                args[s].size = (rand() % 3) * key_size + (rand() % key_size);
+                args[s].in   = setup(args[s].size, true);
+                args[s].out  = setup(args[s].size, false);
+                args[s].iv   = setup(KEYMIX_IV_SIZE, true);
+                args[s].seed = rand();
+                refs[s]      = setup(args[s].size, false);
+
+                if (enc_mode == ENC_MODE_OFB || enc_mode == ENC_MODE_OFB_MULTI) {
+                        // Reset context state for encryption
+                        ctx_set_ofb_chains(&ctx, ctx.chains);
+                }
+                encrypt(&ctx, args[s].in, refs[s], args[s].size, args[s].iv);
+        }
+
+        for (uint8_t s = 0; s < NOF_SESSIONS; s++) {
+                pthread_create(&threads[s], NULL, w_thread_session, &args[s]);
+        }
+
+        for (uint8_t s = 0; s < NOF_SESSIONS; s++) {
+                pthread_join(threads[s], NULL);
+                err |= args[s].err;
+                err |= COMPARE(refs[s], args[s].out, args[s].size,
+                               "Encrypt (%s) != Encrypt (%s, session %d)\n",
+                               get_enc_mode_name(enc_mode), get_enc_mode_name(enc_mode), s);
+                free(args[s].in);
+                free(args[s].out);
+                free(args[s].iv);
+                free(refs[s]);
+        }
+
+        ctx_free(&ctx);
+        free(key);
+        return err;
+}
+
+// More messages than the lanes of a single batch
+#define NOF_BATCH_MSGS 24
+
+int verify_batch(mix_impl_t mix_type, mix_impl_t one_way_type, size_t fanout, uint8_t level) {
+        mix_func_t mix;
+        block_size_t block_size;
+        size_t key_size;
+        size_t sizes[NOF_BATCH_MSGS];
+        byte *ivs[NOF_BATCH_MSGS];
+        byte *ins[NOF_BATCH_MSGS];
+        byte *refs[NOF_BATCH_MSGS];
+        byte *outs[NOF_BATCH_MSGS];
+        byte *key;
+        ctx_t ctx;
+        int err = 0;
+
+        if (get_mix_func(mix_type, &mix, &block_size)) {
+                _log(LOG_ERROR, "Unknown mixing implementation\n");
+                return 1;
+        }
+
+        key_size = block_size * pow(fanout, level);
+
+        _log(LOG_INFO, "> Verifying batched encryption for key size %.2f MiB\n", MiB(key_size));
+
+        // Mostly short messages, with an empty one and one without an IV
+        for (uint8_t m = 0; m < NOF_BATCH_MSGS; m++) {
+                sizes[m] = (rand() % 4 ? 0 : (rand() % 3) * key_size + rand() % key_size);
+                sizes[m] = (m == 1 ? 0 : sizes[m] + rand() % 256);
+                ivs[m]   = (m == 2 ? NULL : setup(KEYMIX_IV_SIZE, true));
+                ins[m]   = setup(sizes[m], true);
+                refs[m]  = setup(sizes[m], false);
+                outs[m]  = setup(sizes[m], false);
+        }
+        key = setup(key_size, true);
+
+        err = ctx_encrypt_init(&ctx, ENC_MODE_CTR_OPT, mix_type, one_way_type, key, key_size,
+                               fanout, 1);
+        if (err) {
+                _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
+                goto cleanup;
+        }
+
+        for (uint8_t m = 0; m < NOF_BATCH_MSGS && !err; m++) {
+                err = encrypt(&ctx, ins[m], refs[m], sizes[m], ivs[m]);
+        }
+        if (!err) {
+                err = encrypt_batch(&ctx, ins, outs, sizes, ivs, NOF_BATCH_MSGS, fanout);
+        }
+        if (err) {
+                _log(LOG_ERROR, "Encryption exited with %d\n", err);
+                goto cleanup;
+        }
+
+        for (uint8_t m = 0; m < NOF_BATCH_MSGS && !err; m++) {
+                err = COMPARE(refs[m], outs[m], sizes[m], "Encrypt != Encrypt (batch)\n");
+        }
+        if (err) {
+                goto cleanup;
+        }
+
+        // A single message has fewer lanes than threads, which split its keys
+        memset(outs[0], 0, sizes[0]);
+        err = encrypt_batch(&ctx, ins, outs, sizes, ivs, 1, fanout);
+        if (err) {
+                _log(LOG_ERROR, "Encryption exited with %d\n", err);
+                goto cleanup;
+        }
+        err = COMPARE(refs[0], outs[0], sizes[0], "Encrypt != Encrypt (batch, 1 message)\n");
+
+cleanup:
+        ctx_free(&ctx);
+        free(key);
+        for (uint8_t m = 0; m < NOF_BATCH_MSGS; m++) {
+                free(ivs[m]);
+                free(ins[m]);
+                free(refs[m]);
+                free(outs[m]);
+        }
+
+        return err;
+}
+
 int verify_enc_ctr_modes(mix_impl_t mix_type, mix_impl_t one_way_type, size_t fanout,
                          uint8_t level) {
         mix_func_t mix;
@@ -422,6 +825,10 @@ int verify_enc_ctr_modes(mix_impl_t mix_type, mix_impl_t one_way_type, size_t fa
         byte *in;
         byte *out1;
         byte *out2;
+        byte *key_buffer = NULL;
+        char state_path[64];
+        char key_path[64];
+        FILE *key_file = NULL;
         ctx_t ctx;
         int err;
 
@@ -442,7 +849,8 @@ int verify_enc_ctr_modes(mix_impl_t mix_type, mix_impl_t one_way_type, size_t fa
         out1 = setup(resource_size, false);
         out2 = setup(resource_size, false);
 
-        err = ctx_encrypt_init(&ctx, ENC_MODE_CTR, mix_type, one_way_type, key, key_size, fanout);
+        err = ctx_encrypt_init(&ctx, ENC_MODE_CTR, mix_type, one_way_type, key, key_size, fanout,
+                               1);
         if (err) {
                 _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
                 goto cleanup;
@@ -450,8 +858,9 @@ int verify_enc_ctr_modes(mix_impl_t mix_type, mix_impl_t one_way_type, size_t fa
         encrypt(&ctx, in, out1, resource_size, iv);
         ctx_free(&ctx);
 
+        // Also exercise the threaded precomputation of the internal state
         err = ctx_encrypt_init(&ctx, ENC_MODE_CTR_OPT, mix_type, one_way_type, key, key_size,
-                               fanout);
+                               fanout, fanout);
         if (err) {
                 _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
                 goto cleanup;
@@ -459,9 +868,69 @@ int verify_enc_ctr_modes(mix_impl_t mix_type, mix_impl_t one_way_type, size_t fa
         encrypt(&ctx, in, out2, resource_size, iv);
 
         err = COMPARE(out1, out2, resource_size, "Encrypt (ctr) != Encrypt (ctr-opt)\n");
+        if (err) {
+                goto cleanup;
+        }
+
+        // Round-trip the precomputed state through a state file
+        sprintf(state_path, "/tmp/keymix-verify-%d.state", getpid());
+        err = ctx_save_state(&ctx, state_path);
+        ctx_free(&ctx);
+        if (err) {
+                _log(LOG_ERROR, "Saving the state exited with %d\n", err);
+                goto cleanup;
+        }
+
+        ctx_encrypt_init(&ctx, ENC_MODE_CTR, mix_type, one_way_type, key, key_size, fanout, 1);
+        err = ctx_load_state(&ctx, state_path);
+        unlink(state_path);
+        if (err) {
+                _log(LOG_ERROR, "Loading the state exited with %d\n", err);
+                goto cleanup;
+        }
+        memset(out2, 0, resource_size);
+        encrypt(&ctx, in, out2, resource_size, iv);
+
+        err = COMPARE(out1, out2, resource_size, "Encrypt (ctr) != Encrypt (ctr-opt, mapped)\n");
+        if (err) {
+                goto cleanup;
+        }
+
+        // Defer the loading of the key from its file to the first keymix,
+        // where the threads read their extents in parallel
+        ctx_free(&ctx);
+        sprintf(key_path, "/tmp/keymix-verify-%d.key", getpid());
+        key_file = fopen(key_path, "w+");
+        unlink(key_path);
+        if (key_file == NULL || fwrite(key, 1, key_size, key_file) != key_size ||
+            fflush(key_file)) {
+                _log(LOG_ERROR, "Cannot write the key file\n");
+                err = 1;
+                goto cleanup;
+        }
+
+        key_buffer = setup(key_size, false);
+        ctx_encrypt_init(&ctx, ENC_MODE_CTR, mix_type, one_way_type, key_buffer, key_size, fanout,
+                         1);
+        err = ctx_defer_key_load(&ctx, fileno(key_file));
+        if (err) {
+                _log(LOG_ERROR, "Deferring the key loading exited with %d\n", err);
+                goto cleanup;
+        }
+        memset(out2, 0, resource_size);
+        err = encrypt_t(&ctx, in, out2, resource_size, iv, fanout);
+        if (err) {
+                _log(LOG_ERROR, "Encryption with a deferred key exited with %d\n", err);
+                goto cleanup;
+        }
+
+        err = COMPARE(out1, out2, resource_size, "Encrypt (ctr) != Encrypt (ctr, deferred key)\n");
 
 cleanup:
         ctx_free(&ctx);
+        if (key_file != NULL)
+                fclose(key_file);
+        free(key_buffer);
         free(key);
         free(iv);
         free(in);
@@ -470,6 +939,333 @@ cleanup:
         return err;
 }
 
+// Verify that the ctr-ctr refresh fused into keymix is equal to a plain
+// AES-128-CTR refresh of the key followed by keymix, for any number of threads
+int verify_refresh(mix_impl_t mix_type, size_t fanout, uint8_t level) {
+        mix_func_t mix;
+        block_size_t block_size;
+        size_t key_size;
+        uint64_t counter;
+        refresh_ctx_t refresh;
+        byte *key;
+        byte *iv;
+        byte *refreshed;
+        byte *out1;
+        byte *outt;
+        ctx_t ctx;
+        int err;
+
+        if (get_mix_func(mix_type, &mix, &block_size)) {
+                _log(LOG_ERROR, "Unknown mixing implementation\n");
+                return 1;
+        }
+
+        key_size = (size_t)pow(fanout, level) * block_size;
+        counter  = (key_size / BLOCK_SIZE_AES) * (rand() % 5);
+
+        _log(LOG_INFO, "> Verifying the fused ctr-ctr refresh for key size %.2f MiB\n",
+             MiB(key_size));
+
+        key       = setup(key_size, true);
+        iv        = setup(KEYMIX_IV_SIZE, true);
+        refreshed = setup(key_size, false);
+        out1      = setup(key_size, false);
+        outt      = setup(key_size, false);
+
+        err = ctx_encrypt_init(&ctx, ENC_MODE_CTR_CTR, mix_type, NONE, key, key_size, fanout, 1);
+        if (err) {
+                _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
+                goto cleanup;
+        }
+
+        err = refresh_ctx_init(&refresh, iv, counter);
+        if (err) {
+                _log(LOG_ERROR, "Refresh initialization exited with %d\n", err);
+                goto cleanup;
+        }
+        err = refresh_ctx_process(&refresh, key, refreshed, key_size);
+        refresh_ctx_free(&refresh);
+        if (err) {
+                _log(LOG_ERROR, "Refresh exited with %d\n", err);
+                goto cleanup;
+        }
+        err = keymix_ex(&ctx, refreshed, out1, key_size, iv, 1);
+        if (err) {
+                _log(LOG_ERROR, "Keymix exited with %d\n", err);
+                goto cleanup;
+        }
+
+        for (uint8_t nof_threads = 1; nof_threads <= fanout; nof_threads++) {
+                memset(outt, 0, key_size);
+                err = keymix_refresh(&ctx, outt, key_size, iv, counter, nof_threads);
+                if (err) {
+                        _log(LOG_ERROR, "Keymix with refresh exited with %d\n", err);
+                        break;
+                }
+                err = COMPARE(out1, outt, key_size, "Refresh + Keymix != Keymix (refresh, %d)\n",
+                              nof_threads);
+                if (err) {
+                        break;
+                }
+        }
+
+cleanup:
+        ctx_free(&ctx);
+        free(key);
+        free(iv);
+        free(refreshed);
+        free(out1);
+        free(outt);
+        return err;
+}
+
+void on_job_over(keymix_job_t *job, int err, void *arg) { sem_post((sem_t *)arg); }
+
+// Verify that asynchronous encryptions on two contexts, notified by waiting, by
+// a callback and by a completion queue, are equal to the synchronous ones
+int verify_async(mix_impl_t mix_type, size_t fanout, uint8_t level) {
+        enc_mode_t enc_modes[2] = {ENC_MODE_CTR, ENC_MODE_CTR_CTR};
+        mix_func_t mix;
+        block_size_t block_size;
+        size_t key_size;
+        size_t resource_sizes[2];
+        byte *keys[2];
+        byte *ins[2];
+        byte *refs[2];
+        // Outputs notified by waiting, by the callback and by the queue
+        byte *outs[2][3];
+        keymix_job_t *jobs[2][3];
+        keymix_job_t *job;
+        keymix_queue_t queue;
+        struct pollfd pfd;
+        ctx_t ctxs[2];
+        byte *iv;
+        sem_t sem;
+        int err = 0;
+
+        if (get_mix_func(mix_type, &mix, &block_size)) {
+                _log(LOG_ERROR, "Unknown mixing implementation\n");
+                return 1;
+        }
+
+        key_size = block_size * pow(fanout, level);
+
+        _log(LOG_INFO, "> Verifying asynchronous encryption for key size %.2f MiB\n",
+             MiB(key_size));
+
+        iv = setup(KEYMIX_IV_SIZE, true);
+        for (uint8_t c = 0; c < 2; c++) {
+                resource_sizes[c] = (rand() % 5) * key_size + (rand() % key_size);
+                keys[c]           = setup(key_size, true);
+                ins[c]            = setup(resource_sizes[c], true);
+                refs[c]           = setup(resource_sizes[c], false);
+                for (uint8_t o = 0; o < 3; o++)
+                        outs[c][o] = setup(resource_sizes[c], false);
+
+                ctx_encrypt_init(&ctxs[c], enc_modes[c], mix_type, NONE, keys[c], key_size, fanout,
+                                 1);
+                encrypt(&ctxs[c], ins[c], refs[c], resource_sizes[c], iv);
+        }
+
+        sem_init(&sem, 0, 0);
+        keymix_queue_init(&queue);
+
+        // Interleave the jobs of the two contexts
+        for (uint8_t c = 0; c < 2; c++) {
+                jobs[c][0] = encrypt_submit(&ctxs[c], ins[c], outs[c][0], resource_sizes[c], iv,
+                                            fanout, NULL, NULL, NULL);
+                jobs[c][1] = encrypt_submit(&ctxs[c], ins[c], outs[c][1], resource_sizes[c], iv,
+                                            fanout, on_job_over, NULL, &sem);
+                jobs[c][2] = encrypt_submit(&ctxs[c], ins[c], outs[c][2], resource_sizes[c], iv,
+                                            fanout, NULL, &queue, NULL);
+        }
+
+        for (uint8_t c = 0; c < 2; c++) {
+                err |= keymix_job_wait(jobs[c][0]);
+                sem_wait(&sem);
+        }
+
+        pfd.fd     = queue.fd;
+        pfd.events = POLLIN;
+        for (uint8_t popped = 0; popped < 2;) {
+                poll(&pfd, 1, -1);
+                while ((job = keymix_queue_pop(&queue)) != NULL) {
+                        err |= keymix_job_err(job);
+                        popped++;
+                }
+        }
+        keymix_async_shutdown();
+
+        for (uint8_t c = 0; c < 2; c++) {
+                for (uint8_t o = 0; o < 3; o++) {
+                        err |= keymix_job_err(jobs[c][o]);
+                        err |= COMPARE(refs[c], outs[c][o], resource_sizes[c],
+                                       "Encrypt (%s) != Encrypt (%s, async %d)\n",
+                                       get_enc_mode_name(enc_modes[c]),
+                                       get_enc_mode_name(enc_modes[c]), o);
+                        keymix_job_free(jobs[c][o]);
+                        free(outs[c][o]);
+                }
+                ctx_free(&ctxs[c]);
+                free(keys[c]);
+                free(ins[c]);
+                free(refs[c]);
+        }
+        keymix_queue_free(&queue);
+        sem_destroy(&sem);
+        free(iv);
+
+        return err;
+}
+
+// Verify that keymix and encryption with a mixed-radix fanout schedule do not
+// depend on the number of threads, and that the ctr modes agree on it
+int verify_schedule(mix_impl_t mix_type, mix_impl_t one_way_type, uint8_t *fanouts,
+                    uint8_t nof_fanouts) {
+        mix_func_t mix;
+        block_size_t block_size;
+        size_t key_size;
+        size_t resource_size;
+        byte *key;
+        byte *iv;
+        byte *in;
+        byte *out1;
+        byte *outt;
+        ctx_t ctx;
+        int err;
+
+        if (get_mix_func(mix_type, &mix, &block_size)) {
+                _log(LOG_ERROR, "Unknown mixing implementation\n");
+                return 1;
+        }
+
+        key_size = block_size;
+        for (uint8_t i = 0; i < nof_fanouts; i++) {
+                key_size *= fanouts[i];
+        }
+        resource_size = (rand() % 5) * key_size + (rand() % key_size);
+
+        _log(LOG_INFO, "> Verifying fanout schedule for key size %.2f MiB\n", MiB(key_size));
+
+        key  = setup(key_size, true);
+        iv   = setup(KEYMIX_IV_SIZE, true);
+        in   = setup(resource_size, true);
+        out1 = setup(MAX(key_size, resource_size), false);
+        outt = setup(MAX(key_size, resource_size), false);
+
+        err = ctx_keymix_init_schedule(&ctx, mix_type, key, key_size, fanouts, nof_fanouts, 0);
+        if (err) {
+                _log(LOG_ERROR, "Keymix context initialization exited with %d\n", err);
+                goto cleanup;
+        }
+
+        keymix(&ctx, out1, key_size);
+        for (uint8_t nof_threads = 2; nof_threads <= SCHEDULE_MAX_THREADS; nof_threads++) {
+                keymix_t(&ctx, outt, key_size, nof_threads);
+                err = COMPARE(out1, outt, key_size, "Keymix (1) != Keymix (%d)\n", nof_threads);
+                if (err) {
+                        goto cleanup;
+                }
+        }
+
+        for (enc_mode_t enc_mode = ENC_MODE_CTR; enc_mode <= ENC_MODE_OFB_MULTI; enc_mode++) {
+                bool ofb           = (enc_mode == ENC_MODE_OFB || enc_mode == ENC_MODE_OFB_MULTI);
+                mix_impl_t one_way = (ofb ? one_way_type : NONE);
+
+                if (ofb && one_way == NONE) {
+                        continue;
+                }
+
+                ctx_free(&ctx);
+                err = ctx_encrypt_init_schedule(&ctx, enc_mode, mix_type, one_way, key, key_size,
+                                                fanouts, nof_fanouts, 0, SCHEDULE_MAX_THREADS);
+                if (err) {
+                        _log(LOG_ERROR, "Encryption context initialization exited with %d\n",
+                             err);
+                        goto cleanup;
+                }
+
+                // The ctr-opt mode must match the reference of the ctr one
+                if (enc_mode != ENC_MODE_CTR_OPT) {
+                        encrypt(&ctx, in, out1, resource_size, iv);
+                }
+                for (uint8_t nof_threads = 1; nof_threads <= SCHEDULE_MAX_THREADS;
+                     nof_threads++) {
+                        if (ofb) {
+                                // Reset context state for encryption
+                                ctx_set_ofb_chains(&ctx, ctx.chains);
+                        }
+
+                        encrypt_t(&ctx, in, outt, resource_size, iv, nof_threads);
+                        err = COMPARE(out1, outt, resource_size,
+                                      "Encrypt (%s) != Encrypt (%s, %d thr)\n",
+                                      get_enc_mode_name(enc_mode == ENC_MODE_CTR_OPT
+                                                                ? ENC_MODE_CTR
+                                                                : enc_mode),
+                                      get_enc_mode_name(enc_mode), nof_threads);
+                        if (err) {
+                                goto cleanup;
+                        }
+                }
+        }
+
+cleanup:
+        ctx_free(&ctx);
+        free(key);
+        free(iv);
+        free(in);
+        free(out1);
+        free(outt);
+
+        return err;
+}
+
+// Verify the Haraka mixes against the test vectors of Haraka v2, with the
+// input 0, 1, 2, ... Since the 512-bit mix is not truncated, its output is
+// checked on the 64-bit words making up the Haraka-512 one
+int verify_haraka() {
+        static const byte HARAKA_256_KAT[32] = {
+                0x80, 0x27, 0xcc, 0xb8, 0x79, 0x49, 0x77, 0x4b,
+                0x78, 0xd0, 0x54, 0x5f, 0xb7, 0x2b, 0xf7, 0x0c,
+                0x69, 0x5c, 0x2a, 0x09, 0x23, 0xcb, 0xd4, 0x7b,
+                0xba, 0x11, 0x59, 0xef, 0xbf, 0x2b, 0x2c, 0x1c,
+        };
+        static const byte HARAKA_512_KAT[32] = {
+                0xbe, 0x7f, 0x72, 0x3b, 0x4e, 0x80, 0xa9, 0x98,
+                0x13, 0xb2, 0x92, 0x28, 0x7f, 0x30, 0x6f, 0x62,
+                0x5a, 0x6d, 0x57, 0x33, 0x1c, 0xae, 0x5f, 0x34,
+                0xdd, 0x92, 0x77, 0xb0, 0x94, 0x5b, 0xe2, 0xaa,
+        };
+        const size_t HARAKA_512_WORDS[4] = {8, 24, 32, 48};
+        mix_func_t mix;
+        block_size_t block_size;
+        byte in[64];
+        byte out[64];
+        byte trunc[32];
+        int err = 0;
+
+        for (uint8_t i = 0; i < sizeof(in); i++) {
+                in[i] = i;
+        }
+
+        _log(LOG_INFO, "> Verifying the Haraka test vectors\n");
+
+        get_mix_func(AESNI_HARAKA_256, &mix, &block_size);
+        (*mix)(in, out, block_size, NULL);
+        err |= COMPARE(out, (byte *)HARAKA_256_KAT, sizeof(HARAKA_256_KAT),
+                       "Haraka-256 != Test vector\n");
+
+        get_mix_func(AESNI_HARAKA_512, &mix, &block_size);
+        (*mix)(in, out, block_size, NULL);
+        for (uint8_t w = 0; w < 4; w++) {
+                memcpy(trunc + 8 * w, out + HARAKA_512_WORDS[w], 8);
+        }
+        err |= COMPARE(trunc, (byte *)HARAKA_512_KAT, sizeof(HARAKA_512_KAT),
+                       "Haraka-512 != Test vector\n");
+
+        return err;
+}
+
 int custom_checks(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_type) {
         mix_func_t mix;
         block_size_t block_size;
@@ -496,15 +1292,15 @@ int custom_checks(enc_mode_t enc_mode, mix_impl_t mix_type, mix_impl_t one_way_t
         enc = setup(size, false);
         dec = setup(size, false);
 
-        err = ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_type, key, block_size, 2);
+        err = ctx_encrypt_init(&ctx, enc_mode, mix_type, one_way_type, key, block_size, 2, 1);
         if (err) {
                 _log(LOG_ERROR, "Encryption context initialization exited with %d\n", err);
                 goto cleanup;
         }
         encrypt(&ctx, in, enc, size, iv);
-        if (enc_mode == ENC_MODE_OFB) {
+        if (enc_mode == ENC_MODE_OFB || enc_mode == ENC_MODE_OFB_MULTI) {
                 // Reset context state for decryption
-                memcpy(ctx.state, ctx.key, ctx.key_size);
+                ctx_set_ofb_chains(&ctx, ctx.chains);
         }
         encrypt(&ctx, enc, dec, size, iv);
 
@@ -525,6 +1321,60 @@ cleanup:
         if (err)                                                                                   \
                 goto cleanup;
 
+// Verify that the keymix results with a non-default block size match across
+// two implementations of the same XOF and do not depend on the number of
+// threads
+int verify_xof_block_size(mix_impl_t mix_type, mix_impl_t reference, block_size_t block_size,
+                          size_t fanout, uint8_t level) {
+        size_t size;
+        byte *in;
+        byte *out1;
+        byte *outt;
+        ctx_t ctx;
+        ctx_t ref_ctx;
+        int err;
+
+        size = block_size * pow(fanout, level);
+
+        _log(LOG_INFO, "> Verifying keymix with block size %d for size %.2f MiB\n", block_size,
+             MiB(size));
+
+        in   = setup(size, true);
+        out1 = setup(size, false);
+        outt = setup(size, false);
+
+        err = ctx_keymix_init_ex(&ctx, mix_type, in, size, fanout, block_size);
+        if (err) {
+                _log(LOG_ERROR, "Keymix context initialization exited with %d\n", err);
+                goto cleanup;
+        }
+        err = ctx_keymix_init_ex(&ref_ctx, reference, in, size, fanout, block_size);
+        if (err) {
+                _log(LOG_ERROR, "Keymix context initialization exited with %d\n", err);
+                ctx_free(&ctx);
+                goto cleanup;
+        }
+
+        keymix(&ref_ctx, out1, size);
+        for (uint8_t nof_threads = 1; nof_threads <= fanout; nof_threads++) {
+                keymix_t(&ctx, outt, size, nof_threads);
+                err = COMPARE(out1, outt, size, "Keymix %s != Keymix %s (%d)\n",
+                              get_mix_name(reference), get_mix_name(mix_type), nof_threads);
+                if (err) {
+                        break;
+                }
+        }
+
+        ctx_free(&ctx);
+        ctx_free(&ref_ctx);
+cleanup:
+        free(in);
+        free(out1);
+        free(outt);
+
+        return err;
+}
+
 int main() {
         uint64_t rand_seed;
         int err;
@@ -539,6 +1389,17 @@ int main() {
         rand_seed = time(NULL);
         srand(rand_seed);
 
+        _log(LOG_INFO, "[*] Verifying the mixing primitives against test vectors\n\n");
+        CHECKED(verify_haraka());
+        _log(LOG_INFO, "\n");
+
+        _log(LOG_INFO, "[*] Verifying the specialized spreads\n\n");
+#define VERIFY_SPREAD_ENGINE(block_size, fanout)                                                   \
+        CHECKED(verify_spread_engine(block_size, fanout, SPREAD_ENGINE_LEVEL));
+        FOR_EACH_ENGINE(VERIFY_SPREAD_ENGINE)
+#undef VERIFY_SPREAD_ENGINE
+        _log(LOG_INFO, "\n");
+
         _log(LOG_INFO, "[*] Verifying keymix with varying block sizes and fanouts\n\n");
         for (uint8_t i = 0; i < sizeof(BLOCK_SIZES) / sizeof(block_size_t); i++) {
                 block_size = BLOCK_SIZES[i];
@@ -567,11 +1428,12 @@ int main() {
                 mix_info = *get_mix_info(mix_type);
                 fanouts_count = get_fanouts_from_mix_type(mix_type, NUM_OF_FANOUTS, fanouts);
 
-                for (enc_mode_t enc_mode = ENC_MODE_CTR; enc_mode <= ENC_MODE_OFB; enc_mode++) {
-                        if (enc_mode != ENC_MODE_OFB) {
+                for (enc_mode_t enc_mode = ENC_MODE_CTR; enc_mode <= ENC_MODE_OFB_MULTI;
+                     enc_mode++) {
+                        if (enc_mode < ENC_MODE_OFB) {
                                 CHECKED(custom_checks(enc_mode, mix_type, NONE));
                         } else if (mix_info.primitive != MIX_MATYAS_MEYER_OSEAS) {
-                                CHECKED(custom_checks(ENC_MODE_OFB, mix_type,
+                                CHECKED(custom_checks(enc_mode, mix_type,
                                                       OPENSSL_MATYAS_MEYER_OSEAS_128));
                         }
                 }
@@ -583,21 +1445,85 @@ int main() {
                              get_mix_name(mix_type), fanout);
                         for (uint8_t l = MIN_LEVEL; l <= MAX_LEVEL; l++) {
                                 CHECKED(verify_multithreaded_keymix(mix_type, fanout, l));
-                                for (enc_mode_t mode = ENC_MODE_CTR; mode <= ENC_MODE_OFB; mode++) {
-                                        if (mode != ENC_MODE_OFB) {
+                                for (enc_mode_t mode = ENC_MODE_CTR; mode <= ENC_MODE_OFB_MULTI;
+                                     mode++) {
+                                        if (mode < ENC_MODE_OFB) {
                                                 CHECKED(verify_enc(mode, mix_type, NONE, fanout, l));
+                                                CHECKED(verify_stream(mode, mix_type, NONE, fanout,
+                                                                      l));
+                                                CHECKED(verify_sessions(mode, mix_type, NONE,
+                                                                        fanout, l));
                                         } else if (mix_info.primitive != MIX_MATYAS_MEYER_OSEAS) {
-                                                CHECKED(verify_enc(ENC_MODE_OFB, mix_type,
+                                                CHECKED(verify_enc(mode, mix_type,
                                                                    OPENSSL_MATYAS_MEYER_OSEAS_128,
                                                                    fanout, l));
+                                                CHECKED(verify_stream(mode, mix_type,
+                                                                      OPENSSL_MATYAS_MEYER_OSEAS_128,
+                                                                      fanout, l));
+                                                CHECKED(verify_sessions(
+                                                        mode, mix_type,
+                                                        OPENSSL_MATYAS_MEYER_OSEAS_128, fanout, l));
                                         }
                                 }
                                 CHECKED(verify_enc_ctr_modes(mix_type, NONE, fanout, l));
+                                CHECKED(verify_refresh(mix_type, fanout, l));
+                                CHECKED(verify_async(mix_type, fanout, l));
+                                CHECKED(verify_batch(mix_type, NONE, fanout, l));
                         }
                         _log(LOG_INFO, "\n");
                 }
         }
 
+        _log(LOG_INFO, "[*] Verifying keymix with larger XOF block sizes\n\n");
+        for (uint8_t i = 0; i < sizeof(XOF_PAIRS) / sizeof(XOF_PAIRS[0]); i++) {
+                mix_type = XOF_PAIRS[i][0];
+                mix_info = *get_mix_info(mix_type);
+
+                for (uint8_t factor = 2; factor <= 4; factor *= 2) {
+                        block_size = factor * mix_info.block_size;
+                        fanouts_count =
+                                get_fanouts_from_block_size(block_size, NUM_OF_FANOUTS, fanouts);
+
+                        for (uint8_t j = 0; j < fanouts_count; j++) {
+                                fanout = fanouts[j];
+
+                                _log(LOG_INFO,
+                                     "Verifying with mixing implementation %s, block size %d and "
+                                     "fanout %zu\n",
+                                     get_mix_name(mix_type), block_size, fanout);
+                                for (uint8_t l = MIN_LEVEL; l <= XOF_MAX_LEVEL; l++) {
+                                        CHECKED(verify_xof_block_size(mix_type, XOF_PAIRS[i][1],
+                                                                      block_size, fanout, l));
+                                }
+                                _log(LOG_INFO, "\n");
+                        }
+                }
+        }
+
+        _log(LOG_INFO, "[*] Verifying keymix and encryption with mixed-radix fanout schedules\n\n");
+        for (uint8_t i = 0; i < sizeof(MIX_TYPES) / sizeof(mix_impl_t); i++) {
+                uint8_t schedule[4];
+
+                mix_type = MIX_TYPES[i];
+                mix_info = *get_mix_info(mix_type);
+                fanouts_count = get_fanouts_from_mix_type(mix_type, NUM_OF_FANOUTS, fanouts);
+
+                // Alternate the smallest and the highest fanouts
+                schedule[0] = fanouts[fanouts_count - 1];
+                schedule[1] = fanouts[0];
+                schedule[2] = fanouts[fanouts_count - 1];
+                schedule[3] = fanouts[0];
+
+                _log(LOG_INFO, "Verifying with mixing implementation %s and schedule %d,%d,%d,%d\n",
+                     get_mix_name(mix_type), schedule[0], schedule[1], schedule[2], schedule[3]);
+                CHECKED(verify_schedule(mix_type,
+                                        mix_info.primitive != MIX_MATYAS_MEYER_OSEAS
+                                                ? OPENSSL_MATYAS_MEYER_OSEAS_128
+                                                : NONE,
+                                        schedule, 4));
+                _log(LOG_INFO, "\n");
+        }
+
 cleanup:
         if (err)
                 _log(LOG_INFO, "Failed, seed was %u\n", rand_seed);